@@ -385,7 +385,7 @@ char *cfg_get(const char *section, const char *key, const char *defval)
     char *expression;
     char *retval;
     void *tree = NULL;
-    RESULT result = { 0, 0, 0, NULL };
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
 
     expression = cfg_lookup(section, key);
 
@@ -411,7 +411,7 @@ int cfg_number(const char *section, const char *key, const int defval, const int
 {
     char *expression;
     void *tree = NULL;
-    RESULT result = { 0, 0, 0, NULL };
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
 
     /* start with default value */
     /* in case of an (uncatched) error, you have the */
@@ -322,6 +322,7 @@ SERIAL="no"
 I2C="no"
 KEYPAD="no"
 SPIDEV="no"
+FBDEV="no"
 
 # generic libraries
 LIBUSB="no"
@@ -795,12 +796,14 @@ fi
 
 if test "$VUPLUS4K" = "yes"; then
    GRAPHIC="yes"
+   FBDEV="yes"
    DRIVERS="$DRIVERS drv_vuplus4k.o"
    AC_DEFINE(WITH_VUPLUS4K,1,[vuplus4k driver])
 fi
 
 if test "$ILI9486_FB" = "yes"; then
    GRAPHIC="yes"
+   FBDEV="yes"
    DRIVERS="$DRIVERS drv_ili9486_fb.o"
    AC_DEFINE(WITH_ILI9486_FB,1,[ili9486 fb driver])
 fi
@@ -939,6 +942,7 @@ fi
 if test "$IMAGE" = "yes"; then
    GRAPHIC="yes"
    DRIVERS="$DRIVERS drv_Image.o"
+   AC_SEARCH_LIBS(shm_open, rt)
 fi
 
 if test "$DRIVERS" = ""; then
@@ -1000,6 +1004,11 @@ if test "$SPIDEV" = "yes"; then
    AC_DEFINE(WITH_SPIDEV, 1, [SPIDEV driver])
 fi
 
+# generic framebuffer driver
+if test "$FBDEV" = "yes"; then
+   DRIVERS="$DRIVERS drv_generic_fbdev.o"
+fi
+
 # libusb
 if test "$LIBUSB" = "yes"; then
    DRVLIBS="$DRVLIBS -lusb"
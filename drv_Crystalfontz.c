@@ -38,6 +38,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/time.h>
 
 #include "debug.h"
@@ -45,6 +47,7 @@
 #include "qprintf.h"
 #include "thread.h"
 #include "timer.h"
+#include "event.h"
 #include "plugin.h"
 #include "widget.h"
 #include "widget_text.h"
@@ -77,6 +80,37 @@ struct {
     unsigned char data[16 + 1];	/* trailing '\0' */
 } Packet;
 
+/* outbound packet queue */
+#define QUEUE_SIZE 64
+#define QUEUE_TIMEOUT 250000	/* usec to wait for an acknowledge */
+#define QUEUE_RETRIES 3
+
+typedef struct {
+    unsigned char cmd;
+    unsigned char len;
+    unsigned char data[22];
+    int tries;
+    long long sent;		/* usec */
+} QUEUED;
+
+/* packets 0..InFlight-1 are sent and wait for their acknowledge */
+static QUEUED Queue[QUEUE_SIZE];
+static int Queued = 0;
+static int InFlight = 0;
+static int Window = 1;
+static int Stale = 0;		/* responses still due from before a go-back */
+
+static int Device = -1;
+
+/* queue statistics */
+static unsigned long Packets = 0;
+static unsigned long Coalesced = 0;
+static unsigned long Retransmits = 0;
+static unsigned long Acks = 0;
+static long long AckTime = 0, AckMax = 0;
+static unsigned long Frames = 0;
+static long long FrameStart = 0, FrameTime = 0, FrameMax = 0;
+
 /* Line Buffer for 633 displays */
 static unsigned char Line[2 * 16];
 
@@ -295,34 +329,328 @@ static int drv_CF_poll(void)
 }
 
 
-static void drv_CF_timer(void __attribute__ ((unused)) * notused)
+static long long drv_CF_usec(void)
 {
-    while (drv_CF_poll()) {
-	drv_CF_process_packet();
-    }
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 
-static void drv_CF_send(const unsigned char cmd, const unsigned char len, const unsigned char *data)
+static void drv_CF_transmit(const unsigned char cmd, const unsigned char len, const unsigned char *data)
 {
     /* 1 cmd + 1 len + 22 payload + 2 crc = 26 */
     unsigned char buffer[26];
     unsigned short crc;
-    struct timeval now, end;
-
-    if (len > Payload) {
-	error("%s: internal error: packet length %d exceeds payload size %d", Name, len, Payload);
-	return;
-    }
 
     buffer[0] = cmd;
     buffer[1] = len;
-    memcpy(buffer + 2, data, len);
+    if (len)
+	memcpy(buffer + 2, data, len);
     crc = CRC(buffer, len + 2, 0xffff);
     buffer[len + 2] = LSB(crc);
     buffer[len + 3] = MSB(crc);
 
     drv_generic_serial_write((char *) buffer, len + 4);
+}
+
+
+static void drv_CF_dequeue(const int i)
+{
+    if (i < InFlight)
+	InFlight--;
+    Queued--;
+    memmove(Queue + i, Queue + i + 1, (Queued - i) * sizeof(*Queue));
+}
+
+
+/* the queue ran empty: the frame is on the display */
+static void drv_CF_frame(void)
+{
+    long long t = drv_CF_usec() - FrameStart;
+
+    Frames++;
+    FrameTime += t;
+    if (t > FrameMax)
+	FrameMax = t;
+}
+
+
+/* send queued packets as long as the window is open */
+static void drv_CF_kick(void)
+{
+    while (InFlight < Window && InFlight < Queued) {
+	QUEUED *q = &Queue[InFlight++];
+	drv_CF_transmit(q->cmd, q->len, q->data);
+	q->sent = drv_CF_usec();
+	q->tries++;
+	Packets++;
+    }
+}
+
+
+/* the display answers in order, so a response belongs to Queue[0] */
+static int drv_CF_ack(const unsigned char code)
+{
+    long long t;
+    int i;
+
+    /* responses to packets sent before the last go-back */
+    if (Stale > 0) {
+	Stale--;
+	return 1;
+    }
+
+    for (i = 0; i < InFlight; i++) {
+	if (Queue[i].cmd == code)
+	    break;
+    }
+
+    if (i == InFlight)
+	return 0;
+
+    if (i > 0) {
+	/* packets 0..i-1 got lost: go back and resend from the first one */
+	/* packet i took effect, but is resent, too, so the order is kept */
+	debug("%s: lost response to cmd 0x%02x, going back", Name, Queue[0].cmd);
+	Stale = InFlight - i - 1;
+	Retransmits += InFlight;
+	InFlight = 0;
+	drv_CF_kick();
+	return 1;
+    }
+
+    t = drv_CF_usec() - Queue[0].sent;
+    Acks++;
+    AckTime += t;
+    if (t > AckMax)
+	AckMax = t;
+    drv_CF_dequeue(0);
+    if (Queued == 0)
+	drv_CF_frame();
+
+    return 1;
+}
+
+
+/* go back and resend all packets in flight, so their order is kept */
+static void drv_CF_retransmit(void)
+{
+    if (InFlight == 0 || drv_CF_usec() - Queue[0].sent < QUEUE_TIMEOUT)
+	return;
+
+    if (Queue[0].tries >= QUEUE_RETRIES) {
+	error("%s: timeout waiting for response to cmd 0x%02x, giving up", Name, Queue[0].cmd);
+	drv_CF_dequeue(0);
+	if (Queued == 0)
+	    drv_CF_frame();
+    } else {
+	debug("%s: timeout waiting for response to cmd 0x%02x, retrying", Name, Queue[0].cmd);
+    }
+
+    /* nothing came within the timeout: no more responses to expect */
+    Stale = 0;
+    Retransmits += InFlight;
+    InFlight = 0;
+    drv_CF_kick();
+}
+
+
+static void drv_CF_receive(void)
+{
+    while (drv_CF_poll()) {
+	if (Packet.type == 0x01) {
+	    if (!drv_CF_ack(Packet.code))
+		debug("%s: ignoring late response to cmd 0x%02x", Name, Packet.code);
+	} else if (Packet.type == 0x03) {
+	    /* the display rejected the packet: resending won't help */
+	    drv_CF_process_packet();
+	    drv_CF_ack(Packet.code);
+	} else {
+	    drv_CF_process_packet();
+	}
+    }
+
+    drv_CF_retransmit();
+    drv_CF_kick();
+}
+
+
+static void drv_CF_event(event_flags_t __attribute__ ((unused)) flags, void __attribute__ ((unused)) * notused)
+{
+    drv_CF_receive();
+}
+
+
+static void drv_CF_timer(void __attribute__ ((unused)) * notused)
+{
+    drv_CF_receive();
+}
+
+
+/* block until the display answers or the oldest packet is due for retransmission */
+static void drv_CF_wait(void)
+{
+    struct pollfd pfd;
+    long long due = QUEUE_TIMEOUT;
+
+    if (InFlight > 0) {
+	due = Queue[0].sent + QUEUE_TIMEOUT - drv_CF_usec();
+	if (due < 0)
+	    due = 0;
+    }
+
+    pfd.fd = Device;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, (due + 999) / 1000);
+}
+
+
+/* wait until no more than 'room' packets are queued */
+/* gives up if the queue does not shrink for a while */
+static void drv_CF_drain(const int room)
+{
+    long long end;
+    int left;
+
+    drv_CF_receive();
+
+    left = Queued;
+    end = drv_CF_usec() + QUEUE_TIMEOUT * (QUEUE_RETRIES + 1);
+
+    while (Queued > room) {
+	if (Queued < left) {
+	    left = Queued;
+	    end = drv_CF_usec() + QUEUE_TIMEOUT * (QUEUE_RETRIES + 1);
+	} else if (drv_CF_usec() > end) {
+	    error("%s: display does not respond, dropping %d packets", Name, Queued);
+	    Queued = InFlight = Stale = 0;
+	    drv_CF_frame();
+	    break;
+	}
+	drv_CF_wait();
+	drv_CF_receive();
+    }
+}
+
+
+/* wait until all queued packets are acknowledged */
+static void drv_CF_flush(void)
+{
+    drv_CF_drain(0);
+}
+
+
+/* a pending write may be merged with or replaced by a new one */
+static int drv_CF_coalesce(const unsigned char cmd, const unsigned char len, const unsigned char *data)
+{
+    unsigned char buffer[22];
+    QUEUED *q;
+    int i, col, end, qcol, qend, m, e;
+
+    /* coalescing must never move data past another command, */
+    /* e.g. a write merged into a packet queued before a clear would be erased */
+
+    /* 633: the whole line is sent anyway, replace the last pending write */
+    if (cmd == 7 || cmd == 8) {
+	if (Queued > InFlight && Queue[Queued - 1].cmd == cmd) {
+	    memcpy(Queue[Queued - 1].data, data, len);
+	    Queue[Queued - 1].len = len;
+	    return 1;
+	}
+	return 0;
+    }
+
+    if (cmd != 31)
+	return 0;
+
+    col = data[0];
+    end = col + len - 2;
+
+    /* drop pending writes which will be overwritten completely */
+    for (i = Queued - 1; i >= InFlight; i--) {
+	q = &Queue[i];
+	if (q->cmd == 31 && q->data[1] == data[1] && q->data[0] >= col && q->data[0] + q->len - 2 <= end) {
+	    drv_CF_dequeue(i);
+	    Coalesced++;
+	}
+    }
+
+    /* merge with the last pending write if they overlap or touch */
+    if (Queued == InFlight)
+	return 0;
+    q = &Queue[Queued - 1];
+    if (q->cmd != 31 || q->data[1] != data[1])
+	return 0;
+    qcol = q->data[0];
+    qend = qcol + q->len - 2;
+    if (col > qend || end < qcol)
+	return 0;
+    m = col < qcol ? col : qcol;
+    e = end > qend ? end : qend;
+    if (e - m + 2 > Payload)
+	return 0;
+
+    buffer[0] = m;
+    buffer[1] = data[1];
+    memcpy(buffer + 2 + qcol - m, q->data + 2, qend - qcol);
+    memcpy(buffer + 2 + col - m, data + 2, len - 2);
+    memcpy(q->data, buffer, e - m + 2);
+    q->len = e - m + 2;
+
+    return 1;
+}
+
+
+/* queue a packet, the acknowledge is processed later */
+static void drv_CF_queue(const unsigned char cmd, const unsigned char len, const unsigned char *data)
+{
+    QUEUED *q;
+
+    if (len > Payload) {
+	error("%s: internal error: packet length %d exceeds payload size %d", Name, len, Payload);
+	return;
+    }
+
+    if (drv_CF_coalesce(cmd, len, data)) {
+	Coalesced++;
+	return;
+    }
+
+    /* wait for room in the queue */
+    if (Queued >= QUEUE_SIZE)
+	drv_CF_drain(QUEUE_SIZE - 1);
+
+    if (Queued == 0)
+	FrameStart = drv_CF_usec();
+
+    q = &Queue[Queued++];
+    q->cmd = cmd;
+    q->len = len;
+    if (len)
+	memcpy(q->data, data, len);
+    q->tries = 0;
+    q->sent = 0;
+
+    drv_CF_kick();
+}
+
+
+/* send a packet and wait for its response */
+static void drv_CF_send(const unsigned char cmd, const unsigned char len, const unsigned char *data)
+{
+    struct timeval now, end;
+
+    if (len > Payload) {
+	error("%s: internal error: packet length %d exceeds payload size %d", Name, len, Payload);
+	return;
+    }
+
+    /* keep the order of queued packets */
+    drv_CF_flush();
+
+    drv_CF_transmit(cmd, len, data);
 
     /* wait for acknowledge packet */
     gettimeofday(&now, NULL);
@@ -332,11 +660,6 @@ static void drv_CF_send(const unsigned char cmd, const unsigned char len, const
 	if (drv_CF_poll()) {
 	    if (Packet.type == 0x01 && Packet.code == cmd) {
 		/* this is the ack we're waiting for */
-		if (0) {
-		    gettimeofday(&end, NULL);
-		    debug("%s: ACK after %ld usec", Name,
-			  1000000 * (end.tv_sec - now.tv_sec) + end.tv_usec - now.tv_usec);
-		}
 		break;
 	    } else {
 		/* some other (maybe async) packet, just process it */
@@ -470,7 +793,7 @@ static void drv_CF_write2(const int row, const int col, const char *data, const
 	return;
     }
     memcpy(Line + 16 * row + col, data, l);
-    drv_CF_send(7 + row, 16, (unsigned char *) (Line + 16 * row));
+    drv_CF_queue(7 + row, 16, (unsigned char *) (Line + 16 * row));
 }
 
 
@@ -495,7 +818,30 @@ static void drv_CF_write3(const int row, const int col, const char *data, const
     cmd[1] = row;
     memcpy(cmd + 2, data, l);
 
-    drv_CF_send(31, l + 2, cmd);
+    drv_CF_queue(31, l + 2, cmd);
+}
+
+
+/* bytes sent by drv_CF_write1(): cursor home is shorter than a goto */
+static int drv_CF_cost1(const int row, const int col, const int len)
+{
+    return (row == 0 && col == 0 ? 1 : 3) + len;
+}
+
+
+/* bytes sent by drv_CF_write2(): the whole line goes into one packet */
+static int drv_CF_cost2(const int __attribute__ ((unused)) row, const int __attribute__ ((unused)) col,
+			const int __attribute__ ((unused)) len)
+{
+    return 16 + 4;
+}
+
+
+/* bytes sent by drv_CF_write3(): col, row and data in one packet */
+static int drv_CF_cost3(const int __attribute__ ((unused)) row, const int __attribute__ ((unused)) col,
+			const int len)
+{
+    return 2 + len + 4;
 }
 
 
@@ -526,7 +872,7 @@ static void drv_CF_defchar23(const int ascii, const unsigned char *matrix)
 	buffer[i + 1] = matrix[i] & 0x3f;
     }
 
-    drv_CF_send(9, 9, buffer);
+    drv_CF_queue(9, 9, buffer);
 }
 
 
@@ -560,12 +906,12 @@ static int drv_CF_contrast(int contrast)
 	/* contrast range 0 to 50 */
 	if (Contrast > 50)
 	    Contrast = 50;
-	drv_CF_send(13, 1, &Contrast);
+	drv_CF_queue(13, 1, &Contrast);
 	break;
 
     case 3:
 	/* contrast range 0 to 255 */
-	drv_CF_send(13, 1, &Contrast);
+	drv_CF_queue(13, 1, &Contrast);
 	break;
     }
 
@@ -598,7 +944,7 @@ static int drv_CF_backlight(int backlight)
 
     case 2:
     case 3:
-	drv_CF_send(14, 1, &Backlight);
+	drv_CF_queue(14, 1, &Backlight);
 	break;
     }
 
@@ -694,12 +1040,12 @@ static int drv_CF_GPO(const int num, const int val)
     switch (Protocol) {
     case 2:
 	PWM2[num] = v;
-	drv_CF_send(17, 4, PWM2);
+	drv_CF_queue(17, 4, PWM2);
 	break;
     case 3:
 	PWM3[0] = num + 1;
 	PWM3[1] = v;
-	drv_CF_send(34, 2, PWM3);
+	drv_CF_queue(34, 2, PWM3);
 	break;
     }
 
@@ -813,7 +1159,7 @@ static void drv_CF_clear(void)
 	break;
     case 2:
     case 3:
-	drv_CF_send(6, 0, NULL);
+	drv_CF_queue(6, 0, NULL);
 	break;
     }
 }
@@ -908,7 +1254,7 @@ static int drv_CF_start(const char *section)
     }
 
     /* open serial port */
-    if (drv_generic_serial_open(section, Name, 0) < 0)
+    if ((Device = drv_generic_serial_open(section, Name, 0)) < 0)
 	return -1;
 
     /* Fixme: why such a large delay? */
@@ -936,6 +1282,9 @@ static int drv_CF_start(const char *section)
     Protocol = Models[Model].protocol;
     Payload = Models[Model].payload;
 
+    /* number of packets sent without waiting for their acknowledge */
+    if (cfg_number(section, "Window", 1, 1, QUEUE_SIZE, &Window) < 0)
+	return -1;
 
     switch (Protocol) {
 
@@ -947,6 +1296,7 @@ static int drv_CF_start(const char *section)
 	/* regularly process display answers */
 	/* Fixme: make 100msec configurable */
 	timer_add(drv_CF_timer, NULL, 100, 0);
+	event_add(drv_CF_event, NULL, Device, 1, 0, 1);
 	drv_CF_start_2();
 	/* clear 633 linebuffer */
 	memset(Line, ' ', sizeof(Line));
@@ -956,6 +1306,7 @@ static int drv_CF_start(const char *section)
 	/* regularly process display answers */
 	/* Fixme: make 100msec configurable */
 	timer_add(drv_CF_timer, NULL, 100, 0);
+	event_add(drv_CF_event, NULL, Device, 1, 0, 1);
 	drv_CF_start_3();
 	break;
     }
@@ -1075,12 +1426,14 @@ int drv_CF_init(const char *section, const int quiet)
 	CHAR0 = 128;		/* ASCII of first user-defineable char */
 	GOTO_COST = 3;		/* number of bytes a goto command requires */
 	drv_generic_text_real_write = drv_CF_write1;
+	drv_generic_text_real_cost = drv_CF_cost1;
 	drv_generic_text_real_defchar = drv_CF_defchar1;
 	break;
     case 2:
 	CHAR0 = 0;		/* ASCII of first user-defineable char */
 	GOTO_COST = -1;		/* there is no goto on 633 */
 	drv_generic_text_real_write = drv_CF_write2;
+	drv_generic_text_real_cost = drv_CF_cost2;
 	drv_generic_text_real_defchar = drv_CF_defchar23;
 	drv_generic_gpio_real_get = drv_CF_GPI;
 	drv_generic_gpio_real_set = drv_CF_GPO;
@@ -1089,6 +1442,7 @@ int drv_CF_init(const char *section, const int quiet)
 	CHAR0 = 0;		/* ASCII of first user-defineable char */
 	GOTO_COST = 3;		/* number of bytes a goto command requires */
 	drv_generic_text_real_write = drv_CF_write3;
+	drv_generic_text_real_cost = drv_CF_cost3;
 	drv_generic_text_real_defchar = drv_CF_defchar23;
 	drv_generic_gpio_real_get = drv_CF_GPI;
 	drv_generic_gpio_real_set = drv_CF_GPO;
@@ -1100,6 +1454,8 @@ int drv_CF_init(const char *section, const int quiet)
 	char buffer[40];
 	qprintf(buffer, sizeof(buffer), "%s %s", Name, Models[Model].name);
 	if (drv_generic_text_greet(buffer, "www.crystalfontz.com")) {
+	    if (Protocol >= 2)
+		drv_CF_flush();
 	    sleep(3);
 	    drv_CF_clear();
 	}
@@ -1171,6 +1527,15 @@ int drv_CF_quit(const int quiet)
 	drv_generic_text_greet("goodbye!", NULL);
     }
 
+    if (Protocol >= 2) {
+	drv_CF_flush();
+	event_del(Device);
+	debug("%s: %lu packets sent, %lu coalesced, %lu retransmitted", Name, Packets, Coalesced, Retransmits);
+	if (Acks && Frames)
+	    debug("%s: ack %lld/%lld usec, frame %lld/%lld usec (avg/max)", Name, AckTime / Acks, AckMax,
+		  FrameTime / Frames, FrameMax);
+    }
+
     drv_generic_serial_close();
 
     return (0);
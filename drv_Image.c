@@ -43,6 +43,7 @@
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 
 #ifdef WITH_PNG
@@ -89,58 +90,54 @@ static int cgap = 0;		/* column gap between characters */
 static int border = 0;		/* window border */
 
 static int dimx, dimy;		/* total window dimension in pixel */
+static int xsize, ysize;	/* image dimension including border */
+
+static int update = 100;	/* flush interval in msec */
+static int level = -1;		/* PNG compression level */
 
 static RGBA BC;
 static RGBA *drv_IMG_FB = NULL;
 
+/* display rows changed since the last flush */
+static unsigned char *drv_IMG_rows = NULL;
 static int dirty = 1;
 
+/* PPM: header and pixels, kept between flushes */
+static unsigned char *drv_IMG_PPM = NULL;
+static int drv_IMG_PPM_head = 0;
+
+#ifdef WITH_PNG
+static gdImagePtr drv_IMG_im = NULL;
+#endif
+
+/* shared memory: header followed by the current frame */
+typedef struct {
+    char magic[4];		/* "L4LI" */
+    volatile unsigned int seq;	/* odd while a frame is being written */
+    unsigned int format;	/* 1 = PPM, 2 = PNG */
+    unsigned int size;		/* size of the current frame */
+    unsigned int max;		/* room for a frame */
+} IMG_SHM;
+
+static IMG_SHM *drv_IMG_shm = NULL;
+static size_t drv_IMG_shm_size = 0;
+
+/* statistics */
+static unsigned long frames = 0;
+static unsigned long skipped = 0;
+
 /****************************************/
 /***  hardware dependant functions    ***/
 /****************************************/
 
-#ifdef WITH_PPM
-static int drv_IMG_flush_PPM(void)
+static int drv_IMG_write_file(const void *data, const size_t size)
 {
     static int seq = 0;
-    static RGBA *bitbuf = NULL;
-    static unsigned char *rowbuf = NULL;
-    int xsize, ysize, row, col, i;
-    char path[256], tmp[256], buffer[256];
+    const unsigned char *p = data;
+    size_t done = 0;
+    char path[256], tmp[256];
     int fd;
 
-    xsize = 2 * border + (DCOLS / XRES - 1) * cgap + DCOLS * pixel + (DCOLS - 1) * pgap;
-    ysize = 2 * border + (DROWS / YRES - 1) * rgap + DROWS * pixel + (DROWS - 1) * pgap;
-
-    if (bitbuf == NULL) {
-	if ((bitbuf = malloc(xsize * ysize * sizeof(*bitbuf))) == NULL) {
-	    error("%s: malloc() failed: %s", Name, strerror(errno));
-	    return -1;
-	}
-    }
-
-    if (rowbuf == NULL) {
-	if ((rowbuf = malloc(3 * xsize * sizeof(*rowbuf))) == NULL) {
-	    error("Raster: malloc() failed: %s", strerror(errno));
-	    return -1;
-	}
-    }
-
-    for (i = 0; i < xsize * ysize; i++) {
-	bitbuf[i] = BC;
-    }
-
-    for (row = 0; row < DROWS; row++) {
-	int y = border + (row / YRES) * rgap + row * (pixel + pgap);
-	for (col = 0; col < DCOLS; col++) {
-	    int x = border + (col / XRES) * cgap + col * (pixel + pgap);
-	    int a, b;
-	    for (a = 0; a < pixel; a++)
-		for (b = 0; b < pixel; b++)
-		    bitbuf[y * xsize + x + a * xsize + b] = drv_IMG_FB[row * DCOLS + col];
-	}
-    }
-
     snprintf(path, sizeof(path), output, seq++);
     qprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
@@ -155,24 +152,16 @@ static int drv_IMG_flush_PPM(void)
 	return -1;
     }
 
-    qprintf(buffer, sizeof(buffer), "P6\n%d %d\n255\n", xsize, ysize);
-    if (write(fd, buffer, strlen(buffer)) < 0) {
-	error("%s: write(%s) failed: %s", Name, tmp, strerror(errno));
-	return -1;
-    }
-
-    for (row = 0; row < ysize; row++) {
-	int c = 0;
-	for (col = 0; col < xsize; col++) {
-	    RGBA p = bitbuf[row * xsize + col];
-	    rowbuf[c++] = p.R;
-	    rowbuf[c++] = p.G;
-	    rowbuf[c++] = p.B;
-	}
-	if (write(fd, rowbuf, c) < 0) {
+    while (done < size) {
+	ssize_t n = write(fd, p + done, size - done);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
 	    error("%s: write(%s) failed: %s", Name, tmp, strerror(errno));
-	    break;
+	    close(fd);
+	    return -1;
 	}
+	done += n;
     }
 
     if (close(fd) < 0) {
@@ -186,70 +175,216 @@ static int drv_IMG_flush_PPM(void)
 
     return 0;
 }
-#endif
 
-#ifdef WITH_PNG
-static int drv_IMG_flush_PNG(void)
+
+static int drv_IMG_write_shm(const void *data, const size_t size)
 {
-    static int seq = 0;
-    int xsize, ysize, row, col;
-    char path[256], tmp[256];
-    FILE *fp;
-    int fd;
-    gdImagePtr im;
+    IMG_SHM *shm = drv_IMG_shm;
 
-    xsize = 2 * border + (DCOLS / XRES - 1) * cgap + DCOLS * pixel + (DCOLS - 1) * pgap;
-    ysize = 2 * border + (DROWS / YRES - 1) * rgap + DROWS * pixel + (DROWS - 1) * pgap;
+    if (size > shm->max) {
+	error("%s: frame of %lu bytes does not fit into shared memory", Name, (unsigned long) size);
+	return -1;
+    }
 
-    im = gdImageCreateTrueColor(xsize, ysize);
-    gdImageFilledRectangle(im, 0, 0, xsize, ysize, gdTrueColor(BC.R, BC.G, BC.B));
+    /* readers retry while seq is odd or has changed */
+    shm->seq++;
+    __sync_synchronize();
+    memcpy(shm + 1, data, size);
+    shm->size = size;
+    __sync_synchronize();
+    shm->seq++;
 
-    for (row = 0; row < DROWS; row++) {
-	int y = border + (row / YRES) * rgap + row * (pixel + pgap);
-	for (col = 0; col < DCOLS; col++) {
-	    int x = border + (col / XRES) * cgap + col * (pixel + pgap);
-	    RGBA p = drv_IMG_FB[row * DCOLS + col];
-	    int c = gdTrueColor(p.R, p.G, p.B);
-	    gdImageFilledRectangle(im, x, y, x + pixel - 1, y + pixel - 1, c);
-	}
-    }
+    return 0;
+}
 
-    snprintf(path, sizeof(path), output, seq++);
-    qprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
-    /* remove the file */
-    unlink(tmp);
+static int drv_IMG_write(const void *data, const size_t size)
+{
+    int ret = 0;
 
-    /* avoid symlink security hole:  */
-    /* open it with O_EXCL will fail if the file exists.  */
-    /* This should not happen because we just unlinked it. */
-    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
-	error("%s: open(%s) failed: %s", Name, tmp, strerror(errno));
+    if (output != NULL && *output != '\0')
+	ret |= drv_IMG_write_file(data, size);
+
+    if (drv_IMG_shm != NULL)
+	ret |= drv_IMG_write_shm(data, size);
+
+    frames++;
+
+    return ret;
+}
+
+
+static int drv_IMG_shm_open(const char *name, const size_t max)
+{
+    void *map;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT, 0644)) < 0) {
+	error("%s: shm_open(%s) failed: %s", Name, name, strerror(errno));
 	return -1;
     }
 
-    if ((fp = fdopen(fd, "w")) == NULL) {
-	error("%s: fdopen(%s) failed: %s\n", Name, tmp, strerror(errno));
+    drv_IMG_shm_size = sizeof(IMG_SHM) + max;
+    if (ftruncate(fd, drv_IMG_shm_size) < 0) {
+	error("%s: ftruncate(%s) failed: %s", Name, name, strerror(errno));
 	close(fd);
 	return -1;
     }
 
-    gdImagePng(im, fp);
-    gdImageDestroy(im);
+    map = mmap(NULL, drv_IMG_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	error("%s: mmap(%s) failed: %s", Name, name, strerror(errno));
+	return -1;
+    }
 
+    drv_IMG_shm = map;
+    memcpy(drv_IMG_shm->magic, "L4LI", 4);
+    drv_IMG_shm->seq = 0;
+    drv_IMG_shm->format = Format;
+    drv_IMG_shm->size = 0;
+    drv_IMG_shm->max = max;
 
-    if (fclose(fp) != 0) {
-	error("%s: fclose(%s) failed: %s\n", Name, tmp, strerror(errno));
+    return 0;
+}
+
+
+/* first image line of a display row */
+static int drv_IMG_y(const int row)
+{
+    return border + (row / YRES) * rgap + row * (pixel + pgap);
+}
+
+
+static int drv_IMG_x(const int col)
+{
+    return border + (col / XRES) * cgap + col * (pixel + pgap);
+}
+
+
+#ifdef WITH_PPM
+static int drv_IMG_start_PPM(void)
+{
+    char buffer[256];
+    unsigned char *p;
+    int i;
+
+    qprintf(buffer, sizeof(buffer), "P6\n%d %d\n255\n", xsize, ysize);
+    drv_IMG_PPM_head = strlen(buffer);
+
+    if ((drv_IMG_PPM = malloc(drv_IMG_PPM_head + 3 * xsize * ysize)) == NULL) {
+	error("%s: malloc() failed: %s", Name, strerror(errno));
 	return -1;
     }
 
-    if (rename(tmp, path) < 0) {
-	error("%s: rename(%s) failed: %s\n", Name, tmp, strerror(errno));
+    memcpy(drv_IMG_PPM, buffer, drv_IMG_PPM_head);
+    p = drv_IMG_PPM + drv_IMG_PPM_head;
+    for (i = 0; i < xsize * ysize; i++) {
+	*p++ = BC.R;
+	*p++ = BC.G;
+	*p++ = BC.B;
+    }
+
+    return 0;
+}
+
+
+/* regenerate the scanlines of one display row */
+static void drv_IMG_row_PPM(const int row)
+{
+    unsigned char *line;
+    int col, a;
+
+    line = drv_IMG_PPM + drv_IMG_PPM_head + 3 * drv_IMG_y(row) * xsize;
+
+    for (col = 0; col < DCOLS; col++) {
+	RGBA p = drv_IMG_FB[row * DCOLS + col];
+	unsigned char *d = line + 3 * drv_IMG_x(col);
+	for (a = 0; a < pixel; a++) {
+	    *d++ = p.R;
+	    *d++ = p.G;
+	    *d++ = p.B;
+	}
+    }
+
+    /* gaps are background, so the whole line can be replicated */
+    for (a = 1; a < pixel; a++)
+	memcpy(line + 3 * a * xsize, line, 3 * xsize);
+}
+
+
+static int drv_IMG_flush_PPM(void)
+{
+    int row;
+
+    for (row = 0; row < DROWS; row++) {
+	if (drv_IMG_rows[row]) {
+	    drv_IMG_row_PPM(row);
+	    drv_IMG_rows[row] = 0;
+	}
+    }
+
+    return drv_IMG_write(drv_IMG_PPM, drv_IMG_PPM_head + 3 * xsize * ysize);
+}
+#endif
+
+#ifdef WITH_PNG
+static int drv_IMG_start_PNG(void)
+{
+    if ((drv_IMG_im = gdImageCreateTrueColor(xsize, ysize)) == NULL) {
+	error("%s: gdImageCreateTrueColor() failed", Name);
 	return -1;
     }
+    gdImageFilledRectangle(drv_IMG_im, 0, 0, xsize, ysize, gdTrueColor(BC.R, BC.G, BC.B));
 
     return 0;
 }
+
+
+/* regenerate the scanlines of one display row */
+static void drv_IMG_row_PNG(const int row)
+{
+    int *line;
+    int y, col, a;
+
+    y = drv_IMG_y(row);
+    line = drv_IMG_im->tpixels[y];
+
+    for (col = 0; col < DCOLS; col++) {
+	RGBA p = drv_IMG_FB[row * DCOLS + col];
+	int c = gdTrueColor(p.R, p.G, p.B);
+	int *d = line + drv_IMG_x(col);
+	for (a = 0; a < pixel; a++)
+	    *d++ = c;
+    }
+
+    for (a = 1; a < pixel; a++)
+	memcpy(drv_IMG_im->tpixels[y + a], line, xsize * sizeof(*line));
+}
+
+
+static int drv_IMG_flush_PNG(void)
+{
+    void *data;
+    int row, size, ret;
+
+    for (row = 0; row < DROWS; row++) {
+	if (drv_IMG_rows[row]) {
+	    drv_IMG_row_PNG(row);
+	    drv_IMG_rows[row] = 0;
+	}
+    }
+
+    if ((data = gdImagePngPtrEx(drv_IMG_im, &size, level)) == NULL) {
+	error("%s: gdImagePngPtrEx() failed", Name);
+	return -1;
+    }
+
+    ret = drv_IMG_write(data, size);
+    gdFree(data);
+
+    return ret;
+}
 #endif
 
 
@@ -278,20 +413,28 @@ static void drv_IMG_timer( __attribute__ ((unused))
     if (dirty) {
 	drv_IMG_flush();
 	dirty = 0;
+    } else {
+	skipped++;
     }
 }
 
 
 static void drv_IMG_blit(const int row, const int col, const int height, const int width)
 {
+    RGBA *rect;
     int r, c;
 
+    rect = drv_generic_graphic_compose_rect(row, col, height, width);
+    if (rect == NULL)
+	return;
+
     for (r = row; r < row + height; r++) {
 	for (c = col; c < col + width; c++) {
 	    RGBA p1 = drv_IMG_FB[r * DCOLS + c];
-	    RGBA p2 = drv_generic_graphic_rgb(r, c);
+	    RGBA p2 = *rect++;
 	    if (p1.R != p2.R || p1.G != p2.G || p1.B != p2.B) {
 		drv_IMG_FB[r * DCOLS + c] = p2;
+		drv_IMG_rows[r] = 1;
 		dirty = 1;
 	    }
 	}
@@ -301,14 +444,9 @@ static void drv_IMG_blit(const int row, const int col, const int height, const i
 
 static int drv_IMG_start(const char *section)
 {
-    int i;
+    int i, max;
     char *s;
 
-    if (output == NULL || *output == '\0') {
-	error("%s: no output file specified (use -o switch)", Name);
-	return -1;
-    }
-
     /* read file format from config */
     s = cfg_get(section, "Format", NULL);
     if (s == NULL || *s == '\0') {
@@ -381,6 +519,14 @@ static int drv_IMG_start(const char *section)
     }
     free(s);
 
+    /* flush interval in msec, unchanged images are skipped */
+    if (cfg_number(section, "update", 100, 10, -1, &update) < 0)
+	return -1;
+
+    /* PNG compression level, -1 is the zlib default */
+    if (cfg_number(section, "Compression", -1, -1, 9, &level) < 0)
+	return -1;
+
     drv_IMG_FB = malloc(DCOLS * DROWS * sizeof(*drv_IMG_FB));
     if (drv_IMG_FB == NULL) {
 	error("%s: framebuffer could not be allocated: malloc() failed", Name);
@@ -391,16 +537,63 @@ static int drv_IMG_start(const char *section)
 	drv_IMG_FB[i] = BC;
     }
 
+    /* all rows have to be drawn initially */
+    drv_IMG_rows = malloc(DROWS);
+    if (drv_IMG_rows == NULL) {
+	error("%s: malloc() failed: %s", Name, strerror(errno));
+	return -1;
+    }
+    memset(drv_IMG_rows, 1, DROWS);
+
     dimx = DCOLS * pixel + (DCOLS - 1) * pgap + (DCOLS / XRES - 1) * cgap;
     dimy = DROWS * pixel + (DROWS - 1) * pgap + (DROWS / YRES - 1) * rgap;
 
+    xsize = 2 * border + dimx;
+    ysize = 2 * border + dimy;
+
+    switch (Format) {
+#ifdef WITH_PPM
+    case PPM:
+	if (drv_IMG_start_PPM() < 0)
+	    return -1;
+	max = drv_IMG_PPM_head + 3 * xsize * ysize;
+	break;
+#endif
+#ifdef WITH_PNG
+    case PNG:
+	if (drv_IMG_start_PNG() < 0)
+	    return -1;
+	/* uncompressed scanlines plus deflate and chunk overhead */
+	max = ysize * (1 + 3 * xsize);
+	max += max / 64 + 1024;
+	break;
+#endif
+    default:
+	return -1;
+    }
+
+    /* optional shared memory output */
+    s = cfg_get(section, "Shared", NULL);
+    if (s != NULL && *s != '\0') {
+	if (drv_IMG_shm_open(s, max) < 0) {
+	    free(s);
+	    return -1;
+	}
+	info("%s: writing to shared memory %s", Name, s);
+    }
+    free(s);
+
+    if ((output == NULL || *output == '\0') && drv_IMG_shm == NULL) {
+	error("%s: no output file specified (use -o switch)", Name);
+	return -1;
+    }
 
     /* initially flush the image to a file */
     drv_IMG_flush();
+    dirty = 0;
 
     /* regularly flush the image to a file */
-    /* Fixme: make 100msec configurable */
-    timer_add(drv_IMG_timer, NULL, 100, 0);
+    timer_add(drv_IMG_timer, NULL, update, 0);
 
 
     return 0;
@@ -468,11 +661,34 @@ int drv_IMG_quit(const __attribute__ ((unused))
     info("%s: shutting down.", Name);
     drv_generic_graphic_quit();
 
+    debug("%s: %lu frames written, %lu skipped", Name, frames, skipped);
+
     if (drv_IMG_FB) {
 	free(drv_IMG_FB);
 	drv_IMG_FB = NULL;
     }
 
+    if (drv_IMG_rows) {
+	free(drv_IMG_rows);
+	drv_IMG_rows = NULL;
+    }
+
+    if (drv_IMG_PPM) {
+	free(drv_IMG_PPM);
+	drv_IMG_PPM = NULL;
+    }
+#ifdef WITH_PNG
+    if (drv_IMG_im) {
+	gdImageDestroy(drv_IMG_im);
+	drv_IMG_im = NULL;
+    }
+#endif
+
+    if (drv_IMG_shm) {
+	munmap(drv_IMG_shm, drv_IMG_shm_size);
+	drv_IMG_shm = NULL;
+    }
+
     return (0);
 }
 
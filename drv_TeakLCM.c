@@ -827,6 +827,14 @@ static void drv_TeakLCM_write(const int row, const int col, const char *data, in
 }
 
 
+/* every write sends the whole line */
+static int drv_TeakLCM_cost(const int __attribute__ ((unused)) row, const int __attribute__ ((unused)) col,
+			    const int __attribute__ ((unused)) len)
+{
+    return DCOLS;
+}
+
+
 static
 void try_reset(void)
 {
@@ -963,6 +971,7 @@ int drv_TeakLCM_init(const char *section, const int quiet)
 
     /* real worker functions */
     drv_generic_text_real_write = drv_TeakLCM_write;
+    drv_generic_text_real_cost = drv_TeakLCM_cost;
 
     /* start display */
     if ((ret = drv_TeakLCM_start(section)) != 0)
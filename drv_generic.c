@@ -31,6 +31,19 @@
  * drv_generic_init (void)
  *   initializes generic stuff and registers plugins
  *
+ * drv_generic_frame_begin (void)
+ *   starts a frame: blits are collected until the frame ends
+ *
+ * drv_generic_frame_add (row, col, height, width)
+ *   adds a blit to the current frame, returns 0 if there is none
+ *
+ * drv_generic_frame_end (void)
+ *   ends a frame and sends all collected areas to the display
+ *   calls drv_generic_flush() afterwards
+ *
+ * drv_generic_frame_active (void)
+ *   returns 1 while a frame is open or being sent, 0 otherwise
+ *
  */
 
 
@@ -61,6 +74,20 @@ int YRES = 8;			/* pixel height of one char */
 
 
 void (*drv_generic_blit) () = NULL;
+void (*drv_generic_flush) () = NULL;
+
+
+/* dirty areas collected during a frame */
+#define FRAME_RECTS 16
+
+typedef struct {
+    int row, col, height, width;
+} FRAME_RECT;
+
+static FRAME_RECT Frame[FRAME_RECTS];
+static int nFrame = 0;
+static int FrameDepth = 0;
+static int FrameSending = 0;
 
 
 static void my_drows(RESULT * result)
@@ -99,6 +126,107 @@ static void my_lcols(RESULT * result)
     SetResult(&result, R_NUMBER, &value);
 }
 
+/* area of the bounding box of two rectangles */
+static int drv_generic_frame_union(const FRAME_RECT * a, const FRAME_RECT * b, FRAME_RECT * u)
+{
+    int r2 = a->row + a->height > b->row + b->height ? a->row + a->height : b->row + b->height;
+    int c2 = a->col + a->width > b->col + b->width ? a->col + a->width : b->col + b->width;
+
+    u->row = a->row < b->row ? a->row : b->row;
+    u->col = a->col < b->col ? a->col : b->col;
+    u->height = r2 - u->row;
+    u->width = c2 - u->col;
+
+    return u->height * u->width;
+}
+
+
+void drv_generic_frame_begin(void)
+{
+    FrameDepth++;
+}
+
+
+int drv_generic_frame_add(const int row, const int col, const int height, const int width)
+{
+    FRAME_RECT rect, u;
+    int i, best, waste, area, min;
+
+    /* no frame open: blit immediately */
+    if (FrameDepth == 0)
+	return 0;
+
+    if (height < 1 || width < 1)
+	return 1;
+
+    rect.row = row;
+    rect.col = col;
+    rect.height = height;
+    rect.width = width;
+    area = height * width;
+
+    /* merge with an area if the bounding box covers (almost) nothing else */
+    for (i = 0; i < nFrame; i++) {
+	int a = Frame[i].height * Frame[i].width;
+	if (drv_generic_frame_union(&Frame[i], &rect, &u) <= (a + area) + (a + area) / 4) {
+	    Frame[i] = u;
+	    return 1;
+	}
+    }
+
+    if (nFrame < FRAME_RECTS) {
+	Frame[nFrame++] = rect;
+	return 1;
+    }
+
+    /* out of slots: merge with the area growing least */
+    best = 0;
+    min = -1;
+    for (i = 0; i < nFrame; i++) {
+	waste = drv_generic_frame_union(&Frame[i], &rect, &u) - Frame[i].height * Frame[i].width;
+	if (min < 0 || waste < min) {
+	    min = waste;
+	    best = i;
+	}
+    }
+    drv_generic_frame_union(&Frame[best], &rect, &Frame[best]);
+
+    return 1;
+}
+
+
+void drv_generic_frame_end(void)
+{
+    FRAME_RECT rect[FRAME_RECTS];
+    int i, n;
+
+    if (FrameDepth == 0 || --FrameDepth > 0)
+	return;
+
+    /* the driver may start another frame while we are flushing, */
+    /* which must not overwrite the areas still to be sent */
+    n = nFrame;
+    memcpy(rect, Frame, n * sizeof(*rect));
+    nFrame = 0;
+
+    FrameSending++;
+    for (i = 0; i < n; i++) {
+	if (drv_generic_blit)
+	    drv_generic_blit(rect[i].row, rect[i].col, rect[i].height, rect[i].width);
+    }
+    FrameSending--;
+
+    if (drv_generic_flush && FrameSending == 0)
+	drv_generic_flush();
+}
+
+
+int drv_generic_frame_active(void)
+{
+    return FrameDepth > 0 || FrameSending > 0;
+}
+
+
 int drv_generic_init(void)
 {
 
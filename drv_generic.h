@@ -38,6 +38,15 @@ extern int XRES, YRES;		/* pixel width/height of one char */
 /* these function must be implemented by the generic driver */
 extern void (*drv_generic_blit) (const int row, const int col, const int height, const int width);
 
+/* this function may be implemented by a transport helper, it is called at the end of a frame */
+extern void (*drv_generic_flush) (void);
+
 int drv_generic_init(void);
 
+/* frame transactions: collect blits and send them at once */
+void drv_generic_frame_begin(void);
+int drv_generic_frame_add(const int row, const int col, const int height, const int width);
+void drv_generic_frame_end(void);
+int drv_generic_frame_active(void);
+
 #endif
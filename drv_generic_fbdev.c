@@ -0,0 +1,344 @@
+/* $Id$
+ * $URL$
+ *
+ * generic driver helper for Linux framebuffer devices
+ *
+ * Copyright (C) 2026 The LCD4Linux Team <lcd4linux-devel@users.sourceforge.net>
+ *
+ * This file is part of LCD4Linux.
+ *
+ * LCD4Linux is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * LCD4Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * The framebuffer is mapped into memory, pixels are converted
+ * directly into it in the device's native format. If the device
+ * has room for two pages and supports panning, the rectangles are
+ * drawn into the hidden page, which is panned in once per frame by
+ * drv_generic_flush(). The changed area is copied back so both pages
+ * stay identical.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#include "debug.h"
+#include "drv_generic.h"
+#include "drv_generic_graphic.h"
+#include "drv_generic_fbdev.h"
+
+#ifdef WITH_DMALLOC
+#include <dmalloc.h>
+#endif
+
+static char *generic_fbdev_driver = "";
+static int generic_fbdev_fd = -1;
+
+static struct fb_var_screeninfo generic_fbdev_var;
+static struct fb_fix_screeninfo generic_fbdev_fix;
+
+static unsigned char *generic_fbdev_map = NULL;
+static size_t generic_fbdev_size = 0;
+
+/* double buffering: number of pages and the visible one */
+static int generic_fbdev_pages = 1;
+static int generic_fbdev_page = 0;
+
+/* bounding box of the areas drawn into the hidden page */
+static int generic_fbdev_dirty = 0;
+static int generic_fbdev_top, generic_fbdev_left, generic_fbdev_bottom, generic_fbdev_right;
+
+/* statistics */
+static unsigned long generic_fbdev_blits = 0;
+static unsigned long generic_fbdev_pans = 0;
+static unsigned long generic_fbdev_bytes = 0;
+
+
+static uint32_t drv_generic_fbdev_pixel(const RGBA p)
+{
+    struct fb_var_screeninfo *v = &generic_fbdev_var;
+    uint32_t pixel;
+
+    pixel = ((uint32_t) (p.R >> (8 - v->red.length)) << v->red.offset) |
+	((uint32_t) (p.G >> (8 - v->green.length)) << v->green.offset) |
+	((uint32_t) (p.B >> (8 - v->blue.length)) << v->blue.offset);
+
+    /* opaque */
+    if (v->transp.length)
+	pixel |= (uint32_t) (0xff >> (8 - v->transp.length)) << v->transp.offset;
+
+    return pixel;
+}
+
+
+/* converts a row of pixels, returns the number of changed pixels */
+static int drv_generic_fbdev_row16(uint16_t * dst, const RGBA * src, const int width)
+{
+    int c, n = 0;
+
+    for (c = 0; c < width; c++) {
+	uint16_t p = drv_generic_fbdev_pixel(src[c]);
+	if (dst[c] != p) {
+	    dst[c] = p;
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+
+static int drv_generic_fbdev_row32(uint32_t * dst, const RGBA * src, const int width)
+{
+    int c, n = 0;
+
+    for (c = 0; c < width; c++) {
+	uint32_t p = drv_generic_fbdev_pixel(src[c]);
+	if (dst[c] != p) {
+	    dst[c] = p;
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+
+static unsigned char *drv_generic_fbdev_addr(const int page, const int row, const int col)
+{
+    return generic_fbdev_map + (page * generic_fbdev_var.yres + row) * generic_fbdev_fix.line_length +
+	col * (generic_fbdev_var.bits_per_pixel / 8);
+}
+
+
+static void drv_generic_fbdev_copy(const int to, const int from, const int row, const int col, const int height,
+				   const int width)
+{
+    int r;
+
+    for (r = row; r < row + height; r++)
+	memcpy(drv_generic_fbdev_addr(to, r, col), drv_generic_fbdev_addr(from, r, col),
+	       width * (generic_fbdev_var.bits_per_pixel / 8));
+}
+
+
+/* show the hidden page, and bring the new hidden page up to date */
+static void drv_generic_fbdev_flush(void)
+{
+    int page = generic_fbdev_page ^ 1;
+    int row = generic_fbdev_top;
+    int col = generic_fbdev_left;
+    int height = generic_fbdev_bottom - generic_fbdev_top;
+    int width = generic_fbdev_right - generic_fbdev_left;
+
+    if (!generic_fbdev_dirty)
+	return;
+    generic_fbdev_dirty = 0;
+
+    generic_fbdev_var.yoffset = page * generic_fbdev_var.yres;
+    if (ioctl(generic_fbdev_fd, FBIOPAN_DISPLAY, &generic_fbdev_var) < 0) {
+	error("%s: panning failed, falling back to a single page: %s", generic_fbdev_driver, strerror(errno));
+	generic_fbdev_pages = 1;
+	drv_generic_flush = NULL;
+	drv_generic_fbdev_copy(generic_fbdev_page, page, row, col, height, width);
+	return;
+    }
+    drv_generic_fbdev_copy(generic_fbdev_page, page, row, col, height, width);
+    generic_fbdev_page = page;
+    generic_fbdev_pans++;
+}
+
+
+int drv_generic_fbdev_probe(const char *device)
+{
+    struct fb_fix_screeninfo fix;
+    int fd, ret;
+
+    fd = open(device, O_RDWR);
+    if (fd < 0)
+	return 0;
+
+    ret = ioctl(fd, FBIOGET_FSCREENINFO, &fix) == 0;
+    close(fd);
+
+    return ret;
+}
+
+
+int drv_generic_fbdev_open(const char *device, const char *driver, int *xres, int *yres)
+{
+    struct fb_var_screeninfo *v = &generic_fbdev_var;
+    size_t page;
+
+    generic_fbdev_driver = (char *) driver;
+
+    info("%s: initializing framebuffer device %s", generic_fbdev_driver, device);
+    generic_fbdev_fd = open(device, O_RDWR);
+    if (generic_fbdev_fd < 0) {
+	error("%s: unable to open framebuffer device %s: %s", generic_fbdev_driver, device, strerror(errno));
+	return -1;
+    }
+
+    if (ioctl(generic_fbdev_fd, FBIOGET_FSCREENINFO, &generic_fbdev_fix) < 0 ||
+	ioctl(generic_fbdev_fd, FBIOGET_VSCREENINFO, v) < 0) {
+	error("%s: %s is not a framebuffer device: %s", generic_fbdev_driver, device, strerror(errno));
+	goto exit_error;
+    }
+
+    if ((v->bits_per_pixel != 16 && v->bits_per_pixel != 32) || generic_fbdev_fix.type != FB_TYPE_PACKED_PIXELS
+	|| v->red.length > 8 || v->green.length > 8 || v->blue.length > 8 || v->transp.length > 8) {
+	error("%s: unsupported pixel format: %d bpp, type %d", generic_fbdev_driver, v->bits_per_pixel,
+	      generic_fbdev_fix.type);
+	goto exit_error;
+    }
+
+    /* room for a second page? */
+    page = (size_t) generic_fbdev_fix.line_length * v->yres;
+    generic_fbdev_pages = 1;
+    generic_fbdev_page = 0;
+    if (generic_fbdev_fix.ypanstep > 0 && generic_fbdev_fix.smem_len >= 2 * page) {
+	if (v->yres_virtual < 2 * v->yres) {
+	    struct fb_var_screeninfo var = *v;
+	    var.yres_virtual = 2 * v->yres;
+	    if (ioctl(generic_fbdev_fd, FBIOPUT_VSCREENINFO, &var) == 0)
+		ioctl(generic_fbdev_fd, FBIOGET_VSCREENINFO, v);
+	}
+	if (v->yres_virtual >= 2 * v->yres)
+	    generic_fbdev_pages = 2;
+    }
+
+    generic_fbdev_size = page * generic_fbdev_pages;
+    generic_fbdev_map = mmap(NULL, generic_fbdev_size, PROT_READ | PROT_WRITE, MAP_SHARED, generic_fbdev_fd, 0);
+    if (generic_fbdev_map == MAP_FAILED) {
+	error("%s: unable to map framebuffer device %s: %s", generic_fbdev_driver, device, strerror(errno));
+	generic_fbdev_map = NULL;
+	goto exit_error;
+    }
+
+    /* show page 0, the second page starts as a copy */
+    if (generic_fbdev_pages > 1) {
+	v->yoffset = 0;
+	if (ioctl(generic_fbdev_fd, FBIOPAN_DISPLAY, v) < 0) {
+	    generic_fbdev_pages = 1;
+	} else {
+	    drv_generic_fbdev_copy(1, 0, 0, 0, v->yres, v->xres);
+	}
+    }
+    generic_fbdev_dirty = 0;
+    if (generic_fbdev_pages > 1)
+	drv_generic_flush = drv_generic_fbdev_flush;
+
+    info("%s: %dx%d, %d bpp, %s", generic_fbdev_driver, v->xres, v->yres, v->bits_per_pixel,
+	 generic_fbdev_pages > 1 ? "double buffered" : "single buffered");
+
+    *xres = v->xres;
+    *yres = v->yres;
+
+    return 0;
+
+  exit_error:
+    close(generic_fbdev_fd);
+    generic_fbdev_fd = -1;
+    return -1;
+}
+
+
+int drv_generic_fbdev_close(void)
+{
+    if (drv_generic_flush == drv_generic_fbdev_flush) {
+	drv_generic_fbdev_flush();
+	drv_generic_flush = NULL;
+    }
+
+    debug("%s: %lu bytes changed in %lu blits, %lu pans", generic_fbdev_driver, generic_fbdev_bytes,
+	  generic_fbdev_blits, generic_fbdev_pans);
+
+    if (generic_fbdev_map) {
+	munmap(generic_fbdev_map, generic_fbdev_size);
+	generic_fbdev_map = NULL;
+    }
+
+    if (generic_fbdev_fd >= 0) {
+	close(generic_fbdev_fd);
+	generic_fbdev_fd = -1;
+    }
+
+    return 0;
+}
+
+
+void drv_generic_fbdev_blit(const int row, const int col, const int height, const int width)
+{
+    RGBA *rect;
+    int r, page, changed;
+
+    if (generic_fbdev_map == NULL)
+	return;
+
+    rect = drv_generic_graphic_compose_rect(row, col, height, width);
+    if (rect == NULL)
+	return;
+
+    /* draw into the hidden page, if there is one */
+    page = generic_fbdev_page ^ (generic_fbdev_pages - 1);
+
+    changed = 0;
+    for (r = 0; r < height; r++) {
+	unsigned char *dst = drv_generic_fbdev_addr(page, row + r, col);
+	if (generic_fbdev_var.bits_per_pixel == 16)
+	    changed += drv_generic_fbdev_row16((uint16_t *) dst, rect + r * width, width);
+	else
+	    changed += drv_generic_fbdev_row32((uint32_t *) dst, rect + r * width, width);
+    }
+
+    generic_fbdev_blits++;
+    generic_fbdev_bytes += changed * (generic_fbdev_var.bits_per_pixel / 8);
+
+    if (changed == 0 || page == generic_fbdev_page)
+	return;
+
+    if (!generic_fbdev_dirty) {
+	generic_fbdev_dirty = 1;
+	generic_fbdev_top = row;
+	generic_fbdev_left = col;
+	generic_fbdev_bottom = row + height;
+	generic_fbdev_right = col + width;
+    } else {
+	if (row < generic_fbdev_top)
+	    generic_fbdev_top = row;
+	if (col < generic_fbdev_left)
+	    generic_fbdev_left = col;
+	if (row + height > generic_fbdev_bottom)
+	    generic_fbdev_bottom = row + height;
+	if (col + width > generic_fbdev_right)
+	    generic_fbdev_right = col + width;
+    }
+
+    /* within a frame, the page is flipped when the frame ends */
+    if (!drv_generic_frame_active())
+	drv_generic_fbdev_flush();
+}
@@ -0,0 +1,56 @@
+/* $Id$
+ * $URL$
+ *
+ * generic driver helper for Linux framebuffer devices
+ *
+ * Copyright (C) 2026 The LCD4Linux Team <lcd4linux-devel@users.sourceforge.net>
+ *
+ * This file is part of LCD4Linux.
+ *
+ * LCD4Linux is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * LCD4Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ *
+ * exported fuctions:
+ *
+ * int drv_generic_fbdev_probe (const char *device)
+ *   returns 1 if device is a framebuffer device, 0 otherwise
+ *
+ * int drv_generic_fbdev_open (const char *device, const char *driver, int *xres, int *yres)
+ *   opens and maps the framebuffer device, returns its size
+ *   returns 0 if ok, -1 on failure
+ *
+ * int drv_generic_fbdev_close (void)
+ *   unmaps and closes the framebuffer device
+ *   returns 0 if ok, -1 on failure
+ *
+ * void drv_generic_fbdev_blit (int row, int col, int height, int width)
+ *   converts a rectangle of the generic graphic framebuffer
+ *   into the device's pixel format, can be used as real_blit()
+ *   when double buffered, the page is flipped once per frame
+ *
+ */
+
+#ifndef _DRV_GENERIC_FBDEV_H_
+#define _DRV_GENERIC_FBDEV_H_
+
+int drv_generic_fbdev_probe(const char *device);
+int drv_generic_fbdev_open(const char *device, const char *driver, int *xres, int *yres);
+int drv_generic_fbdev_close(void);
+void drv_generic_fbdev_blit(const int row, const int col, const int height, const int width);
+
+#endif /* _DRV_GENERIC_FBDEV_H_ */
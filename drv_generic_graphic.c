@@ -43,6 +43,15 @@
  *   renders Bar widget into framebuffer
  *   calls drv_generic_graphic_real_blit()
  *
+ * RGBA drv_generic_graphic_rgb (int row, int col);
+ *   returns a pixel of the composited framebuffer
+ *
+ * RGBA *drv_generic_graphic_compose_rect (int row, int col, int height, int width);
+ *   copies a rectangle of the composited framebuffer into a contiguous buffer
+ *
+ * int drv_generic_graphic_dirty_tiles (DIRTY_TILE **tiles);
+ *   returns the tiles which changed since the last call
+ *
  * int drv_generic_graphic_quit (void);
  *   closes generic graphic driver
  *
@@ -59,6 +68,12 @@
 #include <termios.h>
 #include <fcntl.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "debug.h"
 #include "cfg.h"
 #include "plugin.h"
@@ -93,6 +108,25 @@ static char *Driver = NULL;
 /* framebuffer */
 static RGBA *drv_generic_graphic_FB[LAYERS] = { NULL, };
 
+/* composited framebuffer, kept up to date tile by tile */
+#define TILE 16
+#define ALL_LAYERS ((1 << LAYERS) - 1)
+
+#if LAYERS > 8
+#error "tile bitmaps hold 8 layers at most"
+#endif
+
+static RGBA *drv_generic_graphic_CF = NULL;
+static unsigned char *drv_generic_graphic_stale = NULL;	/* per tile: layers written since compositing */
+static unsigned char *drv_generic_graphic_damage = NULL;	/* per tile: layers changed since last query */
+static DIRTY_TILE *drv_generic_graphic_dirty = NULL;
+static int TROWS = 0;
+static int TCOLS = 0;
+
+/* backlight color and inversion the composited framebuffer was built with */
+static RGBA CF_BL;
+static int CF_INVERTED = 0;
+
 /* inverted colors */
 static int INVERTED = 0;
 
@@ -107,6 +141,8 @@ void (*drv_generic_graphic_real_clear) () = NULL;
 /*** generic Framebuffer stuff        ***/
 /****************************************/
 
+static void drv_generic_graphic_update(const int row, const int col, const int height, const int width);
+
 static void drv_generic_graphic_resizeFB(int rows, int cols)
 {
 	RGBA *newFB;
@@ -148,6 +184,38 @@ static void drv_generic_graphic_resizeFB(int rows, int cols)
 	LCOLS = cols;
 	LROWS = rows;
 
+	/* composited framebuffer and tiles will be rebuilt */
+	free(drv_generic_graphic_CF);
+	free(drv_generic_graphic_stale);
+	free(drv_generic_graphic_damage);
+	free(drv_generic_graphic_dirty);
+
+	TROWS = (rows + TILE - 1) / TILE;
+	TCOLS = (cols + TILE - 1) / TILE;
+
+	drv_generic_graphic_CF = malloc(rows * cols * sizeof(*drv_generic_graphic_CF));
+	drv_generic_graphic_stale = malloc(TROWS * TCOLS);
+	drv_generic_graphic_damage = malloc(TROWS * TCOLS);
+	drv_generic_graphic_dirty = malloc(TROWS * TCOLS * sizeof(*drv_generic_graphic_dirty));
+
+	if (drv_generic_graphic_CF == NULL || drv_generic_graphic_stale == NULL || drv_generic_graphic_damage == NULL
+	    || drv_generic_graphic_dirty == NULL)
+	{
+		error("%s: composited framebuffer could not be allocated: malloc() failed", Driver);
+		free(drv_generic_graphic_CF);
+		free(drv_generic_graphic_stale);
+		free(drv_generic_graphic_damage);
+		free(drv_generic_graphic_dirty);
+		drv_generic_graphic_CF = NULL;
+		drv_generic_graphic_stale = NULL;
+		drv_generic_graphic_damage = NULL;
+		drv_generic_graphic_dirty = NULL;
+		return;
+	}
+
+	memset(drv_generic_graphic_stale, ALL_LAYERS, TROWS * TCOLS);
+	memset(drv_generic_graphic_damage, ALL_LAYERS, TROWS * TCOLS);
+	drv_generic_graphic_update(0, 0, rows, cols);
 }
 
 static void drv_generic_graphic_window(int pos, int size, int max, int *wpos, int *wsize)
@@ -173,6 +241,13 @@ static void drv_generic_graphic_window(int pos, int size, int max, int *wpos, in
 
 static void drv_generic_graphic_blit(const int row, const int col, const int height, const int width)
 {
+	/* composited framebuffer must be up to date when the driver reads it */
+	drv_generic_graphic_update(row, col, height, width);
+
+	/* collected for the current frame? */
+	if (drv_generic_frame_add(row, col, height, width))
+		return;
+
 	if (drv_generic_graphic_real_blit)
 	{
 		int r, c, h, w;
@@ -185,58 +260,324 @@ static void drv_generic_graphic_blit(const int row, const int col, const int hei
 	}
 }
 
-static RGBA drv_generic_graphic_blend(const int row, const int col)
+
+/* composited rectangle, handed out by drv_generic_graphic_compose_rect() */
+static RGBA *drv_generic_graphic_CR = NULL;
+static int drv_generic_graphic_CR_size = 0;
+
+/* divide 0..65025 by 255 without division: (x + 1 + (x >> 8)) >> 8 */
+
+#if defined(__SSE2__)
+
+static void drv_generic_graphic_compose_layer(RGBA * dst, const RGBA * src, const int width)
 {
-	int l, o;
-	RGBA p;
-	RGBA ret;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i amask = _mm_set1_epi32(0xff000000);
+	int c;
+
+	for (c = 0; c + 4 <= width; c += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *) (src + c));
+		__m128i pa = _mm_and_si128(p, amask);
+		__m128i d, t, lo, hi, a, x;
 
-	ret.R = BL_COL.R;
-	ret.G = BL_COL.G;
-	ret.B = BL_COL.B;
-	ret.A = 0x00;
+		/* four transparent pixels: nothing to do */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(pa, zero)) == 0xffff)
+			continue;
 
-	/* find first opaque layer */
-	/* layers below are fully covered */
-	o = LAYERS - 1;
-	for (l = 0; l < LAYERS; l++)
+		d = _mm_loadu_si128((const __m128i *) (dst + c));
+
+		/* low two pixels */
+		t = _mm_unpacklo_epi8(p, zero);
+		a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm_add_epi16(_mm_mullo_epi16(t, a), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, a)));
+		lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+
+		/* high two pixels */
+		t = _mm_unpackhi_epi8(p, zero);
+		a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm_add_epi16(_mm_mullo_epi16(t, a), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, a)));
+		hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+
+		/* alpha gets opaque as soon as any layer contributes */
+		t = _mm_andnot_si128(_mm_cmpeq_epi32(pa, zero), amask);
+		t = _mm_or_si128(t, _mm_and_si128(d, amask));
+		x = _mm_andnot_si128(amask, _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *) (dst + c), _mm_or_si128(x, t));
+	}
+
+	for (; c < width; c++)
 	{
-		p = drv_generic_graphic_FB[l][row * LCOLS + col];
-		if (p.A == 255)
-		{
-			o = l;
-			break;
-		}
+		RGBA p = src[c];
+		if (p.A == 0)
+			continue;
+		dst[c].R = (p.R * p.A + dst[c].R * (255 - p.A)) / 255;
+		dst[c].G = (p.G * p.A + dst[c].G * (255 - p.A)) / 255;
+		dst[c].B = (p.B * p.A + dst[c].B * (255 - p.A)) / 255;
+		dst[c].A = 0xff;
+	}
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static void drv_generic_graphic_compose_layer(RGBA * dst, const RGBA * src, const int width)
+{
+	static const uint8_t bcast[8] = { 3, 3, 3, 3, 7, 7, 7, 7 };
+	static const uint8_t amask[8] = { 0, 0, 0, 0xff, 0, 0, 0, 0xff };
+	const uint8x8_t idx = vld1_u8(bcast);
+	const uint8x8_t am = vld1_u8(amask);
+	const uint8x8_t full = vdup_n_u8(255);
+	const uint16x8_t one = vdupq_n_u16(1);
+	int c;
+
+	for (c = 0; c + 2 <= width; c += 2)
+	{
+		uint8x8_t p = vld1_u8((const uint8_t *) (src + c));
+		uint8x8_t a = vtbl1_u8(p, idx);
+		uint8x8_t d, nz, rgb;
+		uint16x8_t x;
+
+		/* two transparent pixels: nothing to do */
+		if (vget_lane_u64(vreinterpret_u64_u8(vand_u8(p, am)), 0) == 0)
+			continue;
+
+		d = vld1_u8((const uint8_t *) (dst + c));
+		x = vmlal_u8(vmull_u8(p, a), d, vsub_u8(full, a));
+		rgb = vshrn_n_u16(vaddq_u16(vaddq_u16(x, one), vshrq_n_u16(x, 8)), 8);
+
+		/* alpha gets opaque as soon as any layer contributes */
+		nz = vand_u8(vtst_u8(a, a), am);
+		rgb = vorr_u8(vbic_u8(rgb, am), vorr_u8(vand_u8(d, am), nz));
+		vst1_u8((uint8_t *) (dst + c), rgb);
 	}
 
-	for (l = o; l >= 0; l--)
+	for (; c < width; c++)
 	{
-		p = drv_generic_graphic_FB[l][row * LCOLS + col];
+		RGBA p = src[c];
+		if (p.A == 0)
+			continue;
+		dst[c].R = (p.R * p.A + dst[c].R * (255 - p.A)) / 255;
+		dst[c].G = (p.G * p.A + dst[c].G * (255 - p.A)) / 255;
+		dst[c].B = (p.B * p.A + dst[c].B * (255 - p.A)) / 255;
+		dst[c].A = 0xff;
+	}
+}
+
+#else
+
+static void drv_generic_graphic_compose_layer(RGBA * dst, const RGBA * src, const int width)
+{
+	int c;
+
+	for (c = 0; c < width; c++)
+	{
+		RGBA p = src[c];
 		switch (p.A)
 		{
 		case 0:
 			break;
 		case 255:
-			ret.R = p.R;
-			ret.G = p.G;
-			ret.B = p.B;
-			ret.A = 0xff;
+			dst[c] = p;
 			break;
 		default:
-			ret.R = (p.R * p.A + ret.R * (255 - p.A)) / 255;
-			ret.G = (p.G * p.A + ret.G * (255 - p.A)) / 255;
-			ret.B = (p.B * p.A + ret.B * (255 - p.A)) / 255;
-			ret.A = 0xff;
+			dst[c].R = (p.R * p.A + dst[c].R * (255 - p.A)) / 255;
+			dst[c].G = (p.G * p.A + dst[c].G * (255 - p.A)) / 255;
+			dst[c].B = (p.B * p.A + dst[c].B * (255 - p.A)) / 255;
+			dst[c].A = 0xff;
+		}
+	}
+}
+
+#endif
+
+static void drv_generic_graphic_compose_tile(const int t)
+{
+	RGBA buffer[TILE];
+	RGBA bl;
+	int row, col, height, width;
+	int l, r, c, changed;
+
+	row = (t / TCOLS) * TILE;
+	col = (t % TCOLS) * TILE;
+	height = LROWS - row < TILE ? LROWS - row : TILE;
+	width = LCOLS - col < TILE ? LCOLS - col : TILE;
+
+	bl = BL_COL;
+	bl.A = 0x00;
+
+	changed = 0;
+	for (r = row; r < row + height; r++)
+	{
+		for (c = 0; c < width; c++)
+			buffer[c] = bl;
+
+		/* bottom-up: an opaque pixel simply overwrites everything below */
+		for (l = LAYERS - 1; l >= 0; l--)
+			drv_generic_graphic_compose_layer(buffer, drv_generic_graphic_FB[l] + r * LCOLS + col, width);
+
+		if (INVERTED)
+		{
+			for (c = 0; c < width; c++)
+			{
+				buffer[c].R = 255 - buffer[c].R;
+				buffer[c].G = 255 - buffer[c].G;
+				buffer[c].B = 255 - buffer[c].B;
+			}
+		}
+
+		if (memcmp(drv_generic_graphic_CF + r * LCOLS + col, buffer, width * sizeof(*buffer)) != 0)
+		{
+			memcpy(drv_generic_graphic_CF + r * LCOLS + col, buffer, width * sizeof(*buffer));
+			changed = 1;
+		}
+	}
+
+	if (changed)
+		drv_generic_graphic_damage[t] |= drv_generic_graphic_stale[t];
+	drv_generic_graphic_stale[t] = 0;
+}
+
+/* converts a pixel rectangle into a range of tiles, returns 0 if empty */
+static int drv_generic_graphic_tiles(int row, int col, int height, int width, int *t0, int *t1, int *u0, int *u1)
+{
+	if (row < 0)
+	{
+		height += row;
+		row = 0;
+	}
+	if (col < 0)
+	{
+		width += col;
+		col = 0;
+	}
+	if (row + height > LROWS)
+		height = LROWS - row;
+	if (col + width > LCOLS)
+		width = LCOLS - col;
+	if (height < 1 || width < 1)
+		return 0;
+
+	*t0 = row / TILE;
+	*t1 = (row + height - 1) / TILE;
+	*u0 = col / TILE;
+	*u1 = (col + width - 1) / TILE;
+	return 1;
+}
+
+/* a layer has been written: its tiles must be composited again */
+static void drv_generic_graphic_invalidate(const int layer, const int row, const int col, const int height,
+					   const int width)
+{
+	int t0, t1, u0, u1, t, u;
+
+	if (drv_generic_graphic_stale == NULL)
+		return;
+
+	if (!drv_generic_graphic_tiles(row, col, height, width, &t0, &t1, &u0, &u1))
+		return;
+
+	for (t = t0; t <= t1; t++)
+		for (u = u0; u <= u1; u++)
+			drv_generic_graphic_stale[t * TCOLS + u] |= 1 << layer;
+}
+
+/* composites all stale tiles of a rectangle */
+static void drv_generic_graphic_update(const int row, const int col, const int height, const int width)
+{
+	int t0, t1, u0, u1, t, u;
+
+	if (drv_generic_graphic_CF == NULL)
+		return;
+
+	/* backlight color or inversion changed: everything is stale */
+	if (memcmp(&CF_BL, &BL_COL, sizeof(BL_COL)) != 0 || CF_INVERTED != INVERTED)
+	{
+		memset(drv_generic_graphic_stale, ALL_LAYERS, TROWS * TCOLS);
+		CF_BL = BL_COL;
+		CF_INVERTED = INVERTED;
+	}
+
+	if (!drv_generic_graphic_tiles(row, col, height, width, &t0, &t1, &u0, &u1))
+		return;
+
+	for (t = t0; t <= t1; t++)
+	{
+		for (u = u0; u <= u1; u++)
+		{
+			if (drv_generic_graphic_stale[t * TCOLS + u])
+				drv_generic_graphic_compose_tile(t * TCOLS + u);
 		}
 	}
-	if (INVERTED)
+}
+
+/* returns the tiles which changed since the last call */
+/* the list is owned by us and valid until the next call */
+int drv_generic_graphic_dirty_tiles(DIRTY_TILE ** tiles)
+{
+	int n, t;
+
+	*tiles = drv_generic_graphic_dirty;
+
+	if (drv_generic_graphic_CF == NULL)
+		return 0;
+
+	drv_generic_graphic_update(0, 0, LROWS, LCOLS);
+
+	n = 0;
+	for (t = 0; t < TROWS * TCOLS; t++)
+	{
+		if (drv_generic_graphic_damage[t] == 0)
+			continue;
+		drv_generic_graphic_dirty[n].row = (t / TCOLS) * TILE;
+		drv_generic_graphic_dirty[n].col = (t % TCOLS) * TILE;
+		drv_generic_graphic_dirty[n].height = LROWS - drv_generic_graphic_dirty[n].row < TILE ?
+			LROWS - drv_generic_graphic_dirty[n].row : TILE;
+		drv_generic_graphic_dirty[n].width = LCOLS - drv_generic_graphic_dirty[n].col < TILE ?
+			LCOLS - drv_generic_graphic_dirty[n].col : TILE;
+		drv_generic_graphic_dirty[n].layers = drv_generic_graphic_damage[t];
+		drv_generic_graphic_damage[t] = 0;
+		n++;
+	}
+
+	return n;
+}
+
+/* copies a rectangle of the composited framebuffer into a contiguous buffer (width pixels per row) */
+/* the buffer is owned by us and valid until the next call */
+RGBA *drv_generic_graphic_compose_rect(const int row, const int col, const int height, const int width)
+{
+	int r;
+
+	if (height < 1 || width < 1)
+		return NULL;
+
+	if (row < 0 || col < 0 || row + height > LROWS || col + width > LCOLS)
+	{
+		error("%s: compose_rect(%d, %d, %d, %d) out of bounds", Driver, row, col, height, width);
+		return NULL;
+	}
+
+	if (height * width > drv_generic_graphic_CR_size)
 	{
-		ret.R = 255 - ret.R;
-		ret.G = 255 - ret.G;
-		ret.B = 255 - ret.B;
+		RGBA *buffer = realloc(drv_generic_graphic_CR, height * width * sizeof(*buffer));
+		if (buffer == NULL)
+		{
+			error("%s: out of memory", Driver);
+			return NULL;
+		}
+		drv_generic_graphic_CR = buffer;
+		drv_generic_graphic_CR_size = height * width;
 	}
 
-	return ret;
+	drv_generic_graphic_update(row, col, height, width);
+
+	for (r = 0; r < height; r++)
+		memcpy(drv_generic_graphic_CR + r * width, drv_generic_graphic_CF + (row + r) * LCOLS + col,
+		       width * sizeof(RGBA));
+
+	return drv_generic_graphic_CR;
 }
 
 
@@ -244,11 +585,97 @@ static RGBA drv_generic_graphic_blend(const int row, const int col)
 /*** generic text handling            ***/
 /****************************************/
 
+/* font atlas: every glyph scaled to XRES x YRES, normal and bold */
+/* one byte per pixel, 0 = background, 1 = foreground */
+static unsigned char *drv_generic_graphic_atlas = NULL;
+static int ATLAS_XRES = 0;
+static int ATLAS_YRES = 0;
+
+/* colored glyphs for the most recent foreground/background pair */
+static RGBA *drv_generic_graphic_glyphs = NULL;
+static unsigned char drv_generic_graphic_glyph_valid[2 * 256];
+static RGBA GLYPH_FG, GLYPH_BG;
+
+static int drv_generic_graphic_atlas_build(void)
+{
+	int b, n, x, y;
+
+	free(drv_generic_graphic_atlas);
+	free(drv_generic_graphic_glyphs);
+
+	drv_generic_graphic_atlas = malloc(2 * 256 * XRES * YRES);
+	drv_generic_graphic_glyphs = malloc(2 * 256 * XRES * YRES * sizeof(RGBA));
+	if (drv_generic_graphic_atlas == NULL || drv_generic_graphic_glyphs == NULL)
+	{
+		error("%s: font atlas could not be allocated: malloc() failed", Driver);
+		free(drv_generic_graphic_atlas);
+		free(drv_generic_graphic_glyphs);
+		drv_generic_graphic_atlas = NULL;
+		drv_generic_graphic_glyphs = NULL;
+		ATLAS_XRES = 0;
+		ATLAS_YRES = 0;
+		return -1;
+	}
+
+	for (b = 0; b < 2; b++)
+	{
+		for (n = 0; n < 256; n++)
+		{
+			unsigned char *chr = b ? Font_6x8_bold[n] : Font_6x8[n];
+			unsigned char *glyph = drv_generic_graphic_atlas + (b * 256 + n) * XRES * YRES;
+			for (y = 0; y < YRES; y++)
+			{
+				for (x = 0; x < XRES; x++)
+				{
+					int mask = 1 << 6;
+					mask >>= ((x * 6) / (XRES)) + 1;
+					glyph[y * XRES + x] = (chr[(y * 8) / (YRES)] & mask) ? 1 : 0;
+				}
+			}
+		}
+	}
+
+	memset(drv_generic_graphic_glyph_valid, 0, sizeof(drv_generic_graphic_glyph_valid));
+	ATLAS_XRES = XRES;
+	ATLAS_YRES = YRES;
+
+	return 0;
+}
+
+/* returns glyph n (bold: n + 256) in the given colors */
+static RGBA *drv_generic_graphic_glyph(const int n, const RGBA fg, const RGBA bg)
+{
+	RGBA *glyph = drv_generic_graphic_glyphs + n * XRES * YRES;
+
+	/* colors changed: forget all colored glyphs */
+	if (memcmp(&fg, &GLYPH_FG, sizeof(fg)) != 0 || memcmp(&bg, &GLYPH_BG, sizeof(bg)) != 0)
+	{
+		memset(drv_generic_graphic_glyph_valid, 0, sizeof(drv_generic_graphic_glyph_valid));
+		GLYPH_FG = fg;
+		GLYPH_BG = bg;
+	}
+
+	if (!drv_generic_graphic_glyph_valid[n])
+	{
+		RGBA color[2];
+		unsigned char *src = drv_generic_graphic_atlas + n * XRES * YRES;
+		int i;
+
+		color[0] = bg;
+		color[1] = fg;
+		for (i = 0; i < XRES * YRES; i++)
+			glyph[i] = color[src[i]];
+		drv_generic_graphic_glyph_valid[n] = 1;
+	}
+
+	return glyph;
+}
+
 static void drv_generic_graphic_render(const int layer, const int row, const int col, const RGBA fg, const RGBA bg,
                                        const char *style, const char *txt)
 {
-	int c, r, x, y, len;
-	int bold;
+	int c, y, len;
+	int bold, base;
 
 	/* sanity checks */
 	if (layer < 0 || layer >= LAYERS)
@@ -257,19 +684,25 @@ static void drv_generic_graphic_render(const int layer, const int row, const int
 		return;
 	}
 
+	/* font size changed since init? */
+	if (ATLAS_XRES != XRES || ATLAS_YRES != YRES)
+	{
+		if (drv_generic_graphic_atlas_build() < 0)
+			return;
+	}
+
 	len = strlen(txt);
 
 	/* maybe grow layout framebuffer */
 	drv_generic_graphic_resizeFB(row + YRES, col + XRES * len);
 
-	r = row;
-	c = col;
-
-	/* render text into layout FB */
+	/* render text into layout FB, glyph by glyph */
+	base = strstr(style, "bold") != NULL;
 	bold = 0;
+	c = col;
 	while (*txt != '\0')
 	{
-		unsigned char *chr;
+		RGBA *glyph;
 
 		/* magic char to toggle bold */
 		if (*txt == '\a')
@@ -278,32 +711,18 @@ static void drv_generic_graphic_render(const int layer, const int row, const int
 			txt++;
 			continue;
 		}
-		if (bold || strstr(style, "bold") != NULL)
-		{
-			chr = Font_6x8_bold[(int) *(unsigned char *) txt];
-		}
-		else
-		{
-			chr = Font_6x8[(int) *(unsigned char *) txt];
-		}
 
+		glyph = drv_generic_graphic_glyph(((bold | base) << 8) + *(unsigned char *) txt, fg, bg);
 		for (y = 0; y < YRES; y++)
 		{
-			for (x = 0; x < XRES; x++)
-			{
-				int mask = 1 << 6;
-				mask >>= ((x * 6) / (XRES)) + 1;
-				if (chr[(y * 8) / (YRES)] & mask)
-					drv_generic_graphic_FB[layer][(r + y) * LCOLS + c + x] = fg;
-				else
-					drv_generic_graphic_FB[layer][(r + y) * LCOLS + c + x] = bg;
-			}
+			memcpy(drv_generic_graphic_FB[layer] + (row + y) * LCOLS + c, glyph + y * XRES, XRES * sizeof(RGBA));
 		}
 		c += XRES;
 		txt++;
 	}
 
 	/* flush area */
+	drv_generic_graphic_invalidate(layer, row, col, YRES, XRES * len);
 	drv_generic_graphic_blit(row, col, YRES, XRES * len);
 
 }
@@ -455,6 +874,7 @@ int drv_generic_graphic_icon_draw(WIDGET * W)
 	}
 
 	/* flush area */
+	drv_generic_graphic_invalidate(layer, row, col, YRES, XRES);
 	drv_generic_graphic_blit(row, col, YRES, XRES);
 
 	return 0;
@@ -590,10 +1010,12 @@ int drv_generic_graphic_bar_draw(WIDGET * W)
 	/* flush area */
 	if (dir & (DIR_EAST | DIR_WEST))
 	{
+		drv_generic_graphic_invalidate(layer, row, col, YRES, XRES * len);
 		drv_generic_graphic_blit(row, col, YRES, XRES * len);
 	}
 	else
 	{
+		drv_generic_graphic_invalidate(layer, row, col, YRES * len, XRES);
 		drv_generic_graphic_blit(row, col, YRES * len, XRES);
 	}
 
@@ -662,6 +1084,7 @@ int drv_generic_graphic_image_draw(WIDGET * W)
 	}
 
 	/* flush area */
+	drv_generic_graphic_invalidate(layer, row, col, height, width);
 	drv_generic_graphic_blit(row, col, height, width);
 
 	return 0;
@@ -701,9 +1124,16 @@ int drv_generic_graphic_init(const char *section, const char *driver)
 		}
 	}
 
+	/* scale the font once */
+	if (drv_generic_graphic_atlas_build() < 0)
+		return -1;
+
 	/* init generic driver & register plugins */
 	drv_generic_init();
 
+	/* frames are flushed through our blit */
+	drv_generic_blit = drv_generic_graphic_blit;
+
 	/* set default colors */
 	color = cfg_get(Section, "foreground", "000000ff");
 	if (color2RGBA(color, &FG_COL) < 0)
@@ -759,8 +1189,12 @@ int drv_generic_graphic_init(const char *section, const char *driver)
 
 	/* clear framebuffer but do not blit to display */
 	for (l = 0; l < LAYERS; l++)
+	{
 		for (i = 0; i < LCOLS * LROWS; i++)
 			drv_generic_graphic_FB[l][i] = NO_COL;
+		drv_generic_graphic_invalidate(l, 0, 0, LROWS, LCOLS);
+	}
+	drv_generic_graphic_update(0, 0, LROWS, LCOLS);
 
 	return 0;
 }
@@ -771,8 +1205,12 @@ int drv_generic_graphic_clear(void)
 	int i, l;
 
 	for (l = 0; l < LAYERS; l++)
+	{
 		for (i = 0; i < LCOLS * LROWS; i++)
 			drv_generic_graphic_FB[l][i] = NO_COL;
+		drv_generic_graphic_invalidate(l, 0, 0, LROWS, LCOLS);
+	}
+	drv_generic_graphic_update(0, 0, LROWS, LCOLS);
 
 	if (drv_generic_graphic_real_clear)
 		drv_generic_graphic_real_clear(NO_COL);
@@ -785,13 +1223,23 @@ int drv_generic_graphic_clear(void)
 
 RGBA drv_generic_graphic_rgb(const int row, const int col)
 {
-	return drv_generic_graphic_blend(row, col);
+	RGBA p;
+
+	/* not (or no longer) initialized: only the backlight shows */
+	if (drv_generic_graphic_CF == NULL)
+	{
+		p = BL_COL;
+		p.A = 0x00;
+		return p;
+	}
+
+	return drv_generic_graphic_CF[row * LCOLS + col];
 }
 
 
 unsigned char drv_generic_graphic_gray(const int row, const int col)
 {
-	RGBA p = drv_generic_graphic_blend(row, col);
+	RGBA p = drv_generic_graphic_rgb(row, col);
 	return (77 * p.R + 150 * p.G + 28 * p.B) / 255;
 }
 
@@ -814,6 +1262,30 @@ int drv_generic_graphic_quit(void)
 			drv_generic_graphic_FB[l] = NULL;
 		}
 	}
+	free(drv_generic_graphic_CF);
+	free(drv_generic_graphic_stale);
+	free(drv_generic_graphic_damage);
+	free(drv_generic_graphic_dirty);
+	drv_generic_graphic_CF = NULL;
+	drv_generic_graphic_stale = NULL;
+	drv_generic_graphic_damage = NULL;
+	drv_generic_graphic_dirty = NULL;
+	TROWS = 0;
+	TCOLS = 0;
+
+	free(drv_generic_graphic_atlas);
+	free(drv_generic_graphic_glyphs);
+	drv_generic_graphic_atlas = NULL;
+	drv_generic_graphic_glyphs = NULL;
+	ATLAS_XRES = 0;
+	ATLAS_YRES = 0;
+
+	if (drv_generic_graphic_CR)
+	{
+		free(drv_generic_graphic_CR);
+		drv_generic_graphic_CR = NULL;
+		drv_generic_graphic_CR_size = 0;
+	}
 	widget_unregister();
 	return (0);
 }
@@ -37,6 +37,12 @@ extern RGBA BG_COL;		/* background color */
 extern RGBA BL_COL;		/* backlight color */
 extern RGBA NO_COL;		/* no color (completely transparent) */
 
+/* a tile of the composited framebuffer */
+typedef struct {
+    int row, col, height, width;
+    int layers;			/* bitmask of the layers which changed */
+} DIRTY_TILE;
+
 /* these functions must be implemented by the real driver */
 extern void (*drv_generic_graphic_real_blit) (const int row, const int col, const int height, const int width);
 
@@ -48,6 +54,12 @@ extern RGBA drv_generic_graphic_rgb(const int row, const int col);
 extern unsigned char drv_generic_graphic_gray(const int row, const int col);
 extern unsigned char drv_generic_graphic_black(const int row, const int col);
 
+/* helper function to get a whole rectangle of blended pixels */
+extern RGBA *drv_generic_graphic_compose_rect(const int row, const int col, const int height, const int width);
+
+/* helper function to get the tiles which changed since the last call */
+extern int drv_generic_graphic_dirty_tiles(DIRTY_TILE ** tiles);
+
 
 /* generic functions and widget callbacks */
 int drv_generic_graphic_init(const char *section, const char *driver);
@@ -41,6 +41,14 @@
  *
  * void drv_generic_serial_write (char *string, int len);
  *   writes to the serial or USB port
+ *   buffered while a frame is open, sent at the end of the frame
+ *
+ * void drv_generic_serial_write_rts (char *string, int len);
+ *   writes to the serial port, waiting for the display's handshake line
+ *   if CTS stays low for 500 msec, the rest of the data is dropped
+ *
+ * void drv_generic_serial_flush (void);
+ *   starts sending buffered data, the rest is sent when the port is writeable
  *
  * int drv_generic_serial_close (void);
  *   closes the serial port
@@ -58,14 +66,19 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <poll.h>
 #include <linux/serial.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "debug.h"
 #include "qprintf.h"
 #include "cfg.h"
+#include "event.h"
+#include "drv_generic.h"
 #include "drv_generic_serial.h"
 
 
@@ -77,6 +90,20 @@ static char *Port;
 static speed_t Speed;
 static int Device = -1;
 
+/* transmit ring buffer, and a duplicate of the port for write events */
+#define TX_SIZE 4096
+
+static char TxBuffer[TX_SIZE];
+static int TxHead = 0;
+static int TxFill = 0;
+static int TxEvent = -1;
+static int TxErrors = 0;
+
+/* statistics */
+static unsigned long TxBytes = 0;
+static unsigned long TxCalls = 0;
+static unsigned long TxFrames = 0;
+
 
 #define LOCK "/var/lock/LCK..%s"
 
@@ -207,6 +234,129 @@ static pid_t drv_generic_serial_unlock_port(const char *Port)
     return 0;
 }
 
+static void drv_generic_serial_failed(const char *what)
+{
+    error("%s: %s(%s) failed: %s", Driver, what, Port, strerror(errno));
+    if (++TxErrors > 10) {
+	error("%s: too much errors, giving up", Driver);
+	got_signal = -1;
+    }
+}
+
+
+/* one non-blocking writev() of the buffered data */
+/* returns the number of bytes sent, or -1 on error */
+static int drv_generic_serial_send(void)
+{
+    struct iovec iov[2];
+    int n, ret;
+
+    if (TxFill == 0)
+	return 0;
+
+    iov[0].iov_base = TxBuffer + TxHead;
+    iov[0].iov_len = TxHead + TxFill > TX_SIZE ? TX_SIZE - TxHead : TxFill;
+    iov[1].iov_base = TxBuffer;
+    iov[1].iov_len = TxFill - iov[0].iov_len;
+    n = iov[1].iov_len ? 2 : 1;
+
+    TxCalls++;
+    ret = writev(Device, iov, n);
+    if (ret < 0) {
+	if (errno == EAGAIN || errno == EINTR)
+	    return 0;
+	drv_generic_serial_failed("write");
+	TxFill = 0;
+	return -1;
+    }
+
+    TxHead = (TxHead + ret) % TX_SIZE;
+    TxFill -= ret;
+    TxBytes += ret;
+    if (TxFill == 0) {
+	TxHead = 0;
+	TxErrors = 0;
+    }
+
+    return ret;
+}
+
+
+/* sends all buffered data, waits if the port is busy */
+static int drv_generic_serial_drain(void)
+{
+    struct pollfd pfd;
+    int ret;
+
+    while (TxFill > 0) {
+	ret = drv_generic_serial_send();
+	if (ret < 0)
+	    return -1;
+	if (ret > 0 || TxFill == 0)
+	    continue;
+	/* port busy: wait up to 500 msec for some room */
+	pfd.fd = Device;
+	pfd.events = POLLOUT;
+	ret = poll(&pfd, 1, 500);
+	if (ret == 0) {
+	    error("%s: write(%s) timed out, dropping %d bytes", Driver, Port, TxFill);
+	    TxFill = 0;
+	    TxHead = 0;
+	    return -1;
+	}
+	if (ret < 0 && errno != EINTR) {
+	    drv_generic_serial_failed("poll");
+	    TxFill = 0;
+	    TxHead = 0;
+	    return -1;
+	}
+    }
+
+    if (TxEvent != -1)
+	event_modify(TxEvent, 0, 1, 0);
+
+    return 0;
+}
+
+
+static void drv_generic_serial_event(event_flags_t flags, void *data)
+{
+    (void) data;
+
+    if (flags & (EVENT_HUP | EVENT_ERR)) {
+	error("%s: port %s hung up, dropping %d bytes", Driver, Port, TxFill);
+	TxFill = 0;
+	TxHead = 0;
+    } else {
+	drv_generic_serial_send();
+    }
+
+    if (TxFill == 0)
+	event_modify(TxEvent, 0, 1, 0);
+}
+
+
+void drv_generic_serial_flush(void)
+{
+    if (Device == -1 || TxFill == 0)
+	return;
+
+    TxFrames++;
+    drv_generic_serial_send();
+
+    /* send the rest as soon as the port is writeable */
+    if (TxFill > 0 && TxEvent != -1 && event_modify(TxEvent, 0, 1, 1) < 0) {
+	/* epoll cannot watch the port: don't try again */
+	error("%s: cannot watch port %s, sending synchronously", Driver, Port);
+	event_del(TxEvent);
+	close(TxEvent);
+	TxEvent = -1;
+    }
+    if (TxFill > 0 && TxEvent == -1)
+	drv_generic_serial_drain();
+}
+
+
 int drv_generic_serial_open_handshake(const char *section, const char *driver, const unsigned int flags)
 {
     int fd;
@@ -313,6 +463,21 @@ int drv_generic_serial_open(const char *section, const char *driver, const unsig
     }
 
     Device = fd;
+
+    /* write events get their own descriptor, the driver may watch the port itself */
+    if (TxEvent != -1) {
+	event_del(TxEvent);
+	close(TxEvent);
+    }
+    TxHead = TxFill = TxErrors = 0;
+    TxBytes = TxCalls = TxFrames = 0;
+    TxEvent = dup(fd);
+    if (TxEvent != -1 && event_add(drv_generic_serial_event, NULL, TxEvent, 0, 1, 0) < 0) {
+	close(TxEvent);
+	TxEvent = -1;
+    }
+    drv_generic_flush = drv_generic_serial_flush;
+
     return Device;
 }
 
@@ -322,6 +487,9 @@ int drv_generic_serial_poll(char *string, const int len)
     int ret;
     if (Device == -1)
 	return -1;
+    /* the answer may depend on buffered commands */
+    if (TxFill > 0)
+	drv_generic_serial_drain();
     ret = read(Device, string, len);
     if (ret < 0 && errno != EAGAIN) {
 	error("%s: read(%s) failed: %s", Driver, Port, strerror(errno));
@@ -351,62 +519,143 @@ int drv_generic_serial_read(char *string, const int len)
     return ret;
 }
 
-void drv_generic_serial_write_rts(const char *string, const int len)
+/* waits up to 500 msec for the display to assert CTS */
+static void drv_generic_serial_alarm(int signum)
 {
-    int serial, p, tocnt;
-
-    for (p = 0; p < len; p++) {	/* Send Byte-by-Byte checking RTS-Line */
-	/* Timeout is 500ms */
-	tocnt = 250;		/* 250 * 2 */
-	ioctl(Device, TIOCMGET, &serial);	/* Get status of Control Lines */
-	while (!(serial & TIOCM_RTS) && tocnt) {	/* Wait until RTS is set or timeout */
-	    tocnt--;		/* decrease timeout counter */
-	    usleep(2000);	/* Wait two milliseconds */
-	    ioctl(Device, TIOCMGET, &serial);
-	}
-	drv_generic_serial_write(&string[p], 1);	/* Actually send one byte */
+    (void) signum;
+}
+
+static int drv_generic_serial_wait_cts(void)
+{
+    struct sigaction action, old;
+    struct itimerval tick;
+    struct timespec now, end;
+    int lines;
+
+    /* no modem lines (e.g. USB or pty): nothing to wait for */
+    if (ioctl(Device, TIOCMGET, &lines) < 0)
+	return 0;
+    if (lines & TIOCM_CTS)
+	return 0;
+
+    /* a periodic alarm interrupts TIOCMIWAIT, so we can time out */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = drv_generic_serial_alarm;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, &old);
+    memset(&tick, 0, sizeof(tick));
+    tick.it_value.tv_usec = 50000;
+    tick.it_interval.tv_usec = 50000;
+    setitimer(ITIMER_REAL, &tick, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_nsec += 500000000L;
+    if (end.tv_nsec >= 1000000000L) {
+	end.tv_sec++;
+	end.tv_nsec -= 1000000000L;
+    }
+
+    while (!(lines & TIOCM_CTS)) {
+	if (ioctl(Device, TIOCMIWAIT, TIOCM_CTS) < 0 && errno != EINTR)
+	    break;
+	if (ioctl(Device, TIOCMGET, &lines) < 0)
+	    break;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+	    break;
     }
+
+    memset(&tick, 0, sizeof(tick));
+    setitimer(ITIMER_REAL, &tick, NULL);
+    sigaction(SIGALRM, &old, NULL);
+
+    return lines & TIOCM_CTS ? 0 : -1;
 }
 
-void drv_generic_serial_write(const char *string, const int len)
+
+void drv_generic_serial_write_rts(const char *string, const int len)
 {
-    static int error = 0;
-    int run, ret;
+    struct pollfd pfd;
+    int p, ret;
 
     if (Device == -1) {
 	error("%s: write to closed port %s failed!", Driver, Port);
 	return;
     }
 
-    for (run = 0; run < 10; run++) {
-	ret = write(Device, string, len);
-	if (ret >= 0 || errno != EAGAIN) {
-	    break;
+    /* keep the order of buffered data */
+    drv_generic_serial_drain();
+
+    /* the kernel stops at every byte while CTS is low (CRTSCTS, no FIFO) */
+    for (p = 0; p < len;) {
+	if (drv_generic_serial_wait_cts() < 0) {
+	    error("%s: timeout waiting for CTS on %s, dropping %d bytes", Driver, Port, len - p);
+	    return;
 	}
-	/* EAGAIN: retry 10 times, emit message after 2nd retry */
-	if (run > 0) {
-	    info("%s: write(%s): EAGAIN #%d", Driver, Port, run);
+	TxCalls++;
+	ret = write(Device, string + p, len - p);
+	if (ret > 0) {
+	    p += ret;
+	    TxBytes += ret;
+	} else if (ret == 0 || errno == EAGAIN) {
+	    /* port busy: wait up to 500 msec for some room */
+	    pfd.fd = Device;
+	    pfd.events = POLLOUT;
+	    if (poll(&pfd, 1, 500) == 0) {
+		error("%s: write(%s) timed out, dropping %d bytes", Driver, Port, len - p);
+		return;
+	    }
+	} else if (ret < 0 && errno != EINTR) {
+	    drv_generic_serial_failed("write");
+	    return;
 	}
-	usleep(1000);
     }
+}
 
-    if (ret < 0) {
-	error("%s: write(%s) failed: %s", Driver, Port, strerror(errno));
-	if (++error > 10) {
-	    error("%s: too much errors, giving up", Driver);
-	    got_signal = -1;
+
+void drv_generic_serial_write(const char *string, const int len)
+{
+    int p, n;
+
+    if (Device == -1) {
+	error("%s: write to closed port %s failed!", Driver, Port);
+	return;
+    }
+
+    for (p = 0; p < len; p += n) {
+	n = len - p;
+	if (n > TX_SIZE - TxFill)
+	    n = TX_SIZE - TxFill;
+	if (n > 0) {
+	    int tail = (TxHead + TxFill) % TX_SIZE;
+	    int first = tail + n > TX_SIZE ? TX_SIZE - tail : n;
+	    memcpy(TxBuffer + tail, string + p, first);
+	    memcpy(TxBuffer, string + p + first, n - first);
+	    TxFill += n;
 	}
-    } else if (ret != len) {
-	error("%s: partial write(%s): len=%d ret=%d", Driver, Port, len, ret);
-    } else {
-	error = 0;
+	/* buffer full: make some room */
+	if (TxFill == TX_SIZE && drv_generic_serial_drain() < 0)
+	    return;
     }
-    return;
+
+    /* outside of a frame, data is sent immediately */
+    if (!drv_generic_frame_active())
+	drv_generic_serial_drain();
 }
 
 
 int drv_generic_serial_close(void)
 {
+    drv_generic_serial_drain();
+    debug("%s: %lu bytes sent in %lu writes, %lu frames", Driver, TxBytes, TxCalls, TxFrames);
+
+    if (TxEvent != -1) {
+	event_del(TxEvent);
+	close(TxEvent);
+	TxEvent = -1;
+    }
+    drv_generic_flush = NULL;
+
     info("%s: closing port %s", Driver, Port);
     close(Device);
     drv_generic_serial_unlock_port(Port);
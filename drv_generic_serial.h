@@ -34,6 +34,7 @@ int drv_generic_serial_poll(char *string, const int len);
 int drv_generic_serial_read(char *string, const int len);
 void drv_generic_serial_write(const char *string, const int len);
 void drv_generic_serial_write_rts(const char *string, const int len);
+void drv_generic_serial_flush(void);
 int drv_generic_serial_close(void);
 
 #endif
@@ -43,6 +43,13 @@
  *  defines the bitmap of a user-defined character
  *
  *
+ * this function may be implemented by the real driver:
+ *
+ * int (*drv_generic_text_real_cost)(int row, int col, int len);
+ *  returns the number of bytes sent for writing len chars at (row, col)
+ *  defaults to GOTO_COST + len
+ *
+ *
  * exported fuctions:
  *
  * int drv_generic_text_init (char *section, char *driver);
@@ -106,7 +113,6 @@ typedef struct {
     DIRECTION dir;
     STYLE style;
     int segment;
-    int invalid;
 } BAR;
 
 typedef struct {
@@ -118,6 +124,13 @@ typedef struct {
     int ascii;
 } SEGMENT;
 
+typedef struct {
+    unsigned int hash;
+    unsigned long used;
+    int valid;
+    int icons;
+} GLYPH;
+
 static char *Section = NULL;
 static char *Driver = NULL;
 
@@ -131,19 +144,43 @@ int INVALIDATE = 0;		/* re-send a modified userdefined char? */
 
 void (*drv_generic_text_real_write) () = NULL;
 void (*drv_generic_text_real_defchar) () = NULL;
+int (*drv_generic_text_real_cost) () = NULL;
 
 
 static char *LayoutFB = NULL;
 static char *DisplayFB = NULL;
 static int *L2D = NULL;
 
+/* diff planner: changed columns, cheapest cost and start of the last write */
+static int *PlanDiff = NULL;
+static int *PlanCost = NULL;
+static int *PlanFrom = NULL;
+
 static int Single_Segments = 0;
 
+#define SEGMENTS 128
+
 static int nSegment = 0;
 static int fSegment = 0;
-static SEGMENT Segment[128];
+static SEGMENT Segment[SEGMENTS];
 static BAR *BarFB = NULL;
 
+/* segment packing: merge target, best candidate and its error, new index */
+static int PackAlias[SEGMENTS];
+static int PackBest[SEGMENTS];
+static int PackError[SEGMENTS];
+static int PackMap[SEGMENTS];
+
+/* user-defineable chars shared by icons and bars: bitmap, hash, last use, visible icons */
+#define GLYPH_ROWS 32
+
+static GLYPH *Glyph = NULL;
+static unsigned char *GlyphBitmap = NULL;
+static int GlyphRows = 8;
+static unsigned long GlyphTick = 0;
+static unsigned long GlyphLookups = 0;
+static unsigned long GlyphHits = 0;
+
 
 /****************************************/
 /*** generic Framebuffer stuff        ***/
@@ -212,7 +249,6 @@ static void drv_generic_text_resizeFB(int rows, int cols)
 	    newBar[i].val2 = -1;
 	    newBar[i].dir = 0;
 	    newBar[i].segment = -1;
-	    newBar[i].invalid = 0;
 	}
 
 	/* transfer contents */
@@ -231,12 +267,27 @@ static void drv_generic_text_resizeFB(int rows, int cols)
 }
 
 
+/* bytes sent for writing len chars at (row, col) */
+static int drv_generic_text_cost(const int row, const int col, const int len)
+{
+    if (drv_generic_text_real_cost)
+	return drv_generic_text_real_cost(row, col, len);
+
+    /* a negative GOTO_COST splits at every unchanged char */
+    return (GOTO_COST > 0 ? GOTO_COST : 0) + len;
+}
+
+
 static void drv_generic_text_blit(const int row, const int col, const int height, const int width)
 {
     int lr, lc;			/* layout  row/col */
     int dr, dc;			/* display row/col */
     int p1, p2;			/* start/end positon of changed area */
-    int eq;			/* counter for equal contents */
+    int i, j, n;
+
+    /* collected for the current frame? */
+    if (drv_generic_frame_add(row, col, height, width))
+	return;
 
     /* loop over layout rows */
     for (lr = row; lr < LROWS && lr < row + height; lr++) {
@@ -245,33 +296,42 @@ static void drv_generic_text_blit(const int row, const int col, const int height
 	/* sanity check */
 	if (dr < 0 || dr >= DROWS)
 	    continue;
-	/* loop over layout cols */
+	/* collect changed columns */
+	n = 0;
 	for (lc = col; lc < LCOLS && lc < col + width; lc++) {
 	    /* transform layout to display column */
 	    dc = lc;
 	    /* sanity check */
 	    if (dc < 0 || dc >= DCOLS)
 		continue;
-	    /* find start of difference */
-	    if (DisplayFB[dr * DCOLS + dc] == LayoutFB[lr * LCOLS + lc])
-		continue;
-	    /* find end of difference */
-	    for (p1 = dc, p2 = p1, eq = 0, lc++; lc < LCOLS && lc < col + width; lc++) {
-		/* transform layout to display column */
-		dc = lc;
-		/* sanity check */
-		if (dc < 0 || dc >= DCOLS)
-		    continue;
-		if (DisplayFB[dr * DCOLS + dc] == LayoutFB[lr * LCOLS + lc]) {
-		    if (++eq > GOTO_COST)
-			break;
-		} else {
-		    p2 = dc;
-		    eq = 0;
+	    if (DisplayFB[dr * DCOLS + dc] != LayoutFB[lr * LCOLS + lc])
+		PlanDiff[n++] = dc;
+	}
+	if (n == 0)
+	    continue;
+	/* cheapest set of writes covering the first j changes */
+	/* on equal cost the longer write wins, so there are less of them */
+	PlanCost[0] = 0;
+	for (j = 1; j <= n; j++) {
+	    PlanCost[j] = -1;
+	    for (i = 0; i < j; i++) {
+		int c = PlanCost[i] + drv_generic_text_cost(dr, PlanDiff[i], PlanDiff[j - 1] - PlanDiff[i] + 1);
+		if (PlanCost[j] < 0 || c < PlanCost[j]) {
+		    PlanCost[j] = c;
+		    PlanFrom[j] = i;
 		}
 	    }
-	    /* send to display */
-	    memcpy(DisplayFB + dr * DCOLS + p1, LayoutFB + lr * LCOLS + p1, p2 - p1 + 1);
+	}
+	/* the plan is built backwards, collect the ends of the writes */
+	for (j = n, i = n; j > 0; j = PlanFrom[j])
+	    PlanCost[--i] = j;
+	/* send to display */
+	for (; i < n; i++) {
+	    j = PlanCost[i];
+	    p1 = PlanDiff[PlanFrom[j]];
+	    p2 = PlanDiff[j - 1];
+	    lc = p1;
+	    memcpy(DisplayFB + dr * DCOLS + p1, LayoutFB + lr * LCOLS + lc, p2 - p1 + 1);
 	    if (drv_generic_text_real_write)
 		drv_generic_text_real_write(dr, p1, DisplayFB + dr * DCOLS + p1, p2 - p1 + 1);
 	}
@@ -300,8 +360,20 @@ int drv_generic_text_init(const char *section, const char *driver)
     L2D = NULL;
     drv_generic_text_resizeFB(DROWS, DCOLS);
 
+    /* init user-defineable char cache */
+    GlyphRows = YRES > 0 && YRES < GLYPH_ROWS ? YRES : GLYPH_ROWS;
+    GlyphTick = GlyphLookups = GlyphHits = 0;
+    Glyph = calloc(CHARS + 1, sizeof(*Glyph));
+    GlyphBitmap = malloc((CHARS + 1) * GlyphRows);
+
+    /* init diff planner */
+    PlanDiff = malloc(DCOLS * sizeof(*PlanDiff));
+    PlanCost = malloc((DCOLS + 1) * sizeof(*PlanCost));
+    PlanFrom = malloc((DCOLS + 1) * sizeof(*PlanFrom));
+
     /* sanity check */
-    if (DisplayFB == NULL || LayoutFB == NULL || L2D == NULL) {
+    if (DisplayFB == NULL || LayoutFB == NULL || L2D == NULL || PlanDiff == NULL || PlanCost == NULL
+	|| PlanFrom == NULL || Glyph == NULL || GlyphBitmap == NULL) {
 	error("%s: framebuffer could not be allocated: malloc() failed", Driver);
 	return -1;
     }
@@ -418,17 +490,120 @@ int drv_generic_text_quit(void)
 	L2D = NULL;
     }
 
+    free(PlanDiff);
+    free(PlanCost);
+    free(PlanFrom);
+    PlanDiff = PlanCost = PlanFrom = NULL;
+
     if (BarFB) {
 	free(BarFB);
 	BarFB = NULL;
     }
 
+    if (GlyphLookups) {
+	debug("%s: %lu user-defined char lookups, %lu hits (%lu%%), %lu defined", Driver, GlyphLookups, GlyphHits,
+	      100 * GlyphHits / GlyphLookups, GlyphLookups - GlyphHits);
+    }
+
+    free(Glyph);
+    free(GlyphBitmap);
+    Glyph = NULL;
+    GlyphBitmap = NULL;
+
     widget_unregister();
 
     return (0);
 }
 
 
+/****************************************/
+/*** user-defined char cache          ***/
+/****************************************/
+
+static unsigned int drv_generic_text_glyph_hash(const unsigned char *bitmap)
+{
+    unsigned int hash = 2166136261u;
+    int i;
+
+    /* FNV-1a */
+    for (i = 0; i < GlyphRows; i++) {
+	hash ^= bitmap[i];
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/* char is shown by a visible icon or a bar segment */
+static int drv_generic_text_glyph_busy(const int c)
+{
+    int j;
+
+    if (Glyph[c].icons > 0)
+	return 1;
+
+    for (j = fSegment; j < nSegment; j++) {
+	if (Segment[j].ascii == c)
+	    return 1;
+    }
+
+    return 0;
+}
+
+
+/* returns the char showing this bitmap, redefines */
+/* the least recently used free char if there is none */
+static int drv_generic_text_glyph(const unsigned char *bitmap)
+{
+    unsigned int hash;
+    int c, n, lru = -1;
+
+    hash = drv_generic_text_glyph_hash(bitmap);
+    GlyphTick++;
+    GlyphLookups++;
+
+    for (c = 0; c < CHARS; c++) {
+	if (Glyph[c].valid && Glyph[c].hash == hash && memcmp(GlyphBitmap + c * GlyphRows, bitmap, GlyphRows) == 0) {
+	    Glyph[c].used = GlyphTick;
+	    GlyphHits++;
+	    return c;
+	}
+    }
+
+    /* chars which were never defined come first */
+    for (c = 0; c < CHARS; c++) {
+	if (drv_generic_text_glyph_busy(c))
+	    continue;
+	if (lru == -1 || Glyph[c].used < Glyph[lru].used)
+	    lru = c;
+    }
+
+    if (lru == -1) {
+	error("%s: out of user-defined characters", Driver);
+	return -1;
+    }
+
+    memcpy(GlyphBitmap + lru * GlyphRows, bitmap, GlyphRows);
+    Glyph[lru].hash = hash;
+    Glyph[lru].used = GlyphTick;
+    Glyph[lru].valid = 1;
+
+    if (drv_generic_text_real_defchar)
+	drv_generic_text_real_defchar(CHAR0 + lru, bitmap);
+
+    /* ugly invalidation: change display FB to a wrong value so blit() will really send it */
+    if (INVALIDATE) {
+	for (n = 0; n < DROWS * DCOLS; n++) {
+	    if (DisplayFB[n] == (char) (CHAR0 + lru))
+		DisplayFB[n] = ~DisplayFB[n];
+	}
+    }
+
+    return lru;
+}
+
+
 /****************************************/
 /*** generic icon handling            ***/
 /****************************************/
@@ -450,7 +625,7 @@ int drv_generic_text_icon_draw(WIDGET * W)
     WIDGET_ICON *Icon = W->data;
     int row, col;
     int visible;
-    int invalidate = 0;
+    int c;
     unsigned char ascii;
 
     row = W->row;
@@ -463,7 +638,7 @@ int drv_generic_text_icon_draw(WIDGET * W)
     if (Icon->ascii == -2)
 	return 0;
 
-    /* ASCII already assigned? */
+    /* icon counted already? chars are assigned on demand */
     if (Icon->ascii == -1) {
 	if (icon_counter >= ICONS) {
 	    error("cannot process icon '%s': out of icons", W->name);
@@ -471,18 +646,30 @@ int drv_generic_text_icon_draw(WIDGET * W)
 	    return -1;
 	}
 	icon_counter++;
-	Icon->ascii = CHAR0 + CHARS - icon_counter;
+	Icon->ascii = ' ';
     }
 
     /* Icon visible? */
     visible = P2N(&Icon->visible) > 0;
 
-    /* maybe redefine icon */
-    if (Icon->curmap != Icon->prvmap && visible) {
-	Icon->prvmap = Icon->curmap;
-	if (drv_generic_text_real_defchar)
-	    drv_generic_text_real_defchar(Icon->ascii, Icon->bitmap + YRES * Icon->curmap);
-	invalidate = INVALIDATE;
+    /* release the char if the bitmap changed or the icon is hidden */
+    if (Icon->prvmap != -1 && (Icon->curmap != Icon->prvmap || !visible)) {
+	Glyph[Icon->ascii - CHAR0].icons--;
+	Icon->prvmap = -1;
+	Icon->ascii = ' ';
+    }
+
+    /* find or define a char showing the current bitmap */
+    if (Icon->prvmap == -1 && visible) {
+	/* out of chars: the icon stays blank, and is retried next time */
+	c = drv_generic_text_glyph(Icon->bitmap + YRES * Icon->curmap);
+	if (c != -1) {
+	    Glyph[c].icons++;
+	    Icon->prvmap = Icon->curmap;
+	    Icon->ascii = CHAR0 + c;
+	}
+    } else if (Icon->prvmap != -1) {
+	Glyph[Icon->ascii - CHAR0].used = GlyphTick;
     }
 
     /* use blank if invisible */
@@ -491,11 +678,6 @@ int drv_generic_text_icon_draw(WIDGET * W)
     /* transfer icon into layout buffer */
     LayoutFB[row * LCOLS + col] = ascii;
 
-    /* ugly invalidation: change display FB to a wrong value so blit() will really send it */
-    if (invalidate) {
-	DisplayFB[row * DCOLS + col] = ~ascii;
-    }
-
     /* blit it */
     drv_generic_text_blit(row, col, 1, 1);
 
@@ -518,7 +700,6 @@ static void drv_generic_text_bar_clear(void)
 	BarFB[i].dir = 0;
 	BarFB[i].style = 0;
 	BarFB[i].segment = -1;
-	BarFB[i].invalid = 0;
     }
 
     for (i = 0; i < nSegment; i++) {
@@ -550,6 +731,11 @@ int drv_generic_text_bar_init(const int single_segments)
 
 void drv_generic_text_bar_add_segment(const int val1, const int val2, const DIRECTION dir, const int ascii)
 {
+    if (fSegment >= SEGMENTS) {
+	error("too many fixed bar segments");
+	return;
+    }
+
     Segment[fSegment].val1 = val1;
     Segment[fSegment].val2 = val2;
     Segment[fSegment].dir = dir;
@@ -694,6 +880,11 @@ static void drv_generic_text_bar_create_segments(void)
 	    }
 	}
 	if (i == nSegment) {
+	    if (nSegment >= SEGMENTS) {
+		error("too many bar segments");
+		BarFB[n].segment = -1;
+		continue;
+	    }
 	    nSegment++;
 	    Segment[i].val1 = BarFB[n].val1;
 	    Segment[i].val2 = BarFB[n].val2;
@@ -763,38 +954,57 @@ static int drv_generic_text_bar_segment_error(const int i, const int j)
 }
 
 
+/* find the cheapest remaining segment to merge segment i into */
+static void drv_generic_text_bar_pack_best(const int i)
+{
+    int j, e;
+
+    PackBest[i] = -1;
+    PackError[i] = 65535;
+
+    for (j = 0; j < nSegment; j++) {
+	if (PackAlias[j] != -1)
+	    continue;
+	e = drv_generic_text_bar_segment_error(i, j);
+	if (e < PackError[i]) {
+	    PackError[i] = e;
+	    PackBest[i] = j;
+	}
+    }
+}
+
+
 static void drv_generic_text_bar_pack_segments(void)
 {
-    int i, j, n, min;
+    int i, j, n, min, left;
     int pack_i, pack_j;
     int pass1 = 1;
-    int error[nSegment][nSegment];
 
     if (nSegment <= fSegment + CHARS - ICONS) {
 	return;
     }
 
+    /* merged segments get an alias, they are removed at the end */
     for (i = 0; i < nSegment; i++) {
-	for (j = 0; j < nSegment; j++) {
-	    error[i][j] = drv_generic_text_bar_segment_error(i, j);
-	    /* debug ("[%d][%d] = %d", i, j, error[i][j]); */
-	}
+	PackAlias[i] = -1;
+    }
+    for (i = fSegment; i < nSegment; i++) {
+	drv_generic_text_bar_pack_best(i);
     }
 
-    while (nSegment > fSegment + CHARS - ICONS) {
+    left = nSegment;
+    while (left > fSegment + CHARS - ICONS) {
 
 	min = 65535;
 	pack_i = -1;
-	pack_j = -1;
 	for (i = fSegment; i < nSegment; i++) {
+	    if (PackAlias[i] != -1)
+		continue;
 	    if (pass1 && Segment[i].used)
 		continue;
-	    for (j = 0; j < nSegment; j++) {
-		if (error[i][j] < min) {
-		    min = error[i][j];
-		    pack_i = i;
-		    pack_j = j;
-		}
+	    if (PackError[i] < min) {
+		min = PackError[i];
+		pack_i = i;
 	    }
 	}
 	if (pack_i == -1) {
@@ -804,56 +1014,66 @@ static void drv_generic_text_bar_pack_segments(void)
 	    } else {
 		error("unable to compact bar characters");
 		error("nSegment=%d fSegment=%d CHARS=%d ICONS=%d", nSegment, fSegment, CHARS, ICONS);
-		error("Segment[0].val1=%d val2=%d", Segment[0].val1, Segment[0].val2);
-		error("Segment[1].val1=%d val2=%d", Segment[1].val1, Segment[1].val2);
-		error("Segment[2].val1=%d val2=%d", Segment[2].val1, Segment[2].val2);
-		nSegment = CHARS - ICONS;
+		/* drop the last segments, their cells stay empty */
+		for (i = nSegment - 1; i >= fSegment && left > fSegment + CHARS - ICONS; i--) {
+		    if (PackAlias[i] == -1) {
+			PackAlias[i] = -2;
+			left--;
+		    }
+		}
 		break;
 	    }
 	}
+	pack_j = PackBest[pack_i];
 #if 0
-	debug("pack_segment: n=%d i=%d j=%d min=%d", nSegment, pack_i, pack_j, min);
-	debug("Pack_segment: i1=%d i2=%d j1=%d j2=%d\n", Segment[pack_i].val1, Segment[pack_i].val2,
-	      Segment[pack_j].val1, Segment[pack_j].val2);
+	debug("pack_segment: n=%d i=%d j=%d min=%d", left, pack_i, pack_j, min);
 #endif
 
-	nSegment--;
-	Segment[pack_i] = Segment[nSegment];
+	PackAlias[pack_i] = pack_j;
+	left--;
 
-	for (i = 0; i < nSegment; i++) {
-	    error[pack_i][i] = error[nSegment][i];
-	    error[i][pack_i] = error[i][nSegment];
+	/* segments which would have been merged into pack_i need another one */
+	for (i = fSegment; i < nSegment; i++) {
+	    if (PackAlias[i] == -1 && PackBest[i] == pack_i)
+		drv_generic_text_bar_pack_best(i);
 	}
+    }
 
-	for (n = 0; n < LROWS * LCOLS; n++) {
-	    if (BarFB[n].segment == pack_i)
-		BarFB[n].segment = pack_j;
-	    if (BarFB[n].segment == nSegment)
-		BarFB[n].segment = pack_i;
+    /* remove merged segments */
+    for (i = 0, n = 0; i < nSegment; i++) {
+	if (PackAlias[i] == -1) {
+	    Segment[n] = Segment[i];
+	    PackMap[i] = n++;
 	}
     }
+    for (i = 0; i < nSegment; i++) {
+	for (j = i; PackAlias[j] >= 0; j = PackAlias[j]);
+	PackMap[i] = PackAlias[j] == -1 ? PackMap[j] : -1;
+    }
+    nSegment = n;
+
+    /* move the cells in one pass */
+    for (n = 0; n < LROWS * LCOLS; n++) {
+	if (BarFB[n].segment != -1)
+	    BarFB[n].segment = PackMap[BarFB[n].segment];
+    }
 }
 
 
 static void drv_generic_text_bar_define_chars(void)
 {
-    int c, i, j;
-    unsigned char buffer[8];
+    int i, j;
+    unsigned char buffer[GLYPH_ROWS];
+
+    memset(buffer, 0, sizeof(buffer));
 
     for (i = fSegment; i < nSegment; i++) {
-	if (Segment[i].used)
+	if (Segment[i].ascii != -1) {
+	    Glyph[Segment[i].ascii].used = GlyphTick;
 	    continue;
-	if (Segment[i].ascii != -1)
-	    continue;
-	for (c = 0; c < CHARS - ICONS; c++) {
-	    for (j = fSegment; j < nSegment; j++) {
-		if (Segment[j].ascii == c)
-		    break;
-	    }
-	    if (j == nSegment)
-		break;
 	}
-	Segment[i].ascii = c;
+	if (Segment[i].used)
+	    continue;
 	switch (Segment[i].dir) {
 	case DIR_WEST:
 	    if (Segment[i].style) {
@@ -896,18 +1116,32 @@ static void drv_generic_text_bar_define_chars(void)
 	    }
 	    break;
 	}
-	if (drv_generic_text_real_defchar)
-	    drv_generic_text_real_defchar(CHAR0 + c, buffer);
-
-	/* maybe invalidate framebuffer */
-	if (INVALIDATE) {
-	    for (j = 0; j < LROWS * LCOLS; j++) {
-		if (BarFB[j].segment == i) {
-		    BarFB[j].invalid = 1;
-		}
-	    }
+
+	Segment[i].ascii = drv_generic_text_glyph(buffer);
+    }
+}
+
+
+/* out of chars: show the closest fixed segment (usually blank or block) instead */
+static int drv_generic_text_bar_fallback(const int i)
+{
+    int j, res, v1, v2, e, min = -1, ascii = ' ';
+
+    res = Segment[i].dir & (DIR_EAST | DIR_WEST) ? XRES : YRES;
+
+    for (j = 0; j < fSegment; j++) {
+	if (!(Segment[i].dir & Segment[j].dir))
+	    continue;
+	v1 = (Segment[j].val1 > res ? res : Segment[j].val1) - Segment[i].val1;
+	v2 = (Segment[j].val2 > res ? res : Segment[j].val2) - Segment[i].val2;
+	e = v1 * v1 + v2 * v2;
+	if (min == -1 || e < min) {
+	    min = e;
+	    ascii = Segment[j].ascii;
 	}
     }
+
+    return ascii;
 }
 
 
@@ -979,16 +1213,10 @@ int drv_generic_text_bar_draw(WIDGET * W)
 		continue;
 	    c = Segment[s].ascii;
 	    if (c == -1)
-		continue;
-	    if (s >= fSegment)
+		c = drv_generic_text_bar_fallback(s);
+	    else if (s >= fSegment)
 		c += CHAR0;	/* ascii offset for user-defineable chars */
 	    LayoutFB[n] = c;
-	    /* maybe invalidate display framebuffer */
-	    if (BarFB[n].invalid) {
-		BarFB[n].invalid = 0;
-		/* ugly invalidation: change display FB to a wrong value so blit() will really send it */
-		DisplayFB[row * DCOLS + col] = ~LayoutFB[n];
-	    }
 	}
     }
 
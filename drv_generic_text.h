@@ -42,6 +42,9 @@ extern int INVALIDATE;		/* re-send a modified userdefined char? */
 extern void (*drv_generic_text_real_write) (const int row, const int col, const char *data, const int len);
 extern void (*drv_generic_text_real_defchar) (const int ascii, const unsigned char *matrix);
 
+/* this function may be implemented by the real driver */
+extern int (*drv_generic_text_real_cost) (const int row, const int col, const int len);
+
 /* generic functions and widget callbacks */
 int drv_generic_text_init(const char *section, const char *driver);
 int drv_generic_text_greet(const char *msg1, const char *msg2);
@@ -64,82 +64,19 @@
 #include "drv.h"
 
 #include "drv_generic_graphic.h"
+#include "drv_generic_fbdev.h"
 
 typedef enum { false = 0, true = !false } bool;
 
 static char Name[] = "ili9486_fb";
 
 /* Display data */
-static int fd = -1, bpp = 0, stride_bpp_value = 0, xres = 0, yres = 0, stride = 0, backlight = 0;
-static unsigned char * newLCD = NULL, * oldLCD = NULL;
-
-#define WIDTH_MAX 480
-#define HEIGHT_MAX 320
-#define BPP_MAX 16
-
-#define SET_BYTE(INPUT, VALUE, POSITION) (INPUT=(VALUE<<(POSITION<<3))|(INPUT&(0xFFFFFFFF^(0xFF<<(POSITION<<3)))))
-
-static int ili9486_fb_open(const char *dev, int bpp_value, int xres_value, int yres_value)
-{
-	bpp = bpp_value;
-	xres = xres_value;
-	yres = yres_value;
-
-	switch (bpp)
-	{
-		case 8:
-			stride_bpp_value = 2;
-			break;
-		case 15:
-		case 16:
-			stride_bpp_value = 4;
-			break;
-		case 24:
-		case 32:
-			stride_bpp_value = 6;
-			break;
-		default:
-			stride_bpp_value = (bpp + 7) / 8;
-	}
-
-	stride = xres * stride_bpp_value;
-
-	fd = open(dev, O_RDWR);
-	if (fd == -1) {
-		error("cannot open lcd device\n");
-		return -1;
-	}
-
-	return 0;
-}
-
-static int ili9486_fb_close()
-{
-	if (newLCD)
-	{
-		free(newLCD);
-		newLCD = 0;
-	}
-	if (oldLCD)
-	{
-		free(oldLCD);
-		oldLCD = 0;
-	}
-	if (-1 != fd)
-	{
-		close(fd);
-		fd=-1;
-	}
-
-	return 0;
-}
+static int xres = 0, yres = 0, backlight = 0;
 
 static int drv_ili9486_fb_open(const char *section)
 {
 	char *dev;
 	char *size;
-	char *bpp_dev;
-	int bpp_value;
 	int xres_value;
 	int yres_value;
 
@@ -150,111 +87,40 @@ static int drv_ili9486_fb_open(const char *section)
 		return -1;
 	}
 
-	size = cfg_get(section, "Size", NULL);
-	if (size == NULL || *size == '\0')
+	if (drv_generic_fbdev_open(dev, Name, &xres, &yres) < 0)
 	{
-		error("%s: no '%s.Size' entry from %s", Name, section, cfg_source());
-		return -1;
-	}
-
-	if (sscanf(size, "%dx%d", &xres_value, &yres_value) != 2 || xres_value < 1 || yres_value < 1 || xres_value > WIDTH_MAX || yres_value > HEIGHT_MAX) {
-		error("%s: bad %s.Size '%s' from %s", Name, section, size, cfg_source());
-		free(size);
-		return -1;
-	}
-
-	bpp_dev = cfg_get(section, "Bpp", NULL);
-	if (bpp_dev == NULL || *bpp_dev == '\0')
-	{
-		error("%s: no '%s.Bpp' entry from %s", Name, section, cfg_source());
-		return -1;
-	}
-
-	if (sscanf(bpp_dev, "%d", &bpp_value) != 1 || bpp_value < 1 || bpp_value > BPP_MAX) {
-		error("%s: bad %s.Bpp '%s' from %s", Name, section, bpp_dev, cfg_source());
-		free(bpp_dev);
+		error("%s: cannot open ili9486 device %s", Name, dev);
+		free(dev);
 		return -1;
 	}
+	free(dev);
 
-	int h = ili9486_fb_open(dev, bpp_value, xres_value, yres_value);
-	if (h == -1)
+	/* the framebuffer knows its size, but we may use only a part of it */
+	size = cfg_get(section, "Size", NULL);
+	if (size != NULL && *size != '\0')
 	{
-		error("%s: cannot open ili9486 device %s", Name, dev);
-		return -1;
+		if (sscanf(size, "%dx%d", &xres_value, &yres_value) != 2 || xres_value < 1 || yres_value < 1 || xres_value > xres || yres_value > yres)
+		{
+			error("%s: bad %s.Size '%s' from %s", Name, section, size, cfg_source());
+			free(size);
+			drv_generic_fbdev_close();
+			return -1;
+		}
+		xres = xres_value;
+		yres = yres_value;
 	}
+	free(size);
 
 	return 0;
 }
 
 static int drv_ili9486_fb_close(void)
 {
-	ili9486_fb_close();
+	drv_generic_fbdev_close();
 
 	return 0;
 }
 
-static void drv_ili9486_fb_set_pixel(int x, int y, RGBA pix)
-{
-	long int location;
-
-	unsigned char red = pix.R;
-	unsigned char green = pix.G;
-	unsigned char blue = pix.B;
-
-	uint32_t data = NULL;
-	SET_BYTE(data, blue, 0);
-	SET_BYTE(data, green, 1);
-	SET_BYTE(data, red, 2);
-
-	uint32_t colraw = ((data & 0x00FF0000) >> (16 + 8 - 5) << 11) |  // red
-			  ((data & 0x0000FF00) >> ( 8 + 8 - 6) << 5) |   // green
-			  ((data & 0x000000FF) >> ( 0 + 8 - 5) << 0);    // blue;
-
-	unsigned char col1 = colraw & 0x0000FF;
-	unsigned char col2 = (colraw & 0x00FF00) >> 8;
-
- 	location = (x * xres + y) * stride_bpp_value / 2;
-
-	*(newLCD + location + 0) = col1;
-	*(newLCD + location + 1) = col2;
-}
-
-static void drv_ili9486_fb_blit(const int row, const int col, const int height, const int width)
-{
-	bool refreshAll = false;
-	int r, c;
-
-	for (r = row; r < row + height; r++)
-	{
-		for (c = col; c < col + width; c++)
-		{
-			drv_ili9486_fb_set_pixel(r, c, drv_generic_graphic_rgb(r, c));
-		}
-	}
-	for (r = row; r < row + height; r++)
-	{
-		for (c = col; c < col + width; c++)
-		{
-			if (newLCD != oldLCD)
-			{
-				refreshAll = true;
-				break;
-			}
-		}
-	}
-	if (refreshAll)
-	{
-		for (r = row; r < row + height; r++)
-		{
-			for (c = col; c < col + width; c++)
-			{
-				memcpy(oldLCD, newLCD, sizeof(newLCD)+1);
-			}
-		}
-		write(fd, newLCD + stride, stride * yres);
-	}
-}
-
 static int drv_ili9486_fb_backlight(int number)
 {
 	return 0;
@@ -298,31 +164,13 @@ static int drv_ili9486_fb_start(const char *section)
 		return -1;
 	}
 
-	/* you surely want to allocate a framebuffer or something... */
-	newLCD = (unsigned char *)malloc(yres * stride);
-	if (newLCD)
-		memset(newLCD, 0, yres * stride);
-
-	if (newLCD == NULL) {
-		error("%s: newLCD buffer could not be allocated: malloc() failed", Name);
-		return -1;
-	}
-	oldLCD = (unsigned char *)malloc(yres * stride);
-	if (oldLCD)
-		memset(oldLCD, 0, yres * stride);
-
-	if (oldLCD == NULL) {
-		error("%s: oldLCD buffer could not be allocated: malloc() failed", Name);
-		return -1;
-	}
-
 	drv_ili9486_fb_backlight(backlight);
 
 	/* set width/height from ili9486 firmware specs */
 	DROWS = yres;
 	DCOLS = xres;
 
-	info("%s: init succesfully, xres %d, yres %d, bpp %d, stride %d", Name, xres, yres, bpp, stride);
+	info("%s: init succesfully, xres %d, yres %d", Name, xres, yres);
 
 	return 0;
 }
@@ -370,7 +218,7 @@ int drv_ili9486_fb_init(const char *section, const int quiet)
 	int ret;
 
 	/* real worker functions */
-	drv_generic_graphic_real_blit = drv_ili9486_fb_blit;
+	drv_generic_graphic_real_blit = drv_generic_fbdev_blit;
 
 	/* start display */
 	if ((ret = drv_ili9486_fb_start(section)) != 0)
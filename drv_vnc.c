@@ -318,11 +318,15 @@ static void drv_vnc_blit_it(const int row, const int col, const int height, cons
 {
     static int sleep = 0;
     int r, c, ofs;
-    RGBA p;
+    RGBA p, *rect;
+
+    rect = drv_generic_graphic_compose_rect(row, col, height, width);
+    if (rect == NULL)
+	return;
 
     for (r = row; r < row + height; r++) {
 	for (c = col; c < col + width; c++) {
-	    p = drv_generic_graphic_rgb(r, c);
+	    p = *rect++;
 	    ofs = (r * xres + c) * BPP;
 	    buffer[ofs++] = p.R;
 	    buffer[ofs++] = p.G;
@@ -39,6 +39,7 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <string.h>
+#include <errno.h>
 #include <stdint.h>
 #include <syslog.h>
 #include <byteswap.h>
@@ -55,6 +56,7 @@
 #include "drv.h"
 
 #include "drv_generic_graphic.h"
+#include "drv_generic_fbdev.h"
 
 #define LCD_XRES		"/proc/stb/lcd/xres"
 #define LCD_YRES		"/proc/stb/lcd/yres"
@@ -73,7 +75,16 @@ static char Name[] = "vuplus4k";
 
 /* Display data */
 static int fd = -1, bpp = 0, stride_bpp_value = 0, xres = 0, yres = 0, stride = 0, backlight = 0;
-static unsigned char * newLCD = NULL, * oldLCD = NULL;
+
+/* the device is a framebuffer, drawn by drv_generic_fbdev */
+static bool fbdev = false;
+
+/* frame sent to the LCD device, BGRA */
+static unsigned char * newLCD = NULL;
+static bool refreshAll = true;
+
+/* write statistics */
+static unsigned long stat_blits = 0, stat_frames = 0, stat_bytes = 0;
 
 static int lcd_read_value(const char *filename)
 {
@@ -113,6 +124,11 @@ static int vuplus4k_open(const char *dev)
 
 	stride = xres * stride_bpp_value;
 
+	if (stride_bpp_value != 4) {
+		error("%s: unsupported bpp %d (only 24 and 32 bits per pixel)", Name, bpp);
+		return -1;
+	}
+
 	fd = open(dev, O_RDWR);
 	if (fd == -1) {
 		printf("cannot open lcd device\n");
@@ -134,11 +150,6 @@ static int vuplus4k_close()
 		free(newLCD);
 		newLCD = 0;
 	}
-	if (oldLCD)
-	{
-		free(oldLCD);
-		oldLCD = 0;
-	}
 	if (-1 != fd)
 	{
 		close(fd);
@@ -158,6 +169,19 @@ static int drv_vuplus4k_open(const char *section)
 		return -1;
 	}
 
+	/* newer images export the display as a framebuffer */
+	if (drv_generic_fbdev_probe(dev))
+	{
+		if (drv_generic_fbdev_open(dev, Name, &xres, &yres) < 0)
+		{
+			error("%s: cannot open vuplus4k device %s", Name, dev);
+			return -1;
+		}
+		fbdev = true;
+		drv_generic_graphic_real_blit = drv_generic_fbdev_blit;
+		return 0;
+	}
+
 	int h = vuplus4k_open(dev);
 	if (h == -1)
 	{
@@ -170,56 +194,71 @@ static int drv_vuplus4k_open(const char *section)
 
 static int drv_vuplus4k_close(void)
 {
-	vuplus4k_close();
+	if (fbdev)
+		drv_generic_fbdev_close();
+	else
+		vuplus4k_close();
 	return 0;
 }
 
-static void drv_vuplus4k_set_pixel(int x, int y, RGBA pix)
-{
-	long int location;
-
-	location = (x * xres + y) * stride_bpp_value;
-	pix = drv_generic_graphic_rgb(x, y);
-	*(newLCD + location + 0) = pix.B;
-	*(newLCD + location + 1) = pix.G;
-	*(newLCD + location + 2) = pix.R;
-	*(newLCD + location + 3) = 0xff;
-}
-
-static void drv_vuplus4k_blit(const int row, const int col, const int height, const int width)
+/* converts a row of pixels into BGRA, returns 1 if anything changed */
+static int drv_vuplus4k_convert(unsigned char *dst, const RGBA * src, const int width)
 {
-	bool refreshAll = false;
-	int r, c;
+	int c, changed = 0;
 
-	for (r = row; r < row + height; r++)
+	for (c = 0; c < width; c++, dst += 4)
 	{
-		for (c = col; c < col + width; c++)
+		if (dst[0] != src[c].B || dst[1] != src[c].G || dst[2] != src[c].R || dst[3] != 0xff)
 		{
-			drv_vuplus4k_set_pixel(r, c, drv_generic_graphic_rgb(r, c));
+			dst[0] = src[c].B;
+			dst[1] = src[c].G;
+			dst[2] = src[c].R;
+			dst[3] = 0xff;
+			changed = 1;
 		}
 	}
-	for (r = row; r < row + height; r++)
+
+	return changed;
+}
+
+static void drv_vuplus4k_blit(const int row, const int col, const int height, const int width)
+{
+	RGBA *rect;
+	int r, first, last;
+
+	rect = drv_generic_graphic_compose_rect(row, col, height, width);
+	if (rect == NULL)
+		return;
+
+	/* update frame, remember changed lines */
+	first = -1;
+	last = -1;
+	for (r = 0; r < height; r++)
 	{
-		for (c = col; c < col + width; c++)
+		if (drv_vuplus4k_convert(newLCD + (row + r) * stride + col * 4, rect + r * width, width))
 		{
-			if (newLCD != oldLCD)
-			{
-				refreshAll = true;
-				break;
-			}
+			if (first < 0)
+				first = r;
+			last = r;
 		}
 	}
-	if (refreshAll)
+
+	stat_blits++;
+	if (first < 0 && !refreshAll)
+		return;
+
+	/* the device only takes whole frames */
+	if (write(fd, newLCD + stride, stride * yres) != stride * yres)
 	{
-		for (r = row; r < row + height; r++)
-		{
-			for (c = col; c < col + width; c++)
-			{
-				memcpy(oldLCD, newLCD, sizeof(newLCD)+1);
-			}
-		}
-		write(fd, newLCD + stride, stride * yres);
+		error("%s: write to device failed: %s", Name, strerror(errno));
+		return;
 	}
+	refreshAll = false;
+	stat_frames++;
+	stat_bytes += stride * yres;
+
+	debug("%s: lines %d..%d changed: %d bytes written (total %lu bytes in %lu frames, %lu blits)", Name,
+	      first < 0 ? -1 : row + first, first < 0 ? -1 : row + last, stride * yres, stat_bytes, stat_frames, stat_blits);
 }
 
 static int drv_vuplus4k_backlight(int number)
@@ -277,22 +316,18 @@ static int drv_vuplus4k_start(const char *section)
 		return -1;
 	}
 
-	/* you surely want to allocate a framebuffer or something... */
-	newLCD = (unsigned char *)malloc(yres * stride);
-	if (newLCD)
-		memset(newLCD, 0, yres * stride);
-
-	if (newLCD == NULL) {
-		error("%s: newLCD buffer could not be allocated: malloc() failed", Name);
-		return -1;
-	}
-	oldLCD = (unsigned char *)malloc(yres * stride);
-	if (oldLCD)
-		memset(oldLCD, 0, yres * stride);
+	/* the frame is sent starting with its second line, */
+	/* so there is one spare line at the end */
+	if (!fbdev)
+	{
+		newLCD = (unsigned char *)malloc((yres + 1) * stride);
+		if (newLCD)
+			memset(newLCD, 0, (yres + 1) * stride);
 
-	if (oldLCD == NULL) {
-		error("%s: oldLCD buffer could not be allocated: malloc() failed", Name);
-		return -1;
+		if (newLCD == NULL) {
+			error("%s: newLCD buffer could not be allocated: malloc() failed", Name);
+			return -1;
+		}
 	}
 
 	drv_vuplus4k_backlight(backlight);
@@ -422,6 +457,9 @@ int drv_vuplus4k_quit(const int quiet)
 
 	drv_generic_graphic_quit();
 
+	if (!fbdev)
+		debug("%s: %lu bytes written in %lu frames for %lu blits", Name, stat_bytes, stat_frames, stat_blits);
+
 	debug("closing connection");
 	drv_vuplus4k_close();
 
@@ -40,6 +40,9 @@
  * int AddFunction (char *name, int argc, void (*func)())
  *   adds a function to the evaluator
  *
+ * int AddFunctionFlags (char *name, int argc, int flags, void (*func)())
+ *   adds a function with flags (F_PURE, F_VOLATILE, F_NOCACHE, F_CACHE) to the evaluator
+ *
  * void DeleteVariables    (void);
  *   frees all allocated variables
  *
@@ -61,11 +64,28 @@
  *
  *
  * int Compile (char* expression, void **tree)
- *   compiles a expression into a tree
+ *   compiles a expression into a tree and translates
+ *   the tree into bytecode for a simple stack machine
  * 
  * int Eval (void *tree, RESULT *result)
  *   evaluates an expression
  *
+ * int EvalChanged (void *tree)
+ *   returns 0 if Eval() would deliver the same result as last time
+ *   because the expression neither calls impure functions nor
+ *   reads variables that have changed since
+ *
+ * int EvalBackend (int backend)
+ *   selects bytecode machine or tree interpreter for Eval()
+ *   returns the previous backend
+ *
+ * void EvalTick (void)
+ *   starts a new tick: function results cached during
+ *   the last tick are discarded
+ *
+ * void EvalStats (EVAL_STATS *stats)
+ *   returns function cache and allocation statistics
+ *
  * void DelTree (void *tree)
  *   frees a compiled tree
  */
@@ -90,6 +110,9 @@
 /* string buffer chunk size */
 #define CHUNK_SIZE 16
 
+/* initial size of the variable table */
+#define VARIABLE_SLOTS 64
+
 typedef enum {
     T_UNDEF,
     T_NAME,
@@ -142,12 +165,15 @@ typedef struct {
 
 typedef struct {
     char *name;
-    RESULT *value;
+    unsigned int hash;
+    RESULT *value;		/* never moves, compiled code points to it */
+    unsigned long generation;	/* generation of the last change */
 } VARIABLE;
 
 typedef struct {
     char *name;
     int argc;
+    int flags;
     void (*func) ();
 } FUNCTION;
 
@@ -159,8 +185,58 @@ typedef struct _NODE {
     FUNCTION *Function;
     int Children;
     struct _NODE **Child;
+    struct _NODE *Same;		/* identical sub-tree evaluated before */
+    int Slot;			/* instruction holding the result */
+    int Bound;			/* Result points to the variable value */
 } NODE;
 
+typedef enum {
+    I_CONST,			/* push constant */
+    I_VAR,			/* push variable */
+    I_SET,			/* assign top of stack to variable */
+    I_POP,			/* discard top of stack */
+    I_JMP,			/* unconditional jump */
+    I_JZ,			/* pop, jump if zero */
+    I_OR,			/* replace top by 1 and jump if not zero, else pop */
+    I_AND,			/* replace top by 0 and jump if zero, else pop */
+    I_BOOL,			/* replace top by (top != 0) */
+    I_OP,			/* unary or binary operator */
+    I_CALL,			/* function call */
+    I_REF			/* push result of an earlier instruction */
+} OPCODE;
+
+typedef struct {
+    OPCODE Opcode;
+    OPERATOR Operator;
+    int Arg;			/* jump target, argument count or copy flag */
+    VARIABLE *Variable;
+    FUNCTION *Function;
+    RESULT Result;		/* constant or result of this instruction */
+} INSTR;
+
+typedef struct {
+    NODE *Tree;			/* parse tree, used by the tree interpreter */
+    INSTR *Code;		/* bytecode, NULL if translation failed */
+    int nCode;
+    RESULT **Stack;		/* preallocated value stack */
+    int nStack;
+    int Assign;			/* program contains variable assignments */
+    VARIABLE **Depends;		/* variables the result depends on */
+    int nDepends;
+    int Impure;			/* calls impure functions or assigns variables */
+    unsigned long Generation;	/* variable generation at the last Eval(), 0 = never */
+} PROGRAM;
+
+typedef struct {
+    unsigned long Tick;		/* entry is stale unless this is the current tick */
+    unsigned int Hash;
+    void (*Func) ();
+    int Argc;
+    RESULT *Argv;		/* copies of the arguments */
+    int nArgv;			/* allocated arguments */
+    RESULT Result;
+} CACHE;
+
 
 
 /* non-alphanumeric operators */
@@ -209,12 +285,30 @@ static char *Word = NULL;
 static TOKEN Token = T_UNDEF;
 static OPERATOR Operator = O_UNDEF;
 
-static VARIABLE Variable[255];
+/* variable table, open addressing, size is a power of 2 */
+static VARIABLE **Variable = NULL;
 static unsigned int nVariable = 0;
+static unsigned int nVariableSlots = 0;
+
+/* incremented whenever a variable changes */
+static unsigned long Generation = 1;
 
 static FUNCTION *Function = NULL;
 static unsigned int nFunction = 0;
 
+static int Backend = EVAL_BYTECODE;
+
+/* function result cache, size is a power of 2 */
+static CACHE *Cache = NULL;
+static unsigned int nCache = 0;
+static unsigned int nCached = 0;
+static unsigned long Tick = 1;
+static unsigned long CacheHits = 0;
+static unsigned long CacheMisses = 0;
+
+/* heap allocations of results and string buffers */
+static unsigned long nAlloc = 0;
+
 
 /* strndup() may be not available on several platforms */
 #ifndef HAVE_STRNDUP
@@ -240,15 +334,22 @@ char *strndup(const char *source, size_t len)
 #endif
 
 
+/* release a heap string buffer, the inline buffer stays */
+static void FreeString(RESULT * result)
+{
+    if (result->string != NULL && result->string != result->buffer)
+	free(result->string);
+    result->string = NULL;
+    result->size = 0;
+}
+
+
 void DelResult(RESULT * result)
 {
     result->type = 0;
-    result->size = 0;
+    result->derived = 0;
     result->number = 0.0;
-    if (result->string) {
-	free(result->string);
-	result->string = NULL;
-    }
+    FreeString(result);
 }
 
 
@@ -263,17 +364,59 @@ static void FreeResult(RESULT * result)
 
 static RESULT *NewResult(void)
 {
-    RESULT *result = malloc(sizeof(RESULT));
+    RESULT *result = calloc(1, sizeof(RESULT));
     if (result == NULL) {
 	error("Evaluator: cannot allocate result: out of memory!");
 	return NULL;
     }
+    nAlloc++;
+
+    return result;
+}
+
+
+/* make sure the string buffer can hold len characters */
+/* short strings use the inline buffer, the heap buffer is kept for reuse */
+static char *ReserveString(RESULT * result, const int len)
+{
+    if (result->string == NULL || len >= result->size) {
+	FreeString(result);
+	if (len < RESULT_INLINE) {
+	    result->size = RESULT_INLINE;
+	    result->string = result->buffer;
+	} else {
+	    /* allocate memory in multiples of CHUNK_SIZE */
+	    result->size = CHUNK_SIZE * ((len + 1) / CHUNK_SIZE + 1);
+	    result->string = malloc(result->size);
+	    nAlloc++;
+	}
+    }
+    result->type = R_STRING;
+    result->derived = 0;
+    result->number = 0.0;
+    return result->string;
+}
+
+
+/* like DelResult(), but keeps the string buffer for later reuse */
+static void ClearResult(RESULT * result)
+{
     result->type = 0;
-    result->size = 0;
+    result->derived = 0;
     result->number = 0.0;
-    result->string = NULL;
+}
 
-    return result;
+
+/* like SetResult(R_NUMBER), but keeps the string buffer for later reuse */
+static void SetNumber(RESULT * result, const double number)
+{
+    /* a string formatted from the same number is still valid */
+    if (result->type == (R_NUMBER | R_STRING) && result->derived == R_STRING && result->number == number)
+	return;
+
+    result->type = R_NUMBER;
+    result->derived = 0;
+    result->number = number;
 }
 
 
@@ -282,30 +425,25 @@ RESULT *SetResult(RESULT ** result, const int type, const void *value)
     if (*result == NULL) {
 	if ((*result = NewResult()) == NULL)
 	    return NULL;
-    } else if (type == R_NUMBER) {
-	DelResult(*result);
     }
 
     if (type == R_NUMBER) {
-	(*result)->type = R_NUMBER;
-	(*result)->size = 0;
-	(*result)->number = *(double *) value;
-	(*result)->string = NULL;
+	SetNumber(*result, *(double *) value);
     }
 
     else if (type == R_STRING) {
-	int len = strlen((char *) value);
-	(*result)->type = R_STRING;
-	(*result)->number = 0.0;
-	if ((*result)->string == NULL || len >= (*result)->size) {
-	    /* buffer is either empty or too small */
-	    if ((*result)->string)
-		free((*result)->string);
-	    /* allocate memory in multiples of CHUNK_SIZE */
-	    (*result)->size = CHUNK_SIZE * ((len + 1) / CHUNK_SIZE + 1);
-	    (*result)->string = malloc((*result)->size);
+	/* a number parsed from the same string is still valid */
+	if ((*result)->type == (R_NUMBER | R_STRING) && (*result)->derived == R_NUMBER
+	    && strcmp((*result)->string, value) == 0)
+	    return *result;
+	if ((*result)->string != value) {
+	    int len = strlen((char *) value);
+	    strcpy(ReserveString(*result, len), value);
+	} else {
+	    (*result)->type = R_STRING;
+	    (*result)->derived = 0;
+	    (*result)->number = 0.0;
 	}
-	strcpy((*result)->string, value);
     } else {
 	error("Evaluator: internal error: invalid result type %d", type);
 	return NULL;
@@ -322,24 +460,17 @@ RESULT *CopyResult(RESULT ** result, RESULT * value)
 	    return NULL;
     }
 
+    if (*result == value)
+	return *result;
+
+    if (value->type & R_STRING && value->string != NULL) {
+	strcpy(ReserveString(*result, strlen(value->string)), value->string);
+    }
+
     (*result)->type = value->type;
+    (*result)->derived = value->derived;
     (*result)->number = value->number;
 
-    if (value->string == NULL) {
-	(*result)->size = 0;
-	if ((*result)->string)
-	    free((*result)->string);
-	(*result)->string = NULL;
-    } else {
-	/* is buffer large enough? */
-	if ((*result)->string == NULL || value->size > (*result)->size) {
-	    if ((*result)->string)
-		free((*result)->string);
-	    (*result)->size = value->size;
-	    (*result)->string = malloc((*result)->size);
-	}
-	strcpy((*result)->string, value->string);
-    }
     return *result;
 }
 
@@ -361,6 +492,7 @@ double R2N(RESULT * result)
 
     if (result->type & R_STRING) {
 	result->type |= R_NUMBER;
+	result->derived = R_NUMBER;
 	result->number = atof(result->string);
 	return result->number;
     }
@@ -386,12 +518,12 @@ char *R2S(RESULT * result)
     }
 
     if (result->type & R_NUMBER) {
-	result->type |= R_STRING;
-	if (result->string)
-	    free(result->string);
-	result->size = CHUNK_SIZE;
-	result->string = malloc(result->size);
-	snprintf(result->string, result->size, "%g", result->number);
+	double number = result->number;
+	/* "%g" never needs more than CHUNK_SIZE characters */
+	snprintf(ReserveString(result, CHUNK_SIZE - 1), CHUNK_SIZE, "%g", number);
+	result->type = R_NUMBER | R_STRING;
+	result->derived = R_STRING;
+	result->number = number;
 	return result->string;
     }
 
@@ -401,16 +533,131 @@ char *R2S(RESULT * result)
 }
 
 
-static VARIABLE *FindVariable(const char *name)
+/* FNV-1a hash */
+#define HASH_BASIS 2166136261u
+
+static unsigned int HashBytes(unsigned int hash, const void *data, const size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+static unsigned int HashString(unsigned int hash, const char *string)
+{
+    const unsigned char *p = (const unsigned char *) string;
+
+    while (*p != '\0') {
+	hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+}
+
+
+/* do two results look the same to R2N() and R2S()? */
+static int SameResult(RESULT * a, RESULT * b)
+{
+    if (a->type != b->type)
+	return 0;
+    if ((a->type & R_NUMBER) && a->number != b->number)
+	return 0;
+    if ((a->type & R_STRING) && strcmp(a->string, b->string) != 0)
+	return 0;
+    return 1;
+}
+
+
+/* open addressing: returns the variable or the empty slot for it */
+static VARIABLE **LookupVariable(const char *name, const unsigned int hash)
 {
     unsigned int i;
 
-    for (i = 0; i < nVariable; i++) {
-	if (strcmp(name, Variable[i].name) == 0) {
-	    return &Variable[i];
-	}
+    for (i = hash & (nVariableSlots - 1); Variable[i] != NULL; i = (i + 1) & (nVariableSlots - 1)) {
+	if (Variable[i]->hash == hash && strcmp(Variable[i]->name, name) == 0)
+	    break;
+    }
+    return &Variable[i];
+}
+
+
+static VARIABLE *FindVariable(const char *name)
+{
+    if (nVariable == 0)
+	return NULL;
+
+    return *LookupVariable(name, HashString(HASH_BASIS, name));
+}
+
+
+static int GrowVariables(void)
+{
+    VARIABLE **old = Variable;
+    unsigned int i, n = nVariableSlots;
+
+    nVariableSlots = n ? 2 * n : VARIABLE_SLOTS;
+    Variable = calloc(nVariableSlots, sizeof(VARIABLE *));
+    if (Variable == NULL) {
+	error("Evaluator: cannot grow variable table: out of memory!");
+	Variable = old;
+	nVariableSlots = n;
+	return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+	if (old[i] != NULL)
+	    *LookupVariable(old[i]->name, old[i]->hash) = old[i];
+    }
+    free(old);
+
+    return 0;
+}
+
+
+/* returns the (interned) variable, creates it with an empty value if necessary */
+static VARIABLE *InternVariable(const char *name)
+{
+    unsigned int hash = HashString(HASH_BASIS, name);
+    VARIABLE **slot;
+    VARIABLE *V;
+
+    /* keep the table at most half full */
+    if (2 * (nVariable + 1) > nVariableSlots && GrowVariables() < 0)
+	return NULL;
+
+    slot = LookupVariable(name, hash);
+    if (*slot != NULL)
+	return *slot;
+
+    V = malloc(sizeof(VARIABLE));
+    if (V == NULL || (V->value = NewResult()) == NULL) {
+	error("Evaluator: cannot add variable <%s>: out of memory!", name);
+	free(V);
+	return NULL;
+    }
+    V->name = strdup(name);
+    V->hash = hash;
+    V->generation = ++Generation;
+    SetResult(&V->value, R_STRING, "");
+
+    *slot = V;
+    nVariable++;
+
+    return V;
+}
+
+
+/* copy-on-write: the value is only touched if it really changed */
+static void AssignVariable(VARIABLE * V, RESULT * value)
+{
+    if (V->value != value && !SameResult(V->value, value)) {
+	CopyResult(&V->value, value);
+	V->generation = ++Generation;
     }
-    return NULL;
 }
 
 
@@ -420,19 +667,16 @@ int SetVariable(const char *name, RESULT * value)
 
     V = FindVariable(name);
     if (V != NULL) {
-	CopyResult(&V->value, value);
+	AssignVariable(V, value);
 	return 1;
     }
 
-    if (nVariable >= sizeof(Variable) / sizeof(Variable[0])) {
-	error("Evaluator: cannot set variable <%s>: out of slots", name);
+    V = InternVariable(name);
+    if (V == NULL) {
+	error("Evaluator: cannot set variable <%s>", name);
 	return -1;
     }
-
-    nVariable++;
-    Variable[nVariable - 1].name = strdup(name);
-    Variable[nVariable - 1].value = NULL;
-    CopyResult(&Variable[nVariable - 1].value, value);
+    AssignVariable(V, value);
 
     return 0;
 }
@@ -440,7 +684,7 @@ int SetVariable(const char *name, RESULT * value)
 
 int SetVariableNumeric(const char *name, const double value)
 {
-    RESULT result = { 0, 0, 0, NULL };
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
     RESULT *rp = &result;
 
     SetResult(&rp, R_NUMBER, &value);
@@ -451,12 +695,15 @@ int SetVariableNumeric(const char *name, const double value)
 
 int SetVariableString(const char *name, const char *value)
 {
-    RESULT result = { 0, 0, 0, NULL };
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
     RESULT *rp = &result;
+    int ret;
 
     SetResult(&rp, R_STRING, value);
+    ret = SetVariable(name, rp);
+    DelResult(rp);
 
-    return SetVariable(name, rp);
+    return ret;
 }
 
 
@@ -464,11 +711,17 @@ void DeleteVariables(void)
 {
     unsigned int i;
 
-    for (i = 0; i < nVariable; i++) {
-	free(Variable[i].name);
-	FreeResult(Variable[i].value);
+    for (i = 0; i < nVariableSlots; i++) {
+	if (Variable[i] != NULL) {
+	    free(Variable[i]->name);
+	    FreeResult(Variable[i]->value);
+	    free(Variable[i]);
+	}
     }
+    free(Variable);
+    Variable = NULL;
     nVariable = 0;
+    nVariableSlots = 0;
 }
 
 
@@ -498,12 +751,13 @@ static FUNCTION *FindFunction(const char *name)
 }
 
 
-int AddFunction(const char *name, const int argc, void (*func) ())
+int AddFunctionFlags(const char *name, const int argc, const int flags, void (*func) ())
 {
     nFunction++;
     Function = realloc(Function, nFunction * sizeof(FUNCTION));
     Function[nFunction - 1].name = strdup(name);
     Function[nFunction - 1].argc = argc;
+    Function[nFunction - 1].flags = flags;
     Function[nFunction - 1].func = func;
 
     qsort(Function, nFunction, sizeof(FUNCTION), SortFunction);
@@ -512,6 +766,214 @@ int AddFunction(const char *name, const int argc, void (*func) ())
 }
 
 
+int AddFunction(const char *name, const int argc, void (*func) ())
+{
+    return AddFunctionFlags(name, argc, 0, func);
+}
+
+
+/* 
+ * function result cache
+ * a function flagged F_CACHE and called with the same arguments during
+ * the same tick (e.g. from several widgets) is executed only once.
+ * Caching is opt-in: functions with side effects or whose results
+ * arrive in the background (fetches, fifos, events) must see every call.
+ */
+
+#define CACHE_SIZE 64
+
+static void DelCache(void)
+{
+    unsigned int i;
+    int n;
+
+    for (i = 0; i < nCache; i++) {
+	for (n = 0; n < Cache[i].nArgv; n++) {
+	    DelResult(&Cache[i].Argv[n]);
+	}
+	free(Cache[i].Argv);
+	DelResult(&Cache[i].Result);
+    }
+    free(Cache);
+    Cache = NULL;
+    nCache = 0;
+    nCached = 0;
+}
+
+
+static void NewCache(const unsigned int size)
+{
+    DelCache();
+
+    Cache = calloc(size, sizeof(CACHE));
+    if (Cache == NULL) {
+	error("Evaluator: cannot allocate function cache: out of memory!");
+	return;
+    }
+    nCache = size;
+}
+
+
+/* hash over function and arguments */
+static unsigned int HashCall(FUNCTION * F, const int argc, RESULT ** argv)
+{
+    unsigned int hash;
+    char *s;
+    int n;
+
+    hash = HashBytes(HASH_BASIS, &F->func, sizeof(F->func));
+    for (n = 0; n < argc; n++) {
+	if ((s = R2S(argv[n])) != NULL)
+	    hash = HashString(hash, s);
+	/* argument separator */
+	hash = HashBytes(hash, "", 1);
+    }
+
+    return hash;
+}
+
+
+/* functions see their arguments through R2N() and R2S() only */
+static int SameArgument(RESULT * a, RESULT * b)
+{
+    if (a->type == 0 || b->type == 0)
+	return a->type == b->type;
+
+    return R2N(a) == R2N(b) && strcmp(R2S(a), R2S(b)) == 0;
+}
+
+
+static CACHE *LookupCall(FUNCTION * F, const unsigned int hash, const int argc, RESULT ** argv)
+{
+    unsigned int i, n;
+    int k;
+
+    for (n = 0, i = hash & (nCache - 1); n < nCache; n++, i = (i + 1) & (nCache - 1)) {
+	CACHE *C = &Cache[i];
+	/* entries are only added at the first stale slot */
+	if (C->Tick != Tick)
+	    return NULL;
+	if (C->Hash != hash || C->Func != F->func || C->Argc != argc)
+	    continue;
+	for (k = 0; k < argc; k++) {
+	    if (!SameArgument(&C->Argv[k], argv[k]))
+		break;
+	}
+	if (k == argc)
+	    return C;
+    }
+
+    return NULL;
+}
+
+
+static void StoreCall(FUNCTION * F, const unsigned int hash, const int argc, RESULT ** argv, RESULT * result)
+{
+    unsigned int i, n;
+    int k;
+
+    if (Cache == NULL)
+	NewCache(CACHE_SIZE);
+
+    /* table is full for this tick, it will grow with the next one */
+    if (4 * nCached >= 3 * nCache)
+	return;
+
+    for (n = 0, i = hash & (nCache - 1); n < nCache; n++, i = (i + 1) & (nCache - 1)) {
+	CACHE *C = &Cache[i];
+	RESULT *r;
+	if (C->Tick == Tick)
+	    continue;
+	if (C->nArgv < argc) {
+	    /* no realloc(): results must not move */
+	    for (k = 0; k < C->nArgv; k++) {
+		DelResult(&C->Argv[k]);
+	    }
+	    free(C->Argv);
+	    C->Argv = calloc(argc, sizeof(RESULT));
+	    C->nArgv = C->Argv ? argc : 0;
+	    if (C->Argv == NULL)
+		return;
+	}
+	for (k = 0; k < argc; k++) {
+	    r = &C->Argv[k];
+	    CopyResult(&r, argv[k]);
+	    /* convert once, not on every compare */
+	    if (r->type != 0) {
+		R2N(r);
+		R2S(r);
+	    }
+	}
+	r = &C->Result;
+	CopyResult(&r, result);
+	C->Tick = Tick;
+	C->Hash = hash;
+	C->Func = F->func;
+	C->Argc = argc;
+	nCached++;
+	return;
+    }
+}
+
+
+/* call a function, argv[] holds argc arguments */
+static void CallFunction(FUNCTION * F, RESULT * result, const int argc, RESULT ** argv)
+{
+    RESULT *param[10];
+    unsigned int hash = 0;
+    int cache, i;
+
+    cache = (F->flags & F_CACHE) && !(F->flags & (F_PURE | F_VOLATILE | F_NOCACHE));
+
+    if (cache) {
+	CACHE *C;
+	hash = HashCall(F, argc, argv);
+	C = Cache ? LookupCall(F, hash, argc, argv) : NULL;
+	if (C != NULL) {
+	    CacheHits++;
+	    CopyResult(&result, &C->Result);
+	    return;
+	}
+	CacheMisses++;
+    }
+
+    if (F->argc < 0) {
+	/* Function with variable argument list:  */
+	/* pass number of arguments as first parameter */
+	F->func(result, argc, argv);
+    } else {
+	for (i = 0; i < 10; i++) {
+	    param[i] = i < argc ? argv[i] : NULL;
+	}
+	F->func(result, param[0], param[1], param[2], param[3], param[4], param[5], param[6], param[7], param[8], param[9]);
+    }
+
+    if (cache)
+	StoreCall(F, hash, argc, argv, result);
+}
+
+
+void EvalTick(void)
+{
+    Tick++;
+
+    /* more than half full: grow, the old entries are stale anyway */
+    if (2 * nCached > nCache)
+	NewCache(2 * nCache);
+
+    nCached = 0;
+}
+
+
+void EvalStats(EVAL_STATS * stats)
+{
+    stats->hits = CacheHits;
+    stats->misses = CacheMisses;
+    stats->entries = nCached;
+    stats->allocs = nAlloc;
+}
+
+
 void DeleteFunctions(void)
 {
     unsigned int i;
@@ -522,6 +984,8 @@ void DeleteFunctions(void)
     free(Function);
     Function = NULL;
     nFunction = 0;
+
+    DelCache();
 }
 
 
@@ -861,11 +1325,7 @@ static NODE *Level12(void)
 	    Root = NewNode(NULL);
 	    Root->Token = T_VARIABLE;
 	    Root->Result = NewResult();
-	    Root->Variable = FindVariable(Word);
-	    if (Root->Variable == NULL) {
-		SetVariableString(Word, "");
-		Root->Variable = FindVariable(Word);
-	    }
+	    Root->Variable = InternVariable(Word);
 	}
     }
 
@@ -1057,18 +1517,12 @@ static NODE *Level02(void)
 
     /* we have to do a look-ahead if it's really an assignment */
     if ((Token == T_NAME) && (*ExprPtr == '=') && (*(ExprPtr + 1) != '=')) {
-	char *name = strdup(Word);
-	VARIABLE *V = FindVariable(name);
-	if (V == NULL) {
-	    SetVariableString(name, "");
-	    V = FindVariable(name);
-	}
+	VARIABLE *V = InternVariable(Word);
 	Parse();
 	Root = NewNode(NULL);
 	Root->Variable = V;
 	Parse();
 	LinkNode(Root, Level03());
-	free(name);
     } else {
 	Root = Level03();
     }
@@ -1101,11 +1555,16 @@ static int EvalTree(NODE * Root)
     int type = -1;
     double number = 0.0;
     double dummy;
-    int freeme = 0;
-    char *string = NULL;
+    char *string;
     char *s1, *s2;
     RESULT *param[10];
 
+    /* identical sub-tree has already been evaluated */
+    if (Root->Same != NULL) {
+	CopyResult(&Root->Result, Root->Same->Result);
+	return 0;
+    }
+
     switch (Root->Token) {
 
     case T_NUMBER:
@@ -1114,11 +1573,12 @@ static int EvalTree(NODE * Root)
 	return 0;
 
     case T_VARIABLE:
-	CopyResult(&Root->Result, Root->Variable->value);
+	if (!Root->Bound)
+	    CopyResult(&Root->Result, Root->Variable->value);
 	return 0;
 
     case T_FUNCTION:
-	DelResult(Root->Result);
+	ClearResult(Root->Result);
 	/* prepare parameter list */
 	argc = Root->Children;
 	if (argc > 10) {
@@ -1129,14 +1589,7 @@ static int EvalTree(NODE * Root)
 	    EvalTree(Root->Child[i]);
 	    param[i] = Root->Child[i]->Result;
 	}
-	if (Root->Function->argc < 0) {
-	    /* Function with variable argument list:  */
-	    /* pass number of arguments as first parameter */
-	    Root->Function->func(Root->Result, argc, &param);
-	} else {
-	    Root->Function->func(Root->Result, param[0], param[1], param[2], param[3], param[4], param[5], param[6],
-				 param[7], param[8], param[9]);
-	}
+	CallFunction(Root->Function, Root->Result, argc, param);
 	return 0;
 
     case T_OPERATOR:
@@ -1146,28 +1599,21 @@ static int EvalTree(NODE * Root)
 	    for (i = 0; i < Root->Children; i++) {
 		EvalTree(Root->Child[i]);
 	    }
-	    i = Root->Children - 1;
-	    type = Root->Child[i]->Result->type;
-	    number = Root->Child[i]->Result->number;
-	    string = Root->Child[i]->Result->string;
-	    break;
+	    CopyResult(&Root->Result, Root->Child[Root->Children - 1]->Result);
+	    return 0;
 
 	case O_SET:		/* variable assignment */
 	    EvalTree(Root->Child[0]);
-	    CopyResult(&Root->Variable->value, Root->Child[0]->Result);
-	    type = Root->Child[0]->Result->type;
-	    number = Root->Child[0]->Result->number;
-	    string = Root->Child[0]->Result->string;
-	    break;
+	    AssignVariable(Root->Variable, Root->Child[0]->Result);
+	    CopyResult(&Root->Result, Root->Child[0]->Result);
+	    return 0;
 
 	case O_CND:		/* conditional expression */
 	    EvalTree(Root->Child[0]);
 	    i = 1 + (R2N(Root->Child[0]->Result) == 0.0);
 	    EvalTree(Root->Child[i]);
-	    type = Root->Child[i]->Result->type;
-	    number = Root->Child[i]->Result->number;
-	    string = Root->Child[i]->Result->string;
-	    break;
+	    CopyResult(&Root->Result, Root->Child[i]->Result);
+	    return 0;
 
 	case O_OR:		/* logical OR */
 	    type = R_NUMBER;
@@ -1296,16 +1742,16 @@ static int EvalTree(NODE * Root)
 	    break;
 
 	case O_CAT:		/* string concatenation */
-	    type = R_STRING;
 	    EvalTree(Root->Child[0]);
 	    EvalTree(Root->Child[1]);
 	    s1 = R2S(Root->Child[0]->Result);
 	    s2 = R2S(Root->Child[1]->Result);
-	    string = malloc(strlen(s1) + strlen(s2) + 1);
+	    if (Root->Result == NULL && (Root->Result = NewResult()) == NULL)
+		return -1;
+	    string = ReserveString(Root->Result, strlen(s1) + strlen(s2));
 	    strcpy(string, s1);
 	    strcat(string, s2);
-	    freeme = 1;
-	    break;
+	    return 0;
 
 	case O_MUL:		/* multiplication */
 	    type = R_NUMBER;
@@ -1363,12 +1809,6 @@ static int EvalTree(NODE * Root)
 	    SetResult(&Root->Result, R_NUMBER, &number);
 	    return 0;
 	}
-	if (type == R_STRING) {
-	    SetResult(&Root->Result, R_STRING, string);
-	    if (freeme)
-		free(string);
-	    return 0;
-	}
 	error("Evaluator: internal error: unhandled type <%d>", type);
 	SetResult(&Root->Result, R_STRING, "");
 	return -1;
@@ -1384,36 +1824,906 @@ static int EvalTree(NODE * Root)
 }
 
 
-int Compile(const char *expression, void **tree)
+static void DelNode(NODE * Tree)
 {
-    NODE *Root;
-
-    *tree = NULL;
+    int i;
 
-    Expression = (char *) expression;
-    ExprPtr = Expression;
+    if (Tree == NULL)
+	return;
 
-    Parse();
-    if (*Word == '\0') {
-	/* error ("Evaluator: empty expression <%s>", Expression); */
-	free(Word);
-	Word = NULL;
-	return -1;
+    for (i = 0; i < Tree->Children; i++) {
+	DelNode(Tree->Child[i]);
     }
 
-    Root = Level01();
+    if (Tree->Child)
+	free(Tree->Child);
+    if (Tree->Result && !Tree->Bound)
+	FreeResult(Tree->Result);
+    free(Tree);
+}
 
-    if (*Word != '\0') {
-	error("Evaluator: syntax error in <%s>: garbage <%s>", Expression, Word);
-	free(Word);
-	Word = NULL;
+
+/* does the (sub)tree contain a variable assignment? */
+static int HasAssignment(NODE * Root)
+{
+    int i;
+
+    if (Root->Token == T_OPERATOR && Root->Operator == O_SET)
+	return 1;
+
+    for (i = 0; i < Root->Children; i++) {
+	if (HasAssignment(Root->Child[i]))
+	    return 1;
+    }
+
+    return 0;
+}
+
+
+/* variable nodes read the value directly instead of a copy */
+static void BindVariables(NODE * Root)
+{
+    int i;
+
+    for (i = 0; i < Root->Children; i++) {
+	BindVariables(Root->Child[i]);
+    }
+
+    if (Root->Token == T_VARIABLE && !Root->Bound) {
+	FreeResult(Root->Result);
+	Root->Result = Root->Variable->value;
+	Root->Bound = 1;
+    }
+}
+
+
+/* is the node a literal constant? */
+static int IsConstant(NODE * Root)
+{
+    return Root->Token == T_NUMBER || Root->Token == T_STRING;
+}
+
+
+/* does the (sub)tree call functions with side effects? */
+static int IsVolatile(NODE * Root)
+{
+    int i;
+
+    if (Root->Token == T_FUNCTION && Root->Function->flags & F_VOLATILE)
+	return 1;
+
+    for (i = 0; i < Root->Children; i++) {
+	if (IsVolatile(Root->Child[i]))
+	    return 1;
+    }
+
+    return 0;
+}
+
+
+static void DelChildren(NODE * Root)
+{
+    int i;
+
+    for (i = 0; i < Root->Children; i++) {
+	DelNode(Root->Child[i]);
+    }
+    if (Root->Child)
+	free(Root->Child);
+    Root->Child = NULL;
+    Root->Children = 0;
+}
+
+
+/* replace a node by the constant it evaluates to */
+static int FoldNode(NODE * Root)
+{
+    if (EvalTree(Root) != 0 || Root->Result == NULL || Root->Result->type == 0)
+	return 0;
+
+    DelChildren(Root);
+    Root->Token = Root->Result->type & R_STRING ? T_STRING : T_NUMBER;
+    Root->Operator = O_UNDEF;
+    Root->Function = NULL;
+
+    return 1;
+}
+
+
+/* replace a node by one of its children */
+static void LiftNode(NODE * Root, const int n)
+{
+    NODE *Child = Root->Child[n];
+    int i;
+
+    for (i = 0; i < Root->Children; i++) {
+	if (i != n)
+	    DelNode(Root->Child[i]);
+    }
+    free(Root->Child);
+    if (Root->Result)
+	FreeResult(Root->Result);
+
+    *Root = *Child;
+    free(Child);
+}
+
+
+/* constant folding, returns number of folded nodes */
+static int Fold(NODE * Root)
+{
+    int i, n = 0;
+    int constant = 1;
+
+    for (i = 0; i < Root->Children; i++) {
+	n += Fold(Root->Child[i]);
+	if (!IsConstant(Root->Child[i]))
+	    constant = 0;
+    }
+
+    if (Root->Token == T_FUNCTION) {
+	if (constant && Root->Function->flags & F_PURE)
+	    n += FoldNode(Root);
+	return n;
+    }
+
+    if (Root->Token != T_OPERATOR || Root->Children == 0)
+	return n;
+
+    switch (Root->Operator) {
+
+    case O_SET:
+	break;
+
+    case O_CND:
+	if (Root->Children == 3 && IsConstant(Root->Child[0])) {
+	    LiftNode(Root, R2N(Root->Child[0]->Result) != 0.0 ? 1 : 2);
+	    n++;
+	}
+	break;
+
+    case O_OR:
+    case O_AND:
+	/* short-circuit: second operand will not be evaluated */
+	if (constant || (IsConstant(Root->Child[0]) &&
+			 (R2N(Root->Child[0]->Result) != 0.0) == (Root->Operator == O_OR))) {
+	    n += FoldNode(Root);
+	}
+	break;
+
+    default:
+	if (constant)
+	    n += FoldNode(Root);
+    }
+
+    return n;
+}
+
+
+/* may the node share its result with an identical one? */
+static int Shareable(NODE * Root)
+{
+    if (Root->Token == T_OPERATOR) {
+	switch (Root->Operator) {
+	case O_LST:
+	case O_SET:
+	case O_CND:
+	case O_OR:
+	case O_AND:
+	    return 0;
+	default:
+	    break;
+	}
+    } else if (Root->Token != T_FUNCTION) {
+	return 0;
+    }
+
+    return !IsVolatile(Root);
+}
+
+
+/* are two sub-trees identical? */
+static int SameTree(NODE * a, NODE * b)
+{
+    int i;
+
+    if (a->Same)
+	a = a->Same;
+    if (b->Same)
+	b = b->Same;
+
+    if (a->Token != b->Token || a->Operator != b->Operator || a->Children != b->Children)
+	return 0;
+
+    if (a->Function != b->Function || a->Variable != b->Variable)
+	return 0;
+
+    if (IsConstant(a)) {
+	if (a->Result->type != b->Result->type)
+	    return 0;
+	if (a->Result->type & R_STRING)
+	    return strcmp(a->Result->string, b->Result->string) == 0;
+	return a->Result->number == b->Result->number;
+    }
+
+    for (i = 0; i < a->Children; i++) {
+	if (!SameTree(a->Child[i], b->Child[i]))
+	    return 0;
+    }
+
+    return 1;
+}
+
+
+/* common subexpression elimination, returns number of shared nodes */
+/* only sub-trees which are always evaluated may be referenced */
+static int Share(NODE * Root, NODE *** Seen, int *nSeen, const int conditional)
+{
+    int i, n = 0;
+    int branch;
+
+    if (Shareable(Root)) {
+	for (i = 0; i < *nSeen; i++) {
+	    if (SameTree((*Seen)[i], Root)) {
+		DelChildren(Root);
+		Root->Same = (*Seen)[i];
+		return 1;
+	    }
+	}
+    }
+
+    branch = Root->Token == T_OPERATOR && (Root->Operator == O_CND || Root->Operator == O_OR || Root->Operator == O_AND);
+
+    for (i = 0; i < Root->Children; i++) {
+	n += Share(Root->Child[i], Seen, nSeen, conditional || (branch && i > 0));
+    }
+
+    if (!conditional && Shareable(Root)) {
+	*Seen = realloc(*Seen, (*nSeen + 1) * sizeof(NODE *));
+	(*Seen)[(*nSeen)++] = Root;
+    }
+
+    return n;
+}
+
+
+static const char *OperatorName(const OPERATOR op)
+{
+    unsigned int i;
+
+    if (op == O_SGN)
+	return "-";
+    if (op == O_CND)
+	return "?:";
+
+    for (i = 0; i < sizeof(Pattern1) / sizeof(Pattern1[0]); i++) {
+	if (Pattern1[i].op == op)
+	    return Pattern1[i].pattern;
+    }
+    for (i = 0; i < sizeof(Pattern2) / sizeof(Pattern2[0]); i++) {
+	if (Pattern2[i].op == op)
+	    return Pattern2[i].pattern;
+    }
+
+    return "?";
+}
+
+
+/* append a human readable dump of a (sub)tree to 'dump' */
+static char *DumpTree(NODE * Root, const int level, char *dump)
+{
+    char line[256];
+    int i, len;
+
+    switch (Root->Token) {
+    case T_NUMBER:
+	snprintf(line, sizeof(line), "%*s%g", 2 * level, "", Root->Result->number);
+	break;
+    case T_STRING:
+	snprintf(line, sizeof(line), "%*s'%s'", 2 * level, "", Root->Result->string ? Root->Result->string : "");
+	break;
+    case T_VARIABLE:
+	snprintf(line, sizeof(line), "%*s%s", 2 * level, "", Root->Variable->name);
+	break;
+    case T_FUNCTION:
+	snprintf(line, sizeof(line), "%*s%s()%s", 2 * level, "", Root->Function->name,
+		 Root->Function->flags & F_PURE ? " [pure]" : "");
+	break;
+    case T_OPERATOR:
+	if (Root->Operator == O_SET) {
+	    snprintf(line, sizeof(line), "%*s%s =", 2 * level, "", Root->Variable->name);
+	} else {
+	    snprintf(line, sizeof(line), "%*s%s", 2 * level, "", OperatorName(Root->Operator));
+	}
+	break;
+    default:
+	snprintf(line, sizeof(line), "%*s<%d>", 2 * level, "", Root->Token);
+    }
+
+    if (Root->Same) {
+	len = strlen(line);
+	snprintf(line + len, sizeof(line) - len, " [shared]");
+    }
+
+    len = dump ? strlen(dump) : 0;
+    dump = realloc(dump, len + strlen(line) + 2);
+    sprintf(dump + len, "%s\n", line);
+
+    for (i = 0; i < Root->Children; i++) {
+	dump = DumpTree(Root->Child[i], level + 1, dump);
+    }
+
+    return dump;
+}
+
+
+static void PrintDump(const char *title, char *dump)
+{
+    char *line, *next;
+
+    debug("%s", title);
+    for (line = dump; line != NULL && *line != '\0'; line = next) {
+	next = strchr(line, '\n');
+	if (next != NULL)
+	    *next++ = '\0';
+	debug("  %s", line);
+    }
+}
+
+
+/* compile-time optimization of the parse tree */
+static void Optimize(NODE * Root)
+{
+    NODE **Seen = NULL;
+    int nSeen = 0;
+    int folded, shared = 0;
+    char *before = NULL, *after = NULL;
+
+    if (verbose_level > 1)
+	before = DumpTree(Root, 0, NULL);
+
+    folded = Fold(Root);
+
+    /* assignments may change variables between two occurrences */
+    if (!HasAssignment(Root)) {
+	shared = Share(Root, &Seen, &nSeen, 0);
+	free(Seen);
+    }
+
+    if (before != NULL && (folded > 0 || shared > 0)) {
+	debug("Evaluator: <%s>: %d node(s) folded, %d node(s) shared", Expression, folded, shared);
+	after = DumpTree(Root, 0, NULL);
+	PrintDump("tree before optimization:", before);
+	PrintDump("tree after optimization:", after);
+	free(after);
+    }
+
+    free(before);
+}
+
+
+/* append an instruction to the program */
+/* while sizing (no code allocated yet) a scratch instruction is returned */
+static INSTR *Emit(PROGRAM * Program, const OPCODE opcode)
+{
+    static INSTR Scratch;
+    INSTR *I;
+
+    if (Program->Code == NULL) {
+	I = &Scratch;
+    } else {
+	I = &Program->Code[Program->nCode];
+    }
+    Program->nCode++;
+
+    I->Opcode = opcode;
+    I->Operator = O_UNDEF;
+    I->Arg = 0;
+    I->Variable = NULL;
+    I->Function = NULL;
+
+    return I;
+}
+
+
+/* track value stack depth */
+static void Depth(PROGRAM * Program, int *depth, const int delta)
+{
+    *depth += delta;
+    if (*depth > Program->nStack)
+	Program->nStack = *depth;
+}
+
+
+/* translate a (sub)tree into bytecode */
+static int Translate(PROGRAM * Program, NODE * Root, int *depth)
+{
+    INSTR *I, *J;
+    RESULT *result;
+    int i, argc;
+    int operands = 2;
+
+    /* reference the result of an identical sub-tree */
+    if (Root->Same != NULL) {
+	I = Emit(Program, I_REF);
+	I->Arg = Root->Same->Slot;
+	Depth(Program, depth, 1);
+	return 0;
+    }
+
+    switch (Root->Token) {
+
+    case T_NUMBER:
+    case T_STRING:
+	I = Emit(Program, I_CONST);
+	if (Program->Code != NULL) {
+	    result = &I->Result;
+	    CopyResult(&result, Root->Result);
+	}
+	Depth(Program, depth, 1);
+	return 0;
+
+    case T_VARIABLE:
+	I = Emit(Program, I_VAR);
+	I->Variable = Root->Variable;
+	/* variables may change while the program runs: read a copy */
+	I->Arg = Program->Assign;
+	Depth(Program, depth, 1);
+	return 0;
+
+    case T_FUNCTION:
+	argc = Root->Children;
+	if (argc > 10) {
+	    error("evaluator: more than 10 children (operands) not supported!");
+	    argc = 10;
+	}
+	for (i = 0; i < argc; i++) {
+	    if (Translate(Program, Root->Child[i], depth) < 0)
+		return -1;
+	}
+	I = Emit(Program, I_CALL);
+	I->Function = Root->Function;
+	I->Arg = argc;
+	Root->Slot = Program->nCode - 1;
+	Depth(Program, depth, 1 - argc);
+	return 0;
+
+    case T_OPERATOR:
+	switch (Root->Operator) {
+
+	case O_LST:		/* expression list: result is last expression */
+	    for (i = 0; i < Root->Children; i++) {
+		if (i > 0) {
+		    Emit(Program, I_POP);
+		    Depth(Program, depth, -1);
+		}
+		if (Translate(Program, Root->Child[i], depth) < 0)
+		    return -1;
+	    }
+	    return 0;
+
+	case O_SET:		/* variable assignment */
+	    if (Root->Children < 1 || Translate(Program, Root->Child[0], depth) < 0)
+		return -1;
+	    I = Emit(Program, I_SET);
+	    I->Variable = Root->Variable;
+	    return 0;
+
+	case O_CND:		/* conditional expression */
+	    if (Root->Children < 3 || Translate(Program, Root->Child[0], depth) < 0)
+		return -1;
+	    I = Emit(Program, I_JZ);
+	    Depth(Program, depth, -1);
+	    if (Translate(Program, Root->Child[1], depth) < 0)
+		return -1;
+	    J = Emit(Program, I_JMP);
+	    I->Arg = Program->nCode;
+	    /* 'else' branch starts with the same stack */
+	    Depth(Program, depth, -1);
+	    if (Translate(Program, Root->Child[2], depth) < 0)
+		return -1;
+	    J->Arg = Program->nCode;
+	    return 0;
+
+	case O_OR:		/* logical OR */
+	case O_AND:		/* logical AND */
+	    if (Root->Children < 2 || Translate(Program, Root->Child[0], depth) < 0)
+		return -1;
+	    I = Emit(Program, Root->Operator == O_OR ? I_OR : I_AND);
+	    if (Program->Code != NULL) {
+		I->Result.type = R_NUMBER;
+		I->Result.number = (Root->Operator == O_OR);
+	    }
+	    Depth(Program, depth, -1);
+	    if (Translate(Program, Root->Child[1], depth) < 0)
+		return -1;
+	    Emit(Program, I_BOOL);
+	    I->Arg = Program->nCode;
+	    return 0;
+
+	case O_SGN:
+	case O_NOT:
+	    operands = 1;
+	    /* fall through */
+	case O_NEQ:
+	case O_NNE:
+	case O_NLT:
+	case O_NLE:
+	case O_NGT:
+	case O_NGE:
+	case O_SEQ:
+	case O_SNE:
+	case O_SLT:
+	case O_SLE:
+	case O_SGT:
+	case O_SGE:
+	case O_ADD:
+	case O_SUB:
+	case O_CAT:
+	case O_MUL:
+	case O_DIV:
+	case O_MOD:
+	case O_POW:
+	    if (Root->Children < operands)
+		return -1;
+	    for (i = 0; i < operands; i++) {
+		if (Translate(Program, Root->Child[i], depth) < 0)
+		    return -1;
+	    }
+	    I = Emit(Program, I_OP);
+	    I->Operator = Root->Operator;
+	    Root->Slot = Program->nCode - 1;
+	    Depth(Program, depth, 1 - operands);
+	    return 0;
+
+	default:
+	    return -1;
+	}
+
+    default:
+	return -1;
+    }
+}
+
+
+/* collect variables and impure functions the result depends on */
+static void Depends(PROGRAM * Program, NODE * Root)
+{
+    int i;
+
+    for (i = 0; i < Root->Children; i++) {
+	Depends(Program, Root->Child[i]);
+    }
+
+    switch (Root->Token) {
+    case T_VARIABLE:
+	for (i = 0; i < Program->nDepends; i++) {
+	    if (Program->Depends[i] == Root->Variable)
+		return;
+	}
+	Program->nDepends++;
+	Program->Depends = realloc(Program->Depends, Program->nDepends * sizeof(VARIABLE *));
+	Program->Depends[Program->nDepends - 1] = Root->Variable;
+	break;
+    case T_FUNCTION:
+	if (!(Root->Function->flags & F_PURE))
+	    Program->Impure = 1;
+	break;
+    case T_OPERATOR:
+	if (Root->Operator == O_SET)
+	    Program->Impure = 1;
+	break;
+    default:
+	break;
+    }
+}
+
+
+static PROGRAM *NewProgram(NODE * Root)
+{
+    PROGRAM *Program;
+    int depth;
+
+    Program = malloc(sizeof(PROGRAM));
+    if (Program == NULL) {
+	error("Evaluator: cannot allocate program: out of memory!");
+	return NULL;
+    }
+    memset(Program, 0, sizeof(PROGRAM));
+    Program->Tree = Root;
+    Program->Assign = HasAssignment(Root);
+    Depends(Program, Root);
+
+    /* first pass: count instructions and stack depth */
+    depth = 0;
+    if (Translate(Program, Root, &depth) < 0) {
+	debug("Evaluator: cannot translate <%s>, using tree interpreter", Expression);
+	Program->nCode = 0;
+	return Program;
+    }
+
+    Program->Code = calloc(Program->nCode, sizeof(INSTR));
+    Program->Stack = malloc(Program->nStack * sizeof(RESULT *));
+    if (Program->Code == NULL || Program->Stack == NULL) {
+	free(Program->Code);
+	free(Program->Stack);
+	Program->Code = NULL;
+	Program->Stack = NULL;
+	Program->nCode = 0;
+	return Program;
+    }
+
+    /* second pass: generate code */
+    Program->nCode = 0;
+    depth = 0;
+    Translate(Program, Root, &depth);
+
+    return Program;
+}
+
+
+static int EvalOperator(INSTR * I, RESULT * a, RESULT * b)
+{
+    RESULT *result = &I->Result;
+    double dummy;
+    char *s1, *s2;
+    int l1, l2;
+
+    switch (I->Operator) {
+
+    case O_NEQ:		/* numeric equal */
+	SetNumber(result, R2N(a) == R2N(b));
+	break;
+
+    case O_NNE:		/* numeric not equal */
+	SetNumber(result, R2N(a) != R2N(b));
+	break;
+
+    case O_NLT:		/* numeric less than */
+	SetNumber(result, R2N(a) < R2N(b));
+	break;
+
+    case O_NLE:		/* numeric less equal */
+	SetNumber(result, R2N(a) <= R2N(b));
+	break;
+
+    case O_NGT:		/* numeric greater than */
+	SetNumber(result, R2N(a) > R2N(b));
+	break;
+
+    case O_NGE:		/* numeric greater equal */
+	SetNumber(result, R2N(a) >= R2N(b));
+	break;
+
+    case O_SEQ:		/* string equal */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) == 0);
+	break;
+
+    case O_SNE:		/* string not equal */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) != 0);
+	break;
+
+    case O_SLT:		/* string less than */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) < 0);
+	break;
+
+    case O_SLE:		/* string less equal */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) <= 0);
+	break;
+
+    case O_SGT:		/* string greater than */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) > 0);
+	break;
+
+    case O_SGE:		/* string greater equal */
+	SetNumber(result, strcmp(R2S(a), R2S(b)) >= 0);
+	break;
+
+    case O_ADD:		/* addition */
+	SetNumber(result, R2N(a) + R2N(b));
+	break;
+
+    case O_SUB:		/* subtraction */
+	SetNumber(result, R2N(a) - R2N(b));
+	break;
+
+    case O_SGN:		/* sign */
+	SetNumber(result, -R2N(a));
+	break;
+
+    case O_CAT:		/* string concatenation */
+	s1 = R2S(a);
+	s2 = R2S(b);
+	l1 = strlen(s1);
+	l2 = strlen(s2);
+	ReserveString(result, l1 + l2);
+	memcpy(result->string, s1, l1);
+	memcpy(result->string + l1, s2, l2 + 1);
+	break;
+
+    case O_MUL:		/* multiplication */
+	SetNumber(result, R2N(a) * R2N(b));
+	break;
+
+    case O_DIV:		/* division */
+	dummy = R2N(b);
+	if (dummy == 0) {
+	    error("Evaluator: warning: division by zero");
+	    SetNumber(result, 0.0);
+	} else {
+	    SetNumber(result, R2N(a) / dummy);
+	}
+	break;
+
+    case O_MOD:		/* modulo */
+	dummy = R2N(b);
+	if (dummy == 0) {
+	    error("Evaluator: warning: division by zero");
+	    SetNumber(result, 0.0);
+	} else {
+	    SetNumber(result, fmod(R2N(a), dummy));
+	}
+	break;
+
+    case O_POW:		/* x^y */
+	SetNumber(result, pow(R2N(a), R2N(b)));
+	break;
+
+    case O_NOT:		/* logical NOT */
+	SetNumber(result, R2N(a) == 0.0);
+	break;
+
+    default:
+	error("Evaluator: internal error: unhandled operator <%d>", I->Operator);
+	*ReserveString(result, 0) = '\0';
+	return -1;
+    }
+
+    return 0;
+}
+
+
+/* run a bytecode program, *top receives the final value */
+static int EvalCode(PROGRAM * Program, RESULT ** top)
+{
+    INSTR *I;
+    RESULT **Stack = Program->Stack;
+    int pc, sp;
+    int ret = 0;
+
+    pc = 0;
+    sp = 0;
+
+    while (pc < Program->nCode) {
+
+	I = &Program->Code[pc++];
+
+	switch (I->Opcode) {
+
+	case I_CONST:
+	    Stack[sp++] = &I->Result;
+	    break;
+
+	case I_VAR:
+	    if (I->Arg) {
+		RESULT *result = &I->Result;
+		CopyResult(&result, I->Variable->value);
+		Stack[sp++] = result;
+	    } else {
+		Stack[sp++] = I->Variable->value;
+	    }
+	    break;
+
+	case I_SET:
+	    AssignVariable(I->Variable, Stack[sp - 1]);
+	    break;
+
+	case I_POP:
+	    sp--;
+	    break;
+
+	case I_JMP:
+	    pc = I->Arg;
+	    break;
+
+	case I_JZ:
+	    if (R2N(Stack[--sp]) == 0.0)
+		pc = I->Arg;
+	    break;
+
+	case I_OR:
+	    if (R2N(Stack[sp - 1]) != 0.0) {
+		Stack[sp - 1] = &I->Result;
+		pc = I->Arg;
+	    } else {
+		sp--;
+	    }
+	    break;
+
+	case I_AND:
+	    if (R2N(Stack[sp - 1]) == 0.0) {
+		Stack[sp - 1] = &I->Result;
+		pc = I->Arg;
+	    } else {
+		sp--;
+	    }
+	    break;
+
+	case I_BOOL:
+	    SetNumber(&I->Result, R2N(Stack[sp - 1]) != 0.0);
+	    Stack[sp - 1] = &I->Result;
+	    break;
+
+	case I_OP:
+	    if (I->Operator == O_SGN || I->Operator == O_NOT) {
+		ret |= EvalOperator(I, Stack[sp - 1], NULL);
+	    } else {
+		sp--;
+		ret |= EvalOperator(I, Stack[sp - 1], Stack[sp]);
+	    }
+	    Stack[sp - 1] = &I->Result;
+	    break;
+
+	case I_CALL:
+	    sp -= I->Arg;
+	    ClearResult(&I->Result);
+	    CallFunction(I->Function, &I->Result, I->Arg, &Stack[sp]);
+	    Stack[sp++] = &I->Result;
+	    break;
+
+	case I_REF:
+	    Stack[sp++] = &Program->Code[I->Arg].Result;
+	    break;
+	}
+    }
+
+    *top = Stack[0];
+
+    return ret ? -1 : 0;
+}
+
+
+int Compile(const char *expression, void **tree)
+{
+    NODE *Root;
+
+    *tree = NULL;
+
+    Expression = (char *) expression;
+    ExprPtr = Expression;
+
+    Parse();
+    if (*Word == '\0') {
+	/* error ("Evaluator: empty expression <%s>", Expression); */
+	free(Word);
+	Word = NULL;
+	return -1;
+    }
+
+    Root = Level01();
+
+    if (*Word != '\0') {
+	error("Evaluator: syntax error in <%s>: garbage <%s>", Expression, Word);
+	free(Word);
+	Word = NULL;
+	DelNode(Root);
 	return -1;
     }
 
     free(Word);
     Word = NULL;
 
-    *(NODE **) tree = Root;
+    Optimize(Root);
+
+    /* without assignments no variable can change during evaluation */
+    if (!HasAssignment(Root))
+	BindVariables(Root);
+
+    *(PROGRAM **) tree = NewProgram(Root);
+    if (*tree == NULL) {
+	DelNode(Root);
+	return -1;
+    }
 
     return 0;
 }
@@ -1422,47 +2732,72 @@ int Compile(const char *expression, void **tree)
 int Eval(void *tree, RESULT * result)
 {
     int ret;
-    NODE *Tree = (NODE *) tree;
-
-    DelResult(result);
+    PROGRAM *Program = (PROGRAM *) tree;
+    RESULT *value;
 
-    if (Tree == NULL) {
+    if (Program == NULL) {
 	SetResult(&result, R_STRING, "");
 	return 0;
     }
 
-    ret = EvalTree(Tree);
+    Program->Generation = Generation;
 
-    result->type = Tree->Result->type;
-    result->size = Tree->Result->size;
-    result->number = Tree->Result->number;
-    if (result->size > 0) {
-	result->string = malloc(result->size);
-	if (Tree->Result->string != NULL) {
-	    strcpy(result->string, Tree->Result->string);
-	} else
-	    result->string[0] = '\0';
+    if (Program->Code != NULL && Backend == EVAL_BYTECODE) {
+	ret = EvalCode(Program, &value);
     } else {
-	result->string = NULL;
+	ret = EvalTree(Program->Tree);
+	value = Program->Tree->Result;
     }
 
+    /* reuses the string buffer of the result */
+    CopyResult(&result, value);
+
     return ret;
 }
 
 
+int EvalChanged(void *tree)
+{
+    PROGRAM *Program = (PROGRAM *) tree;
+    int i;
+
+    if (Program == NULL || Program->Generation == 0 || Program->Impure)
+	return 1;
+
+    for (i = 0; i < Program->nDepends; i++) {
+	if (Program->Depends[i]->generation > Program->Generation)
+	    return 1;
+    }
+
+    return 0;
+}
+
+
+int EvalBackend(const int backend)
+{
+    int old = Backend;
+
+    Backend = backend;
+
+    return old;
+}
+
+
 void DelTree(void *tree)
 {
     int i;
-    NODE *Tree = (NODE *) tree;
+    PROGRAM *Program = (PROGRAM *) tree;
 
-    if (Tree == NULL)
+    if (Program == NULL)
 	return;
 
-    for (i = 0; i < Tree->Children; i++) {
-	DelTree(Tree->Child[i]);
+    for (i = 0; i < Program->nCode; i++) {
+	DelResult(&Program->Code[i].Result);
     }
+    free(Program->Code);
+    free(Program->Stack);
+    free(Program->Depends);
 
-    if (Tree->Result)
-	FreeResult(Tree->Result);
-    free(Tree);
+    DelNode(Program->Tree);
+    free(Program);
 }
@@ -33,13 +33,35 @@
 #define R_NUMBER 1
 #define R_STRING 2
 
+/* function flags */
+#define F_PURE     1		/* result depends on arguments only: may be folded at compile time */
+#define F_VOLATILE 2		/* side effects: every single call has to be executed */
+#define F_NOCACHE  4		/* result may change within a tick: do not cache */
+#define F_CACHE    8		/* result does not change within a tick: may be cached */
+
+/* evaluator backends */
+#define EVAL_BYTECODE 0
+#define EVAL_TREE     1
+
+/* short strings are stored inside the result */
+#define RESULT_INLINE 16
+
 typedef struct {
     int type;
     int size;
     double number;
-    char *string;
+    char *string;		/* points to buffer or to the heap */
+    int derived;		/* R_NUMBER or R_STRING converted from the other one */
+    char buffer[RESULT_INLINE];
 } RESULT;
 
+typedef struct {
+    unsigned long hits;		/* function cache hits */
+    unsigned long misses;	/* function cache misses */
+    unsigned int entries;	/* cached results of the current tick */
+    unsigned long allocs;	/* heap allocations of results and strings */
+} EVAL_STATS;
+
 /* strndup() may be not available on several platforms */
 #ifndef HAVE_STRNDUP
 #include <string.h>
@@ -51,6 +73,7 @@ int SetVariableNumeric(const char *name, const double value);
 int SetVariableString(const char *name, const char *value);
 
 int AddFunction(const char *name, const int argc, void (*func) ());
+int AddFunctionFlags(const char *name, const int argc, const int flags, void (*func) ());
 
 void DeleteVariables(void);
 void DeleteFunctions(void);
@@ -64,6 +87,10 @@ char *R2S(RESULT * result);
 
 int Compile(const char *expression, void **tree);
 int Eval(void *tree, RESULT * result);
+int EvalChanged(void *tree);
+int EvalBackend(const int backend);
+void EvalTick(void);
+void EvalStats(EVAL_STATS * stats);
 void DelTree(void *tree);
 
 #endif
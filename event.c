@@ -32,7 +32,7 @@
  *   Remove an event
  *
  * int event_modify(const int fd, const int read, const int write, const int active);
- *   Modify an event
+ *   Modify an event, returns -1 if the fd cannot be watched
  *
  * int named_event_add(char *event, void (*callback) (void *data), void *data);
  *   Add an event identified by a string
@@ -44,7 +44,7 @@
  *   call the callbacks of all events that have identified as this string
  *
  * int event_process(const struct timespec *delay);
- *   process the event list
+ *   wait for events (or the delay to expire) and process them
  *
  * void event_exit();
  *   releases all events
@@ -57,27 +57,33 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-
-
-
-#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #include "debug.h"
 #include "cfg.h"
+#include "evaluator.h"
 #include "event.h"
 
 #ifdef WITH_DMALLOC
 #include <dmalloc.h>
 #endif
 
-typedef struct {
+/* max. number of ready file descriptors handled per wakeup */
+#define EVENT_BATCH 16
+
+typedef struct event_t {
     void (*callback) (event_flags_t flags, void *data);
     void *data;
     int fd;
     int read;
     int write;
     int active;
-    int fds_id;
+    int registered;		/* epoll events registered (first event of a fd only) */
+    struct event_t *next;	/* events of the same fd follow each other */
 } event_t;
 
 
@@ -86,118 +92,331 @@ static event_t *events = NULL;
 static int event_count = 0;
 static void free_events(void);
 
+//persistent epoll instance and the timerfd waking us up for the next timer
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static event_t timer_event;
+
+//events returned by the last epoll_wait() and not yet dispatched
+static struct epoll_event ready[EVENT_BATCH];
+static int ready_next = 0, ready_count = 0;
+
+//events deleted by a callback are freed after dispatching, the loop may still hold them
+static int dispatching = 0;
+static event_t *deleted = NULL;
+
+
+static void timer_event_callback(event_flags_t flags, void *data)
+{
+    uint64_t expired;
+    (void) flags;
+    (void) data;
+
+    /* consume the expiration, the timers themselves are processed by the main loop */
+    if (read(timer_fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN) {
+	error("event: read(timerfd) failed: %s", strerror(errno));
+    }
+}
+
+
+static int event_init(void)
+{
+    struct epoll_event ev;
+
+    if (epoll_fd >= 0)
+	return 0;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+	error("event: epoll_create1() failed: %s", strerror(errno));
+	return -1;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+	error("event: timerfd_create() failed: %s", strerror(errno));
+	close(epoll_fd);
+	epoll_fd = -1;
+	return -1;
+    }
+
+    memset(&timer_event, 0, sizeof(timer_event));
+    timer_event.callback = timer_event_callback;
+    timer_event.fd = timer_fd;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &timer_event;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+	error("event: epoll_ctl(timerfd) failed: %s", strerror(errno));
+    }
+
+    return 0;
+}
+
+
+//the first event of a file descriptor, or NULL
+static event_t *event_first(const int fd)
+{
+    event_t *e;
+    for (e = events; e != NULL; e = e->next) {
+	if (e->fd == fd)
+	    return e;
+    }
+    return NULL;
+}
+
+
+//register the events of a file descriptor with epoll
+//'first' is the current first event of this fd (or NULL), 'old' the previous one
+//returns -1 if epoll refused the fd
+static int event_register(const int fd, event_t * first, event_t * old)
+{
+    struct epoll_event ev;
+    int registered, i, ret = 0;
+    event_t *e;
+
+    registered = old ? old->registered : 0;
+
+    memset(&ev, 0, sizeof(ev));
+    for (e = first; e != NULL && e->fd == fd; e = e->next) {
+	if (!e->active)
+	    continue;
+	if (e->read)
+	    ev.events |= EPOLLIN;
+	if (e->write)
+	    ev.events |= EPOLLOUT;
+	//inactive events are not polled at all, active ones get HUP and ERR anyway
+	ev.events |= EPOLLHUP | EPOLLERR;
+    }
+    ev.data.ptr = first;
+
+    if (ev.events == 0) {
+	if (registered)
+	    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+    } else if (registered) {
+	if ((registered != (int) ev.events || first != old) && epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+	    error("event: epoll_ctl(%d) failed: %s", fd, strerror(errno));
+	    ret = -1;
+	}
+    } else if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+	error("event: epoll_ctl(%d) failed: %s", fd, strerror(errno));
+	ev.events = 0;
+	ret = -1;
+    }
+
+    if (first)
+	first->registered = ev.events;
+
+    //events returned but not yet dispatched must not point to a stale event
+    if (old != NULL && first != old) {
+	for (i = ready_next; i < ready_count; i++) {
+	    if (ready[i].data.ptr == old)
+		ready[i].data.ptr = first;
+	}
+    }
+
+    return ret;
+}
+
+
 int event_add(void (*callback) (event_flags_t flags, void *data), void *data, const int fd, const int read,
 	      const int write, const int active)
 {
+    event_t *e, *first;
+
+    if (event_init() < 0)
+	return -1;
+
+    e = malloc(sizeof(event_t));
+    if (e == NULL)
+	return -1;
+
+    e->callback = callback;
+    e->data = data;
+    e->fd = fd;
+    e->read = read;
+    e->write = write;
+    e->active = active;
+    e->registered = 0;
+
+    //keep all events of a fd together
+    first = event_first(fd);
+    if (first) {
+	e->next = first->next;
+	first->next = e;
+    } else {
+	e->next = events;
+	events = e;
+    }
     event_count++;
-    events = realloc(events, sizeof(event_t) * event_count);
-
-    int i = event_count - 1;
-    events[i].callback = callback;
-    events[i].data = data;
-    events[i].fd = fd;
-    events[i].read = read;
-    events[i].write = write;
-    events[i].active = active;
-    events[i].fds_id = -1;
+
+    if (event_register(fd, first ? first : e, first) < 0) {
+	//epoll refused the fd: forget this event again
+	if (first) {
+	    first->next = e->next;
+	    event_register(fd, first, first);
+	} else {
+	    events = e->next;
+	}
+	event_count--;
+	free(e);
+	return -1;
+    }
+
     return 0;
 }
 
 
 int event_process(const struct timespec *timeout)
 {
-    int i, j;
-    struct pollfd *fds = malloc(sizeof(struct pollfd) * event_count);
-    for (i = 0, j = 0; i < event_count; i++) {
-	events[i].fds_id = -1;
-	if (events[i].active) {
-	    events[i].fds_id = j;
-	    fds[j].events = 0;
-	    fds[j].fd = events[i].fd;
-	    if (events[i].read) {
-		fds[j].events |= POLLIN;
-	    }
-	    if (events[i].write) {
-		fds[j].events |= POLLOUT;
-	    }
-	    j++;
+    struct itimerspec when;
+    int wait = -1;
+
+    if (event_init() < 0)
+	return -1;
+
+    if (timeout->tv_sec == 0 && timeout->tv_nsec == 0) {
+	//next timer is due: just look for pending events
+	wait = 0;
+    } else {
+	//arm the timerfd with the absolute deadline, so there are no early wakeups
+	memset(&when, 0, sizeof(when));
+	clock_gettime(CLOCK_MONOTONIC, &when.it_value);
+	when.it_value.tv_sec += timeout->tv_sec;
+	when.it_value.tv_nsec += timeout->tv_nsec;
+	if (when.it_value.tv_nsec >= 1000000000L) {
+	    when.it_value.tv_sec++;
+	    when.it_value.tv_nsec -= 1000000000L;
+	}
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, NULL) < 0) {
+	    error("event: timerfd_settime() failed: %s", strerror(errno));
+	    wait = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
 	}
     }
-#if (__GLIBC__ >= 2 && __GLIBC_MINOR__ >= 4)
-    int ready = ppoll(fds, j, timeout, NULL);
-#else
-    int ready = poll(fds, j, timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000);
-#endif
 
-    if (ready > 0) {
-	//search the file descriptors, call all relavant callbacks
-	for (i = 0, j = 0; i < event_count; i++) {
-	    if (events[i].fds_id != j) {
-		continue;
-	    }
-	    if (fds[j].revents) {
-		int flags = 0;
-		if (fds[j].revents & POLLIN) {
+    ready_count = epoll_wait(epoll_fd, ready, EVENT_BATCH, wait);
+
+    //dispatch the ready file descriptors only
+    dispatching = 1;
+    for (ready_next = 0; ready_next < ready_count; ready_next++) {
+	event_t *e = ready[ready_next].data.ptr;
+	uint32_t revents = ready[ready_next].events;
+	int fd;
+
+	if (e == NULL)
+	    continue;
+
+	fd = e->fd;
+	while (e != NULL && e->fd == fd) {
+	    //a callback may remove this event, so fetch the next one first
+	    //(removed ones stay allocated until the end of the loop, with fd -1)
+	    event_t *next = e->next;
+	    int flags = 0;
+	    if (e->active) {
+		if ((revents & EPOLLIN) && e->read) {
 		    flags |= EVENT_READ;
 		}
-		if (fds[j].revents & POLLOUT) {
+		if ((revents & EPOLLOUT) && e->write) {
 		    flags |= EVENT_WRITE;
 		}
-		if (fds[j].revents & POLLHUP) {
+		if (revents & EPOLLHUP) {
 		    flags |= EVENT_HUP;
 		}
-		if (fds[j].revents & POLLERR) {
+		if (revents & EPOLLERR) {
 		    flags |= EVENT_ERR;
 		}
-		events[i].callback(flags, events[i].data);
-
 	    }
-	    j++;
+	    if (flags) {
+		e->callback(flags, e->data);
+	    }
+	    e = next;
 	}
     }
-    free(fds);
+
+    ready_next = ready_count = 0;
+
+    dispatching = 0;
+    while (deleted != NULL) {
+	event_t *e = deleted;
+	deleted = e->next;
+	free(e);
+    }
+
     return 0;
 
 }
 
 int event_del(const int fd)
 {
+    event_t **link, *e, *first;
     int i;
-    for (i = 0; i < event_count; i++) {
-	if (events[i].fd == fd) {
-	    events[i] = events[event_count - 1];
-	    break;
+
+    first = event_first(fd);
+    if (first == NULL)
+	return 0;
+
+    for (link = &events; *link != first; link = &(*link)->next);
+
+    //remove the first event of this fd, the others take over
+    e = first;
+    *link = e->next;
+    event_count--;
+
+    first = (e->next && e->next->fd == fd) ? e->next : NULL;
+    if (first) {
+	event_register(fd, first, e);
+    } else {
+	if (e->registered)
+	    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	for (i = ready_next; i < ready_count; i++) {
+	    if (ready[i].data.ptr == e)
+		ready[i].data.ptr = NULL;
 	}
     }
-    event_count--;
-    events = realloc(events, sizeof(event_t) * event_count);
+
+    e->fd = -1;
+    if (dispatching) {
+	e->next = deleted;
+	deleted = e;
+    } else {
+	free(e);
+    }
     return 0;
 }
 
 int event_modify(const int fd, const int read, const int write, const int active)
 {
-    int i;
-    for (i = 0; i < event_count; i++) {
-	if (events[i].fd == fd) {
-	    events[i].read = read;
-	    events[i].write = write;
-	    events[i].active = active;
-	    break;
-	}
-    }
-    event_count--;
-    events = realloc(events, sizeof(event_t) * event_count);
-    return 0;
+    event_t *first = event_first(fd);
+
+    if (first == NULL)
+	return 0;
+
+    first->read = read;
+    first->write = write;
+    first->active = active;
+
+    return event_register(fd, first, first);
 }
 
 static void free_events(void)
 {
-    if (events != NULL) {
-	free(events);
+    while (events != NULL) {
+	event_t *e = events;
+	events = e->next;
+	free(e);
     }
     event_count = 0;
-    events = NULL;
+    ready_next = ready_count = 0;
 
+    if (timer_fd >= 0) {
+	close(timer_fd);
+	timer_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+	close(epoll_fd);
+	epoll_fd = -1;
+    }
 }
 
 void event_exit(void)
@@ -292,6 +511,8 @@ int named_event_trigger(char *event)
     int i, j;
     for (i = 0; i < ev_count; i++) {
 	if (0 == strcmp(event, ev_names[i].name)) {
+	    //the event brings new values: cached function results are outdated
+	    EvalTick();
 	    for (j = 0; j < ev_names[i].callback_count; j++) {
 		ev_names[i].c[j].callback(ev_names[i].c[j].data);
 	    }
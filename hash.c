@@ -30,6 +30,9 @@
  * void hash_create (HASH *Hash);
  *   initializes hash
  *
+ * void hash_create_numeric (HASH *Hash);
+ *   initializes hash which keeps delta values as numbers
+ *
  * int hash_age (HASH *Hash, char *key, char **value);
  *   return time of last hash_put
  *
@@ -40,7 +43,8 @@
  *   set a delta entry in the hash
  *
  * char *hash_get (HASH *Hash, char *key);
- *   fetch an entry from the hash
+ *   fetch an entry from the hash, the result is valid
+ *   until the same key is put again
  *
  * double hash_get_delta (HASH *Hash, char *key, int delay);
  *   fetch a delta antry from the hash
@@ -59,6 +63,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include <regex.h>
 
 #include "debug.h"
@@ -74,11 +80,14 @@
 /* string buffer chunk size */
 #define CHUNK_SIZE 16
 
+/* initial size of the index */
+#define INDEX_SIZE 16
+
 
 /* initialize a new hash table */
 void hash_create(HASH * Hash)
 {
-    Hash->sorted = 0;
+    Hash->numeric = 0;
 
     Hash->timestamp.tv_sec = 0;
     Hash->timestamp.tv_usec = 0;
@@ -86,6 +95,9 @@ void hash_create(HASH * Hash)
     Hash->nItems = 0;
     Hash->Items = NULL;
 
+    Hash->nIndex = 0;
+    Hash->Index = NULL;
+
     Hash->nColumns = 0;
     Hash->Columns = NULL;
 
@@ -93,23 +105,13 @@ void hash_create(HASH * Hash)
 }
 
 
-/* bsearch compare function for hash items */
-static int hash_lookup_item(const void *a, const void *b)
-{
-    char *key = (char *) a;
-    HASH_ITEM *item = (HASH_ITEM *) b;
-
-    return strcasecmp(key, item->key);
-}
-
-
-/* qsort compare function for hash items */
-static int hash_sort_item(const void *a, const void *b)
+/* initialize a new hash table for numeric delta values: */
+/* instead of the last DELTA_SLOTS lines, a ring of numbers */
+/* per column is kept for every key */
+void hash_create_numeric(HASH * Hash)
 {
-    HASH_ITEM *ha = (HASH_ITEM *) a;
-    HASH_ITEM *hb = (HASH_ITEM *) b;
-
-    return strcasecmp(ha->key, hb->key);
+    hash_create(Hash);
+    Hash->numeric = 1;
 }
 
 
@@ -133,81 +135,229 @@ static int hash_sort_column(const void *a, const void *b)
 }
 
 
-/* split a value into columns and  */
-/* return the nth column in a string */
-/* WARNING: does return a pointer to a static string!! */
-static char *split(const char *val, const int column, const char *delimiter)
+/* split a value into columns once: columns are */
+/* runs of characters which are no delimiters */
+static void hash_split(HASH_SLOT * Slot, const char *delimiter)
 {
-    static char buffer[256];
-    int num;
-    size_t len;
-    const char *beg, *end;
+    char *p;
+    int n = 0;
 
+    strcpy(Slot->split, Slot->value);
+
+    p = Slot->split;
+    while (*p) {
+	/* terminate the previous column, skip delimiters */
+	while (*p && strchr(delimiter, *p))
+	    *p++ = '\0';
+	if (*p == '\0')
+	    break;
+	if (n >= Slot->nOffset) {
+	    Slot->nOffset += CHUNK_SIZE;
+	    Slot->offset = realloc(Slot->offset, Slot->nOffset * sizeof(int));
+	    Slot->number = realloc(Slot->number, Slot->nOffset * sizeof(double));
+	}
+	Slot->offset[n] = p - Slot->split;
+	Slot->number[n] = NAN;
+	n++;
+	while (*p && !strchr(delimiter, *p))
+	    p++;
+    }
+
+    Slot->nColumn = n;
+}
+
+
+/* return the nth column of a slot as a string */
+/* the pointer is valid until the slot is overwritten */
+static char *hash_column(HASH * Hash, HASH_SLOT * Slot, const int column)
+{
     if (column < 0)
-	return (char *) val;
-    if (val == NULL)
+	return Slot->value;
+    if (Slot->value == NULL)
 	return NULL;
 
-    num = 0;
-    len = 0;
-    beg = val;
-    end = beg;
-    while (beg && *beg) {
-	while (strchr(delimiter, *beg))
-	    beg++;
-	end = strpbrk(beg, delimiter);
-	if (num++ == column)
-	    break;
-	beg = end ? end + 1 : NULL;
+    if (Slot->nColumn < 0)
+	hash_split(Slot, Hash->delimiter);
+
+    if (column >= Slot->nColumn)
+	return "";
+
+    return Slot->split + Slot->offset[column];
+}
+
+
+/* return the nth column of a slot as a number */
+static double hash_number(HASH * Hash, HASH_SLOT * Slot, const int column)
+{
+    if (column < 0 || Slot->value == NULL)
+	return Slot->value ? atof(Slot->value) : 0.0;
+
+    if (Slot->nColumn < 0)
+	hash_split(Slot, Hash->delimiter);
+
+    if (column >= Slot->nColumn)
+	return 0.0;
+
+    /* convert every column only once */
+    if (isnan(Slot->number[column]))
+	Slot->number[column] = atof(Slot->split + Slot->offset[column]);
+
+    return Slot->number[column];
+}
+
+
+/* k-th sample of an item, counting backwards from the newest one */
+#define SAMPLE(Item, k) ((Item)->Sample + (((Item)->head - (k) + DELTA_SLOTS) % DELTA_SLOTS) * (Item)->nColumn)
+#define TIME(Item, k) (&(Item)->Time[((Item)->head - (k) + DELTA_SLOTS) % DELTA_SLOTS])
+
+
+/* add the current value of an item to its sample ring */
+/* number 0 is the whole value, number c+1 is column c */
+static void hash_sample(HASH * Hash, HASH_ITEM * Item, HASH_SLOT * Slot)
+{
+    double *sample;
+    int n, c;
+
+    n = 1;
+    if (Hash->nColumns > 0) {
+	if (Slot->nColumn < 0)
+	    hash_split(Slot, Hash->delimiter);
+	n += Slot->nColumn;
     }
-    if (beg != NULL) {
-	len = end ? (size_t) (end - beg) : strlen(beg);
-	if (len >= sizeof(buffer))
-	    len = sizeof(buffer) - 1;
-	strncpy(buffer, beg, len);
+
+    /* number of columns has changed: start over */
+    if (n != Item->nColumn) {
+	free(Item->Sample);
+	free(Item->Time);
+	Item->Sample = malloc(DELTA_SLOTS * n * sizeof(double));
+	Item->Time = malloc(DELTA_SLOTS * sizeof(struct timespec));
+	Item->nColumn = n;
+	Item->nSample = 0;
+	Item->head = 0;
     }
 
-    buffer[len] = '\0';
-    return buffer;
+    Item->head = (Item->head + 1) % DELTA_SLOTS;
+    if (Item->nSample < DELTA_SLOTS)
+	Item->nSample++;
+
+    sample = SAMPLE(Item, 0);
+    sample[0] = atof(Slot->value);
+    for (c = 1; c < n; c++) {
+	sample[c] = atof(Slot->split + Slot->offset[c - 1]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, TIME(Item, 0));
 }
 
 
-/* search an entry in the hash table: */
-/* If the table is flagged "sorted", the entry is looked */
-/* up using the bsearch function. If the table is  */
-/* unsorted, it will be searched in a linear way */
-static HASH_ITEM *hash_lookup(HASH * Hash, const char *key, const int do_sort)
+/* get a delta value from the sample ring */
+static double hash_sample_delta(HASH_ITEM * Item, const int column, const int delay)
 {
-    HASH_ITEM *Item = NULL;
+    struct timespec end, *t1, *t2;
+    double *s1, *s2;
+    double dv, dt;
+    int n, k, lo, hi;
+
+    n = column + 1;
+    if (Item->nSample == 0 || n >= Item->nColumn)
+	return 0.0;
+
+    s1 = SAMPLE(Item, 0);
+    t1 = TIME(Item, 0);
+
+    /* if delay is zero, return absolute value */
+    if (delay == 0)
+	return s1[n];
 
-    /* maybe sort the array */
-    if (do_sort && !Hash->sorted) {
-	qsort(Hash->Items, Hash->nItems, sizeof(HASH_ITEM), hash_sort_item);
-	Hash->sorted = 1;
+    /* not enough samples available... */
+    if (Item->nSample < 2)
+	return 0.0;
+
+    end.tv_sec = t1->tv_sec - delay / 1000;
+    end.tv_nsec = t1->tv_nsec - (delay % 1000) * 1000000L;
+    if (end.tv_nsec < 0) {
+	end.tv_sec--;
+	end.tv_nsec += 1000000000L;
     }
 
-    /* no key was passed */
-    if (key == NULL)
-	return NULL;
+    /* samples get older with k: binary search for the */
+    /* newest one before end, or take the oldest one */
+    lo = 1;
+    hi = Item->nSample - 1;
+    while (lo < hi) {
+	k = (lo + hi) / 2;
+	t2 = TIME(Item, k);
+	if (t2->tv_sec < end.tv_sec || (t2->tv_sec == end.tv_sec && t2->tv_nsec < end.tv_nsec))
+	    hi = k;
+	else
+	    lo = k + 1;
+    }
 
-    /* lookup using bsearch */
-    if (Hash->sorted) {
-	Item = bsearch(key, Hash->Items, Hash->nItems, sizeof(HASH_ITEM), hash_lookup_item);
+    /* delta value, delta time */
+    s2 = SAMPLE(Item, lo);
+    t2 = TIME(Item, lo);
+    dv = s1[n] - s2[n];
+    dt = (t1->tv_sec - t2->tv_sec) + (t1->tv_nsec - t2->tv_nsec) / 1000000000.0;
+
+    if (dt > 0.0 && dv >= 0.0)
+	return dv / dt;
+    return 0.0;
+}
+
+
+/* case insensitive FNV-1a hash of a key */
+static unsigned int hash_key(const char *key)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*key) {
+	hash = (hash ^ (unsigned char) tolower((unsigned char) *key++)) * 16777619u;
     }
+    return hash;
+}
 
-    /* linear search */
-    if (Item == NULL) {
-	int i;
-	for (i = 0; i < Hash->nItems; i++) {
-	    if (strcmp(key, Hash->Items[i].key) == 0) {
-		Item = &(Hash->Items[i]);
-		break;
-	    }
-	}
+
+/* find the index position of a key, or the empty position for it */
+static int hash_probe(HASH * Hash, const char *key, const unsigned int hash)
+{
+    int i, n;
+
+    for (i = hash & (Hash->nIndex - 1); (n = Hash->Index[i]) != 0; i = (i + 1) & (Hash->nIndex - 1)) {
+	HASH_ITEM *Item = &(Hash->Items[n - 1]);
+	if (Item->hash == hash && strcasecmp(key, Item->key) == 0)
+	    break;
     }
 
-    return Item;
+    return i;
+}
+
+
+/* rebuild the index with twice the size */
+static void hash_grow(HASH * Hash)
+{
+    int i;
+
+    free(Hash->Index);
+    Hash->nIndex = Hash->nIndex ? 2 * Hash->nIndex : INDEX_SIZE;
+    Hash->Index = calloc(Hash->nIndex, sizeof(int));
+
+    for (i = 0; i < Hash->nItems; i++) {
+	Hash->Index[hash_probe(Hash, Hash->Items[i].key, Hash->Items[i].hash)] = i + 1;
+    }
+}
+
+
+/* search an entry in the hash table */
+static HASH_ITEM *hash_lookup(HASH * Hash, const char *key)
+{
+    int n;
+
+    /* no key was passed */
+    if (key == NULL || Hash->nItems == 0)
+	return NULL;
 
+    n = Hash->Index[hash_probe(Hash, key, hash_key(key))];
+
+    return n ? &(Hash->Items[n - 1]) : NULL;
 }
 
 
@@ -222,7 +372,7 @@ int hash_age(HASH * Hash, const char *key)
     if (key == NULL) {
 	timestamp = &(Hash->timestamp);
     } else {
-	Item = hash_lookup(Hash, key, 1);
+	Item = hash_lookup(Hash, key);
 	if (Item == NULL)
 	    return -1;
 	timestamp = &(Item->Slot[Item->index].timestamp);
@@ -276,17 +426,16 @@ void hash_set_delimiter(HASH * Hash, const char *delimiter)
 
 
 /* get a string from the hash table */
+/* the pointer stays valid until the key is put again */
 char *hash_get(HASH * Hash, const char *key, const char *column)
 {
     HASH_ITEM *Item;
-    int c;
 
-    Item = hash_lookup(Hash, key, 1);
+    Item = hash_lookup(Hash, key);
     if (Item == NULL)
 	return NULL;
 
-    c = hash_get_column(Hash, column);
-    return split(Item->Slot[Item->index].value, c, Hash->delimiter);
+    return hash_column(Hash, &(Item->Slot[Item->index]), hash_get_column(Hash, column));
 }
 
 
@@ -301,7 +450,7 @@ double hash_get_delta(HASH * Hash, const char *key, const char *column, const in
     struct timeval now, end;
 
     /* lookup item */
-    Item = hash_lookup(Hash, key, 1);
+    Item = hash_lookup(Hash, key);
     if (Item == NULL)
 	return 0.0;
 
@@ -311,9 +460,12 @@ double hash_get_delta(HASH * Hash, const char *key, const char *column, const in
     /* fetch column number */
     c = hash_get_column(Hash, column);
 
+    if (Hash->numeric)
+	return hash_sample_delta(Item, c, delay);
+
     /* if delay is zero, return absolute value */
     if (delay == 0)
-	return atof(split(Slot1->value, c, Hash->delimiter));
+	return hash_number(Hash, Slot1, c);
 
     /* prepare timing values */
     now = Slot1->timestamp;
@@ -345,8 +497,8 @@ double hash_get_delta(HASH * Hash, const char *key, const char *column, const in
 	return 0.0;
 
     /* delta value, delta time */
-    v1 = atof(split(Slot1->value, c, Hash->delimiter));
-    v2 = atof(split(Slot2->value, c, Hash->delimiter));
+    v1 = hash_number(Hash, Slot1, c);
+    v2 = hash_number(Hash, Slot2, c);
     dv = v1 - v2;
     dt = (Slot1->timestamp.tv_sec - Slot2->timestamp.tv_sec)
 	+ (Slot1->timestamp.tv_usec - Slot2->timestamp.tv_usec) / 1000000.0;
@@ -375,9 +527,6 @@ double hash_get_regex(HASH * Hash, const char *key, const char *column, const in
 	return 0.0;
     }
 
-    /* force the table to be sorted by requesting anything */
-    hash_lookup(Hash, NULL, 1);
-
     sum = 0.0;
     for (i = 0; i < Hash->nItems; i++) {
 	if (regexec(&preg, Hash->Items[i].key, 0, NULL, 0) == 0) {
@@ -390,10 +539,8 @@ double hash_get_regex(HASH * Hash, const char *key, const char *column, const in
 
 
 /* insert a key/val pair into the hash table */
-/* If the entry does already exist, it will be overwritten, */
-/* and the table stays sorted (if it has been before). */
-/* Otherwise, the entry is appended at the end, and  */
-/* the table will be flagged 'unsorted' afterwards */
+/* If the entry does already exist, it will be overwritten. */
+/* Otherwise, the entry is appended at the end and indexed. */
 
 static HASH_ITEM *hash_set(HASH * Hash, const char *key, const char *value, const int delta)
 {
@@ -401,28 +548,40 @@ static HASH_ITEM *hash_set(HASH * Hash, const char *key, const char *value, cons
     HASH_SLOT *Slot;
     int size;
 
-    Item = hash_lookup(Hash, key, 0);
+    Item = hash_lookup(Hash, key);
 
     if (Item == NULL) {
 
+	/* keep the index at most half full */
+	if (2 * (Hash->nItems + 1) > Hash->nIndex)
+	    hash_grow(Hash);
+
 	/* add entry */
-	Hash->sorted = 0;
 	Hash->nItems++;
 	Hash->Items = realloc(Hash->Items, Hash->nItems * sizeof(HASH_ITEM));
 
 	Item = &(Hash->Items[Hash->nItems - 1]);
 	Item->key = strdup(key);
+	Item->hash = hash_key(key);
 	Item->index = 0;
 	Item->nSlot = delta;
 	Item->Slot = malloc(Item->nSlot * sizeof(HASH_SLOT));
 	memset(Item->Slot, 0, Item->nSlot * sizeof(HASH_SLOT));
+	Item->nColumn = 0;
+	Item->nSample = 0;
+	Item->head = 0;
+	Item->Sample = NULL;
+	Item->Time = NULL;
+
+	Hash->Index[hash_probe(Hash, key, Item->hash)] = Hash->nItems;
 
     } else {
 
 	/* maybe enlarge delta table */
 	if (Item->nSlot < delta) {
+	    Item->Slot = realloc(Item->Slot, delta * sizeof(HASH_SLOT));
+	    memset(Item->Slot + Item->nSlot, 0, (delta - Item->nSlot) * sizeof(HASH_SLOT));
 	    Item->nSlot = delta;
-	    Item->Slot = realloc(Item->Slot, Item->nSlot * sizeof(HASH_SLOT));
 	}
 
     }
@@ -441,13 +600,20 @@ static HASH_ITEM *hash_set(HASH * Hash, const char *key, const char *value, cons
     if (size > Slot->size) {
 	/* buffer is either empty or too small */
 	/* allocate memory in multiples of CHUNK_SIZE */
+	/* the second half holds the split columns */
 	Slot->size = CHUNK_SIZE * (size / CHUNK_SIZE + 1);
-	Slot->value = realloc(Slot->value, Slot->size);
+	Slot->value = realloc(Slot->value, 2 * Slot->size);
+	Slot->split = Slot->value + Slot->size;
     }
 
     /* set value */
     strcpy(Slot->value, value);
 
+    /* split it into columns right now if there are any */
+    Slot->nColumn = -1;
+    if (Hash->nColumns > 0)
+	hash_split(Slot, Hash->delimiter);
+
     /* set timestamps */
     gettimeofday(&(Hash->timestamp), NULL);
     Slot->timestamp = Hash->timestamp;
@@ -468,38 +634,57 @@ void hash_put(HASH * Hash, const char *key, const char *value)
 /* with delta processing */
 void hash_put_delta(HASH * Hash, const char *key, const char *value)
 {
-    hash_set(Hash, key, value, DELTA_SLOTS);
+    HASH_ITEM *Item;
+
+    if (Hash->numeric) {
+	/* only the last line is kept, older values live in the sample ring */
+	Item = hash_set(Hash, key, value, 1);
+	hash_sample(Hash, Item, &(Item->Slot[Item->index]));
+    } else {
+	hash_set(Hash, key, value, DELTA_SLOTS);
+    }
 }
 
 
 void hash_destroy(HASH * Hash)
 {
-    int i;
-
-    if (Hash->Items) {
+    int i, s;
 
-	/* free all headers */
-	for (i = 0; i < Hash->nColumns; i++) {
-	    if (Hash->Columns[i].key)
-		free(Hash->Columns[i].key);
-	}
+    /* free all headers */
+    for (i = 0; i < Hash->nColumns; i++) {
+	if (Hash->Columns[i].key)
+	    free(Hash->Columns[i].key);
+    }
 
-	/* free header table */
-	free(Hash->Columns);
+    /* free header table */
+    free(Hash->Columns);
 
-	/* free all items */
-	for (i = 0; i < Hash->nItems; i++) {
-	    if (Hash->Items[i].key)
-		free(Hash->Items[i].key);
-	    if (Hash->Items[i].Slot)
-		free(Hash->Items[i].Slot);
+    /* free all items */
+    for (i = 0; i < Hash->nItems; i++) {
+	HASH_ITEM *Item = &(Hash->Items[i]);
+	if (Item->key)
+	    free(Item->key);
+	for (s = 0; s < Item->nSlot; s++) {
+	    free(Item->Slot[s].value);
+	    free(Item->Slot[s].offset);
+	    free(Item->Slot[s].number);
 	}
-
-	/* free items table */
-	free(Hash->Items);
+	if (Item->Slot)
+	    free(Item->Slot);
+	free(Item->Sample);
+	free(Item->Time);
     }
 
-    Hash->sorted = 0;
+    /* free items table and index */
+    free(Hash->Items);
+    free(Hash->Index);
+    free(Hash->delimiter);
+
     Hash->nItems = 0;
     Hash->Items = NULL;
+    Hash->nIndex = 0;
+    Hash->Index = NULL;
+    Hash->nColumns = 0;
+    Hash->Columns = NULL;
+    Hash->delimiter = NULL;
 }
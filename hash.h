@@ -29,11 +29,18 @@
 
 /* struct timeval */
 #include <sys/time.h>
+/* struct timespec */
+#include <time.h>
 
 
 typedef struct {
     int size;
-    char *value;
+    char *value;		/* the value as it has been put */
+    char *split;		/* copy of value, delimiters replaced by '\0' */
+    int nColumn;		/* columns found in split, -1 if not split yet */
+    int nOffset;		/* allocated offsets and numbers */
+    int *offset;		/* start of each column in split */
+    double *number;		/* numeric value of each column, NAN if not converted yet */
     struct timeval timestamp;
 } HASH_SLOT;
 
@@ -45,17 +52,25 @@ typedef struct {
 
 typedef struct {
     char *key;
+    unsigned int hash;
     int index;
     int nSlot;
     HASH_SLOT *Slot;
+    int nColumn;		/* numbers per sample: whole value and columns */
+    int nSample;		/* samples in the ring */
+    int head;			/* newest sample */
+    double *Sample;		/* ring of DELTA_SLOTS samples (numeric hashes) */
+    struct timespec *Time;	/* monotonic time of each sample */
 } HASH_ITEM;
 
 
 typedef struct {
-    int sorted;
+    int numeric;		/* delta values are stored as numbers */
     struct timeval timestamp;
     int nItems;
     HASH_ITEM *Items;
+    int nIndex;			/* size of the index, a power of 2 */
+    int *Index;			/* open addressing, item number + 1 or 0 */
     int nColumns;
     HASH_COLUMN *Columns;
     char *delimiter;
@@ -64,6 +79,7 @@ typedef struct {
 
 
 void hash_create(HASH * Hash);
+void hash_create_numeric(HASH * Hash);
 
 int hash_age(HASH * Hash, const char *key);
 
@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/time.h>		/* gettimeofday() */
 #include <sys/types.h>		/* umask() */
 #include <sys/stat.h>		/* umask() */
 
@@ -59,6 +60,9 @@
 
 #define PIDFILE "/var/run/lcd4linux.pid"
 
+/* evaluations per expression in bench mode */
+#define BENCH_LOOPS 10000
+
 static char *release = "LCD4Linux " VERSION "-" VCS_VERSION;
 static char *copyright =
     "Copyright (C) 2005, 2006, 2007, 2008, 2009 The LCD4Linux Team <lcd4linux-devel@users.sourceforge.net>";
@@ -77,11 +81,13 @@ static void usage(void)
     printf(" lcd4linux [-h]\n");
     printf(" lcd4linux [-l]\n");
     printf(" lcd4linux [-c key=value] [-i] [-f config-file] [-v] [-p pid-file]\n");
+    printf(" lcd4linux [-c key=value] [-b] [-f config-file] [-v]\n");
     printf(" lcd4linux [-c key=value] [-F] [-f config-file] [-o output-file] [-s] [-v]\n");
     printf("\n");
     printf("options:\n");
     printf("  -h               help\n");
     printf("  -l               list available display drivers and plugins\n");
+    printf("  -b               benchmark evaluator backends with expressions read from stdin\n");
     printf("  -c <key>=<value> overwrite entries from the config-file\n");
     printf("  -i               enter interactive mode (after display initialisation)\n");
     printf("  -ii              enter interactive mode (before display initialisation)\n");
@@ -106,13 +112,15 @@ static void interactive_mode(void)
 {
     char line[1024];
     void *tree;
-    RESULT result = { 0, 0, 0, NULL };
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
 
     printf("\neval> ");
     for (fgets(line, sizeof(line), stdin); !feof(stdin); fgets(line, sizeof(line), stdin)) {
 	if (line[strlen(line) - 1] == '\n')
 	    line[strlen(line) - 1] = '\0';
 	if (strlen(line) > 0) {
+	    /* every line is a tick of its own */
+	    EvalTick();
 	    if (Compile(line, &tree) != -1) {
 		Eval(tree, &result);
 		if (result.type == R_NUMBER) {
@@ -134,6 +142,56 @@ static void interactive_mode(void)
 }
 
 
+static double bench_loop(void *tree, RESULT * result)
+{
+    struct timeval start, end;
+    int i;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_LOOPS; i++) {
+	/* do not measure the function cache */
+	EvalTick();
+	Eval(tree, result);
+    }
+    gettimeofday(&end, NULL);
+    DelResult(result);
+
+    /* microseconds per evaluation */
+    return ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / BENCH_LOOPS;
+}
+
+
+static void bench_mode(void)
+{
+    char line[1024];
+    void *tree;
+    RESULT result = { 0, 0, 0, NULL, 0, "" };
+    double t_tree, t_code;
+    double sum_tree = 0.0, sum_code = 0.0;
+    int backend;
+
+    printf("%10s %10s %8s  %s\n", "tree/us", "code/us", "speedup", "expression");
+    for (fgets(line, sizeof(line), stdin); !feof(stdin); fgets(line, sizeof(line), stdin)) {
+	if (line[strlen(line) - 1] == '\n')
+	    line[strlen(line) - 1] = '\0';
+	if (strlen(line) > 0) {
+	    if (Compile(line, &tree) != -1) {
+		backend = EvalBackend(EVAL_TREE);
+		t_tree = bench_loop(tree, &result);
+		EvalBackend(EVAL_BYTECODE);
+		t_code = bench_loop(tree, &result);
+		EvalBackend(backend);
+		printf("%10.3f %10.3f %7.2fx  %s\n", t_tree, t_code, t_code > 0 ? t_tree / t_code : 0.0, line);
+		sum_tree += t_tree;
+		sum_code += t_code;
+	    }
+	    DelTree(tree);
+	}
+    }
+    printf("%10.3f %10.3f %7.2fx  total\n", sum_tree, sum_code, sum_code > 0 ? sum_tree / sum_code : 0.0);
+}
+
+
 void handler(int signal)
 {
     debug("got signal %d", signal);
@@ -214,6 +272,7 @@ int main(int argc, char *argv[])
     int c;
     int quiet = 1;
     int interactive = 0;
+    int bench = 0;
     int list_mode = 0;
     int pid;
 
@@ -238,9 +297,12 @@ int main(int argc, char *argv[])
 	printf("recognized special X11 parameters\n");
     }
 #endif
-    while ((c = getopt(argc, argv, "c:Ff:hilo:sqvp:")) != EOF) {
+    while ((c = getopt(argc, argv, "bc:Ff:hilo:sqvp:")) != EOF) {
 
 	switch (c) {
+	case 'b':
+	    bench++;
+	    break;
 	case 'c':
 	    if (cfg_cmd(optarg) < 0) {
 		fprintf(stderr, "%s: illegal argument -c '%s'\n", argv[0], optarg);
@@ -287,8 +349,8 @@ int main(int argc, char *argv[])
 	exit(2);
     }
 
-    /* do not fork in interactive mode */
-    if (interactive) {
+    /* do not fork in interactive or bench mode */
+    if (interactive || bench) {
 	running_foreground = 1;
     }
 
@@ -318,6 +380,14 @@ int main(int argc, char *argv[])
 	exit(1);
     }
 
+    /* bench mode does not need a display */
+    if (bench) {
+	bench_mode();
+	plugin_exit();
+	cfg_exit();
+	exit(0);
+    }
+
     display = cfg_get(NULL, "Display", NULL);
     if (display == NULL || *display == '\0') {
 	error("missing 'Display' entry in %s!", cfg_source());
@@ -406,6 +476,8 @@ int main(int argc, char *argv[])
 
     while (got_signal == 0) {
 	struct timespec delay;
+	/* function results cached during the last pass are outdated */
+	EvalTick();
 	if (timer_process(&delay) < 0)
 	    break;
 	event_process(&delay);
@@ -419,6 +491,7 @@ int main(int argc, char *argv[])
     plugin_exit();
     timer_exit_group();
     timer_exit();
+    event_exit();
 
     if (got_signal == SIGHUP) {
 	long fd;
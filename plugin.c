@@ -31,6 +31,25 @@
  *  initializes the expression evaluator
  *  adds some handy constants and functions
  *
+ * int plugin_fetch_register (const char *plugin, void *(*fetch) (const char *key, int *size), const int interval)
+ *  registers the fetch routine of a plugin, which runs on a pool worker
+ *  and refreshes every requested key every 'interval' msec; it returns
+ *  a malloc'ed string (or *size bytes), NULL keeps the previous value
+ *
+ * void *plugin_fetch (const char *plugin, const char *key)
+ *  requests a key and returns its latest value immediately (NULL if
+ *  there is none yet), a changed value triggers the named event 'plugin'
+ *
+ * int plugin_fetch_request (const char *plugin, const char *key)
+ *  fetches a key once (e.g. a command sent to a server)
+ *
+ * int plugin_fetch_age (const char *plugin, const char *key)
+ *  msec since the value of a key (or the oldest value of a plugin if
+ *  key is NULL) has been fetched, -1 if there is none
+ *
+ * int plugin_fetch_connect (const char *host, const int port)
+ *  opens a TCP connection with timeouts, for fetch routines
+ *
  */
 
 
@@ -41,12 +60,30 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
 
 #include "debug.h"
+#include "thread.h"
+#include "timer.h"
+#include "event.h"
+
+/* workers of the pool running plugin fetches */
+#define FETCH_WORKERS 4
+
+/* msec to wait for running fetches on exit (a network fetch gives up after PLUGIN_FETCH_TIMEOUT) */
+#define FETCH_TIMEOUT ((PLUGIN_FETCH_TIMEOUT + 1) * 1000)
 
 
 char *Plugins[] = {
     "cfg",
+    "evaluator",
     "math",
     "string",
     "test",
@@ -175,6 +212,8 @@ char *Plugins[] = {
 /* Prototypes */
 int plugin_init_cfg(void);
 void plugin_exit_cfg(void);
+int plugin_init_evaluator(void);
+void plugin_exit_evaluator(void);
 int plugin_init_math(void);
 void plugin_exit_math(void);
 int plugin_init_string(void);
@@ -280,14 +319,478 @@ int plugin_list(void)
 }
 
 
+/* asynchronous data fetch */
+
+/* a finished fetch, handed over from a worker to the main loop */
+typedef struct {
+    void *value;		/* NULL if the fetch failed */
+    int size;
+    struct timespec time;
+} FETCH_RESULT;
+
+typedef struct FETCH_ITEM {
+    char *key;
+    void *value;		/* latest value, NULL if none yet */
+    int size;
+    struct timespec time;	/* when the value has been fetched */
+    unsigned int due;		/* request sequence number, 0 if not requested */
+    int polled;			/* refreshed by the timer */
+    FETCH_RESULT *fresh;	/* result not yet picked up (atomic pointer swap) */
+    struct FETCH_ITEM *next;
+} FETCH_ITEM;
+
+typedef struct PLUGIN_FETCH {
+    char *plugin;
+    void *(*fetch) (const char *key, int *size);
+    int interval;		/* refresh interval (msec) */
+    int busy;			/* queued or running (atomic) */
+    int started;		/* refresh timer is running */
+    FETCH_ITEM **batch;		/* items of the running job, owned by the worker */
+    int nBatch;
+    int sBatch;
+    FETCH_ITEM *items;
+    struct PLUGIN_FETCH *next;
+} PLUGIN_FETCH;
+
+static PLUGIN_FETCH *Fetches = NULL;
+static unsigned int FetchSequence = 0;
+static int FetchQuit = 0;
+
+/* workers signal new results through an eventfd */
+static int FetchFd = -1;
+
+
+static PLUGIN_FETCH *fetch_lookup(const char *plugin)
+{
+    PLUGIN_FETCH *Fetch;
+
+    for (Fetch = Fetches; Fetch != NULL; Fetch = Fetch->next) {
+	if (strcmp(plugin, Fetch->plugin) == 0)
+	    return Fetch;
+    }
+
+    error("internal error: plugin '%s' has no fetch routine", plugin);
+    return NULL;
+}
+
+
+static FETCH_ITEM *fetch_item(PLUGIN_FETCH * Fetch, const char *key)
+{
+    FETCH_ITEM *Item, **Tail;
+
+    for (Tail = &Fetch->items; (Item = *Tail) != NULL; Tail = &Item->next) {
+	if (strcmp(key, Item->key) == 0)
+	    return Item;
+    }
+
+    /* first request: fetch it right away */
+    Item = calloc(1, sizeof(FETCH_ITEM));
+    Item->key = strdup(key);
+    Item->due = ++FetchSequence;
+    *Tail = Item;
+
+    return Item;
+}
+
+
+static long fetch_msec(const struct timespec *then)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) * 1000L + (now.tv_nsec - then->tv_nsec) / 1000000L;
+}
+
+
+/* runs on a pool worker, fetches one item after the other */
+static void fetch_run(void *data)
+{
+    PLUGIN_FETCH *Fetch = (PLUGIN_FETCH *) data;
+    FETCH_RESULT *Result;
+    uint64_t one = 1;
+    int i;
+
+    for (i = 0; i < Fetch->nBatch; i++) {
+	if (__atomic_load_n(&FetchQuit, __ATOMIC_ACQUIRE))
+	    break;
+	Result = malloc(sizeof(FETCH_RESULT));
+	Result->size = 0;
+	Result->value = Fetch->fetch(Fetch->batch[i]->key, &Result->size);
+	if (Result->value != NULL && Result->size == 0)
+	    Result->size = strlen(Result->value) + 1;
+	clock_gettime(CLOCK_MONOTONIC, &Result->time);
+
+	/* drop an older result which has not been picked up */
+	Result = __atomic_exchange_n(&Fetch->batch[i]->fresh, Result, __ATOMIC_ACQ_REL);
+	if (Result != NULL) {
+	    free(Result->value);
+	    free(Result);
+	}
+    }
+
+    /* the batch may be reused from now on */
+    __atomic_store_n(&Fetch->busy, 0, __ATOMIC_RELEASE);
+
+    /* wake up the main loop */
+    if (write(FetchFd, &one, sizeof(one)) < 0)
+	error("fetch error: could not signal result: %s", strerror(errno));
+}
+
+
+/* a queued fetch has been dropped */
+static void fetch_cancel(void *data)
+{
+    PLUGIN_FETCH *Fetch = (PLUGIN_FETCH *) data;
+
+    __atomic_store_n(&Fetch->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+/* pick up a finished fetch, returns 1 if the value has changed */
+static int fetch_pickup(FETCH_ITEM * Item)
+{
+    FETCH_RESULT *Result = __atomic_exchange_n(&Item->fresh, NULL, __ATOMIC_ACQ_REL);
+    int changed = 0;
+
+    if (Result == NULL)
+	return 0;
+
+    /* a failed fetch keeps the old value, which gets older */
+    if (Result->value != NULL) {
+	if (Item->value == NULL || Item->size != Result->size || memcmp(Item->value, Result->value, Item->size) != 0) {
+	    free(Item->value);
+	    Item->value = Result->value;
+	    Item->size = Result->size;
+	    changed = 1;
+	} else {
+	    free(Result->value);
+	}
+	Item->time = Result->time;
+    }
+
+    free(Result);
+    return changed;
+}
+
+
+/* hand all requested items of a plugin to a worker */
+static void fetch_submit(PLUGIN_FETCH * Fetch)
+{
+    FETCH_ITEM *Item;
+    int i, n;
+
+    if (__atomic_load_n(&Fetch->busy, __ATOMIC_ACQUIRE))
+	return;
+
+    /* the batch is sorted by request, so commands keep their order */
+    n = 0;
+    for (Item = Fetch->items; Item != NULL; Item = Item->next) {
+	if (Item->due == 0)
+	    continue;
+	if (n == Fetch->sBatch) {
+	    Fetch->sBatch = n ? 2 * n : 4;
+	    Fetch->batch = realloc(Fetch->batch, Fetch->sBatch * sizeof(FETCH_ITEM *));
+	}
+	for (i = n++; i > 0 && Fetch->batch[i - 1]->due > Item->due; i--)
+	    Fetch->batch[i] = Fetch->batch[i - 1];
+	Fetch->batch[i] = Item;
+    }
+
+    if (n == 0)
+	return;
+
+    for (i = 0; i < n; i++)
+	Fetch->batch[i]->due = 0;
+    Fetch->nBatch = n;
+
+    Fetch->busy = 1;
+    if (pool_submit(fetch_run, fetch_cancel, Fetch) < 0)
+	Fetch->busy = 0;
+}
+
+
+/* pick up all results of a plugin, tell widgets waiting for them */
+static void fetch_update(PLUGIN_FETCH * Fetch)
+{
+    FETCH_ITEM *Item;
+    int changed = 0;
+
+    for (Item = Fetch->items; Item != NULL; Item = Item->next) {
+	changed |= fetch_pickup(Item);
+    }
+
+    if (changed)
+	named_event_trigger(Fetch->plugin);
+}
+
+
+/* a worker has published results */
+static void fetch_event(event_flags_t flags, void *data)
+{
+    PLUGIN_FETCH *Fetch;
+    uint64_t count;
+
+    (void) flags;
+    (void) data;
+
+    if (read(FetchFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	error("fetch error: read(eventfd) failed: %s", strerror(errno));
+
+    for (Fetch = Fetches; Fetch != NULL; Fetch = Fetch->next) {
+	fetch_update(Fetch);
+	fetch_submit(Fetch);
+    }
+}
+
+
+/* refresh all values of a plugin */
+static void fetch_timer(void *data)
+{
+    PLUGIN_FETCH *Fetch = (PLUGIN_FETCH *) data;
+    FETCH_ITEM *Item;
+
+    for (Item = Fetch->items; Item != NULL; Item = Item->next) {
+	if (Item->polled && Item->due == 0)
+	    Item->due = ++FetchSequence;
+    }
+    fetch_submit(Fetch);
+}
+
+
+/* first-time request: start the pool */
+static int fetch_init(void)
+{
+    if (FetchFd >= 0)
+	return 0;
+
+    if (pool_create(FETCH_WORKERS) < 0)
+	return -1;
+
+    FetchFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (FetchFd < 0) {
+	error("fetch error: eventfd() failed: %s", strerror(errno));
+	pool_destroy();
+	return -1;
+    }
+    event_add(fetch_event, NULL, FetchFd, 1, 0, 1);
+
+    return 0;
+}
+
+
+static void fetch_exit(void)
+{
+    PLUGIN_FETCH *Fetch;
+    FETCH_ITEM *Item;
+
+    for (Fetch = Fetches; Fetch != NULL; Fetch = Fetch->next) {
+	if (Fetch->started)
+	    timer_remove(fetch_timer, Fetch);
+    }
+
+    if (FetchFd >= 0) {
+	/* drop queued fetches, let the workers finish their current one */
+	/* (the pool may be shared, so it cannot be joined here) */
+	__atomic_store_n(&FetchQuit, 1, __ATOMIC_RELEASE);
+	pool_cancel(fetch_run);
+	if (pool_wait(fetch_run, FETCH_TIMEOUT) < 0) {
+	    /* a hung fetch still uses the items: leave them alone */
+	    error("fetch error: fetches did not finish within %d msec", FETCH_TIMEOUT);
+	    return;
+	}
+	pool_destroy();
+	event_del(FetchFd);
+	close(FetchFd);
+	FetchFd = -1;
+    }
+
+    while ((Fetch = Fetches) != NULL) {
+	Fetches = Fetch->next;
+	while ((Item = Fetch->items) != NULL) {
+	    Fetch->items = Item->next;
+	    if (Item->fresh != NULL) {
+		free(Item->fresh->value);
+		free(Item->fresh);
+	    }
+	    free(Item->key);
+	    free(Item->value);
+	    free(Item);
+	}
+	free(Fetch->plugin);
+	free(Fetch->batch);
+	free(Fetch);
+    }
+    FetchQuit = 0;
+}
+
+
+int plugin_fetch_register(const char *plugin, void *(*fetch) (const char *key, int *size), const int interval)
+{
+    PLUGIN_FETCH *Fetch;
+
+    Fetch = calloc(1, sizeof(PLUGIN_FETCH));
+    if (Fetch == NULL)
+	return -1;
+
+    Fetch->plugin = strdup(plugin);
+    Fetch->fetch = fetch;
+    Fetch->interval = interval;
+    Fetch->next = Fetches;
+    Fetches = Fetch;
+
+    return 0;
+}
+
+
+void *plugin_fetch(const char *plugin, const char *key)
+{
+    PLUGIN_FETCH *Fetch;
+    FETCH_ITEM *Item;
+
+    if ((Fetch = fetch_lookup(plugin)) == NULL)
+	return NULL;
+
+    if (fetch_init() < 0)
+	return NULL;
+
+    Item = fetch_item(Fetch, key);
+    Item->polled = 1;
+
+    /* usually picked up by fetch_event() already */
+    if (fetch_pickup(Item))
+	named_event_trigger(Fetch->plugin);
+
+    if (Item->due)
+	fetch_submit(Fetch);
+
+    /* refresh all values of this plugin from now on */
+    if (!Fetch->started && Fetch->interval > 0) {
+	Fetch->started = 1;
+	timer_add(fetch_timer, Fetch, Fetch->interval, 0);
+    }
+
+    return Item->value;
+}
+
+
+int plugin_fetch_request(const char *plugin, const char *key)
+{
+    PLUGIN_FETCH *Fetch;
+    FETCH_ITEM *Item;
+
+    if ((Fetch = fetch_lookup(plugin)) == NULL)
+	return -1;
+
+    if (fetch_init() < 0)
+	return -1;
+
+    /* queued behind all earlier requests */
+    Item = fetch_item(Fetch, key);
+    Item->due = ++FetchSequence;
+    fetch_submit(Fetch);
+
+    return 0;
+}
+
+
+int plugin_fetch_age(const char *plugin, const char *key)
+{
+    PLUGIN_FETCH *Fetch;
+    FETCH_ITEM *Item;
+    long age, max = -1;
+
+    if ((Fetch = fetch_lookup(plugin)) == NULL)
+	return -1;
+
+    for (Item = Fetch->items; Item != NULL; Item = Item->next) {
+	if (key != NULL && strcmp(key, Item->key) != 0)
+	    continue;
+	/* an item without a value is infinitely old */
+	if (Item->value == NULL)
+	    return -1;
+	age = fetch_msec(&Item->time);
+	if (age > max)
+	    max = age;
+    }
+
+    return max;
+}
+
+
+/* blocking connect with timeouts, safe to use on pool workers (unlike gethostbyname) */
+int plugin_fetch_connect(const char *host, const int port)
+{
+    struct addrinfo hints, *info, *ai;
+    struct timeval tv = { PLUGIN_FETCH_TIMEOUT, 0 };
+    char service[8];
+    int sock, err;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+
+    err = getaddrinfo(host, service, &hints, &info);
+    if (err != 0) {
+	error("fetch error: unknown server %s: %s", host, gai_strerror(err));
+	return -1;
+    }
+
+    sock = -1;
+    err = 0;
+    for (ai = info; ai != NULL; ai = ai->ai_next) {
+	sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+	if (sock < 0) {
+	    err = errno;
+	    continue;
+	}
+	/* on Linux, SO_SNDTIMEO applies to connect() as well */
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+	    break;
+	err = errno;
+	close(sock);
+	sock = -1;
+    }
+
+    if (sock < 0)
+	error("fetch error: can't connect to server %s:%d: %s", host, port, strerror(err));
+
+    freeaddrinfo(info);
+    return sock;
+}
+
+
+/* fetch::age('plugin')  msec since the oldest value of a plugin has been fetched, -1 if a value is missing */
+static void my_fetch_age(RESULT * result, RESULT * arg1)
+{
+    double value = -1.0;
+    char *plugin = R2S(arg1);
+    PLUGIN_FETCH *Fetch;
+
+    for (Fetch = Fetches; Fetch != NULL; Fetch = Fetch->next) {
+	if (strcmp(plugin, Fetch->plugin) == 0) {
+	    value = plugin_fetch_age(plugin, NULL);
+	    break;
+	}
+    }
+
+    SetResult(&result, R_NUMBER, &value);
+}
+
+
 int plugin_init(void)
 {
     plugin_init_cfg();
+    plugin_init_evaluator();
     plugin_init_math();
     plugin_init_string();
     plugin_init_test();
     plugin_init_time();
 
+    AddFunction("fetch::age", 1, my_fetch_age);
+
 #ifdef PLUGIN_APM
     plugin_init_apm();
 #endif
@@ -412,6 +915,14 @@ int plugin_init(void)
 
 void plugin_exit(void)
 {
+#ifdef PLUGIN_EXEC
+    /* running commands block pool workers: kill them first */
+    plugin_exit_exec();
+#endif
+
+    /* stop the fetches before the plugins release their resources */
+    fetch_exit();
+
 #ifdef PLUGIN_APM
     plugin_exit_apm();
 #endif
@@ -433,9 +944,6 @@ void plugin_exit(void)
 #ifdef PLUGIN_DVB
     plugin_exit_dvb();
 #endif
-#ifdef PLUGIN_EXEC
-    plugin_exit_exec();
-#endif
 #ifdef PLUGIN_EVENT
     plugin_exit_event();
 #endif
@@ -528,6 +1036,7 @@ void plugin_exit(void)
 #endif
 
     plugin_exit_cfg();
+    plugin_exit_evaluator();
     plugin_exit_math();
     plugin_exit_string();
     plugin_exit_test();
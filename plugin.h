@@ -30,7 +30,17 @@
 #ifndef _PLUGIN_H_
 #define _PLUGIN_H_
 
+/* socket timeout (seconds) of fetch routines */
+#define PLUGIN_FETCH_TIMEOUT 5
+
 int plugin_list(void);
 int plugin_init(void);
 void plugin_exit(void);
+
+int plugin_fetch_register(const char *plugin, void *(*fetch) (const char *key, int *size), const int interval);
+void *plugin_fetch(const char *plugin, const char *key);
+int plugin_fetch_request(const char *plugin, const char *key);
+int plugin_fetch_age(const char *plugin, const char *key);
+int plugin_fetch_connect(const char *host, const int port);
+
 #endif
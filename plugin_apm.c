@@ -183,7 +183,7 @@ int plugin_init_apm(void)
 {
     hash_create(&APM);
 
-    AddFunction("apm", 1, my_apm);
+    AddFunctionFlags("apm", 1, F_CACHE, my_apm);
 
     return 0;
 }
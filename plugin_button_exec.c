@@ -100,7 +100,7 @@ int plugin_init_button_exec(void)
     /* register all our cool functions */
     /* the second parameter is the number of arguments */
     /* -1 stands for variable argument list */
-    AddFunction("button_exec", -1, my_button_exec);
+    AddFunctionFlags("button_exec", -1, F_VOLATILE, my_button_exec);
     return 0;
 }
 
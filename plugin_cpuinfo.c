@@ -152,7 +152,7 @@ static void my_cpuinfo(RESULT * result, RESULT * arg1)
 int plugin_init_cpuinfo(void)
 {
     hash_create(&CPUinfo);
-    AddFunction("cpuinfo", 1, my_cpuinfo);
+    AddFunctionFlags("cpuinfo", 1, F_CACHE, my_cpuinfo);
     return 0;
 }
 
@@ -468,7 +468,7 @@ static void timeout_dbus_handle(void *data)
 static dbus_bool_t add_dbus_timeout(DBusTimeout * t, void *data)
 {
     (void) data;		//ignore warning
-    if (!timer_add_late(timeout_dbus_handle, t, dbus_timeout_get_interval(t), 0)) {
+    if (timer_add_late(timeout_dbus_handle, t, dbus_timeout_get_interval(t), 0) != 0) {
 	return FALSE;
     }
     return TRUE;
@@ -135,13 +135,13 @@ int plugin_init_diskstats(void)
 	"in_flight", "io_ticks", "time_in_queue", ""
     };
 
-    hash_create(&DISKSTATS);
+    hash_create_numeric(&DISKSTATS);
     hash_set_delimiter(&DISKSTATS, " \n");
     for (i = 0; *header[i] != '\0'; i++) {
 	hash_set_column(&DISKSTATS, i, header[i]);
     }
 
-    AddFunction("diskstats", 3, my_diskstats);
+    AddFunctionFlags("diskstats", 3, F_CACHE, my_diskstats);
     return 0;
 }
 
@@ -0,0 +1,108 @@
+/* $Id$
+ * $URL$
+ *
+ * evaluator statistics plugin
+ *
+ * Copyright (C) 2004 The LCD4Linux Team <lcd4linux-devel@users.sourceforge.net>
+ *
+ * This file is part of LCD4Linux.
+ *
+ * LCD4Linux is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * LCD4Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * exported functions:
+ *
+ * int plugin_init_evaluator (void)
+ *  adds evaluator::stats() function
+ *
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "plugin.h"
+
+#ifdef WITH_DMALLOC
+#include <dmalloc.h>
+#endif
+
+
+/* evaluator::stats()        returns a summary string */
+/* evaluator::stats('key')   returns 'hits', 'misses', 'ratio' (percent), 'entries' or 'allocs' */
+static void my_stats(RESULT * result, int argc, RESULT * argv[])
+{
+    EVAL_STATS stats;
+    double ratio, value;
+    char buffer[80];
+    char *key;
+
+    EvalStats(&stats);
+    ratio = stats.hits + stats.misses ? 100.0 * stats.hits / (stats.hits + stats.misses) : 0.0;
+
+    if (argc == 0) {
+	snprintf(buffer, sizeof(buffer), "%lu hits, %lu misses (%.1f%%), %lu allocs", stats.hits, stats.misses, ratio,
+		 stats.allocs);
+	SetResult(&result, R_STRING, buffer);
+	return;
+    }
+
+    if (argc != 1) {
+	error("evaluator::stats(): wrong number of parameters");
+	SetResult(&result, R_STRING, "");
+	return;
+    }
+
+    key = R2S(argv[0]);
+    if (strcmp(key, "hits") == 0) {
+	value = stats.hits;
+    } else if (strcmp(key, "misses") == 0) {
+	value = stats.misses;
+    } else if (strcmp(key, "ratio") == 0) {
+	value = ratio;
+    } else if (strcmp(key, "entries") == 0) {
+	value = stats.entries;
+    } else if (strcmp(key, "allocs") == 0) {
+	value = stats.allocs;
+    } else {
+	error("evaluator::stats(): unknown key '%s'", key);
+	value = 0.0;
+    }
+
+    SetResult(&result, R_NUMBER, &value);
+}
+
+
+int plugin_init_evaluator(void)
+{
+    /* must not be cached, of course */
+    AddFunctionFlags("evaluator::stats", -1, F_NOCACHE, my_stats);
+
+    return 0;
+}
+
+void plugin_exit_evaluator(void)
+{
+    EVAL_STATS stats;
+
+    EvalStats(&stats);
+    debug("evaluator: %lu function cache hits, %lu misses, %lu allocations", stats.hits, stats.misses, stats.allocs);
+}
@@ -81,7 +81,7 @@ int plugin_init_event(void)
     /* register all our cool functions */
     /* the second parameter is the number of arguments */
     /* -1 stands for variable argument list */
-    AddFunction("event::trigger", 1, my_trigger);
+    AddFunctionFlags("event::trigger", 1, F_VOLATILE, my_trigger);
 
 
     return 0;
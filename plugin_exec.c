@@ -34,6 +34,13 @@
  * int plugin_init_exec (void)
  *  adds functions to start external pocesses
  *
+ * commands are run by a pool of worker threads (Backend 'pool', the default)
+ * or by one forked process per command (Backend 'fork')
+ *
+ * with the pool backend, a changed result triggers the named event
+ * 'exec' (see Plugin:Exec.Event), so widgets using this event are
+ * only updated when the output of a command has changed
+ *
  */
 
 
@@ -43,19 +50,43 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
 
 #include "debug.h"
 #include "plugin.h"
 #include "hash.h"
 #include "cfg.h"
 #include "thread.h"
+#include "timer.h"
+#include "event.h"
 #include "qprintf.h"
 
 
+#define SECTION "Plugin:Exec"
+
+/* exec backends */
+#define EXEC_POOL 0
+#define EXEC_FORK 1
+
 #define NUM_THREADS 16
 #define SHM_SIZE 4096
 
+/* output of a command run by the pool is read in chunks, up to EXEC_MAX bytes */
+#define EXEC_CHUNK 256
+#define EXEC_MAX 65536
+
+/* msec to wait for killed commands on exit */
+#define EXEC_EXIT_TIMEOUT 1000
+
 typedef struct {
     int delay;
     int mutex;
@@ -71,6 +102,46 @@ static int max_thread = -1;
 
 static HASH EXEC;
 
+static int Backend = EXEC_POOL;
+static int Workers = 4;
+static int Timeout = 10000;	/* msec a pool command may run */
+static int ExecQuit = 0;	/* shutting down, start no more commands (atomic) */
+
+/* a command run by the worker pool */
+typedef struct EXEC_CMD {
+    char *cmd;
+    char *key;
+    int delay;			/* msec between the end of a run and the next one */
+    int busy;			/* queued or running (atomic) */
+    pid_t pid;			/* running child (atomic) */
+    struct timespec done;	/* end of the last run */
+    int runs;			/* number of finished runs */
+    unsigned int hash;		/* hash of the last published result */
+    char *fresh;		/* result not yet picked up (atomic pointer swap) */
+    struct EXEC_CMD *next;
+} EXEC_CMD;
+
+/* a long-running command, every line of its output is a new result */
+typedef struct EXEC_STREAM {
+    char *cmd;
+    char *key;
+    int delay;			/* msec before a finished command is restarted */
+    pid_t pid;
+    int fd;
+    char *line;			/* incomplete line */
+    int len;
+    int size;
+    struct EXEC_STREAM *next;
+} EXEC_STREAM;
+
+static EXEC_CMD *Cmds = NULL;
+static EXEC_STREAM *Streams = NULL;
+static char **ExecEnv = NULL;
+
+/* workers signal new results through an eventfd */
+static int EventFd = -1;
+static char *EventName = NULL;
+
 
 /* x^0 + x^5 + x^12 */
 #define CRCPOLY 0x8408
@@ -201,10 +272,443 @@ static int create_exec_thread(const char *cmd, const char *key, const int delay)
 }
 
 
+/* FNV-1a hash of a command output, used to detect changes */
+static unsigned int exec_hash(const char *s)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*s != '\0') {
+	hash ^= (unsigned char) *s++;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/* start a command with its stdout connected to a pipe */
+static pid_t exec_spawn(const char *cmd, int *fd, const int flags)
+{
+    char *argv[] = { "/bin/sh", "-c", (char *) cmd, NULL };
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    int p[2], err;
+    pid_t pid;
+
+    if (pipe2(p, O_CLOEXEC) < 0) {
+	error("exec error: could not run pipe '%s': %s", cmd, strerror(errno));
+	return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, p[1], STDOUT_FILENO);
+
+    /* workers block all signals, the command should not */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    /* own process group, so a hung command can be killed with its children */
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    err = posix_spawn(&pid, argv[0], &actions, &attr, argv, ExecEnv);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(p[1]);
+
+    if (err != 0) {
+	error("exec error: could not run pipe '%s': %s", cmd, strerror(err));
+	close(p[0]);
+	return -1;
+    }
+
+    if (flags)
+	fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL) | flags);
+
+    *fd = p[0];
+    return pid;
+}
+
+
+/* store a new value, tell widgets waiting for exec results */
+static void exec_update(const char *key, const char *value)
+{
+    char *old = hash_get(&EXEC, key, NULL);
+
+    if (old != NULL && strcmp(old, value) == 0)
+	return;
+
+    hash_put(&EXEC, key, value);
+    if (*EventName != '\0')
+	named_event_trigger(EventName);
+}
+
+
+/* runs on a pool worker */
+static void exec_run(void *data)
+{
+    EXEC_CMD *Cmd = (EXEC_CMD *) data;
+    char *buffer, *old, scratch[EXEC_CHUNK];
+    int fd, len, size, status, left;
+    unsigned int hash;
+    uint64_t one = 1;
+    struct timespec now, end;
+    struct pollfd pfd;
+    pid_t pid;
+    ssize_t n;
+
+    /* picked up from the queue while shutting down */
+    if (__atomic_load_n(&ExecQuit, __ATOMIC_SEQ_CST)) {
+	__atomic_store_n(&Cmd->busy, 0, __ATOMIC_RELEASE);
+	return;
+    }
+
+    size = EXEC_CHUNK;
+    buffer = malloc(size);
+    len = 0;
+
+    pid = exec_spawn(Cmd->cmd, &fd, 0);
+    if (pid > 0) {
+	/* either plugin_exit_exec() sees the pid, or we see ExecQuit */
+	__atomic_store_n(&Cmd->pid, pid, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ExecQuit, __ATOMIC_SEQ_CST))
+	    kill(-pid, SIGKILL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += Timeout / 1000;
+	end.tv_nsec += (Timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+	    end.tv_sec++;
+	    end.tv_nsec -= 1000000000L;
+	}
+	while (1) {
+	    /* a hung command would keep this worker busy forever */
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    left = (end.tv_sec - now.tv_sec) * 1000 + (end.tv_nsec - now.tv_nsec) / 1000000;
+	    if (left <= 0) {
+		error("exec error: '%s' did not finish within %d msec, killed", Cmd->cmd, Timeout);
+		kill(-pid, SIGKILL);
+		break;
+	    }
+	    pfd.fd = fd;
+	    pfd.events = POLLIN;
+	    if (poll(&pfd, 1, left) <= 0)
+		continue;
+	    if (len < EXEC_MAX - 1) {
+		if (len == size - 1)
+		    buffer = realloc(buffer, size *= 2);
+		n = read(fd, buffer + len, size - 1 - len);
+	    } else {
+		/* too much output: drain the pipe */
+		n = read(fd, scratch, sizeof(scratch));
+		if (n > 0)
+		    continue;
+	    }
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    len += n;
+	}
+	close(fd);
+	waitpid(pid, &status, 0);
+	__atomic_store_n(&Cmd->pid, 0, __ATOMIC_RELEASE);
+	if (len == 0 && !__atomic_load_n(&ExecQuit, __ATOMIC_ACQUIRE)) {
+	    error("exec error: could not read from pipe '%s': %s", Cmd->cmd, strerror(errno));
+	}
+    }
+
+    /* force trailing zero */
+    buffer[len] = '\0';
+
+    /* remove trailing CR/LF */
+    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+	buffer[--len] = '\0';
+    }
+
+    /* publish the result only if it has changed, */
+    /* drop an older one which has not been picked up */
+    hash = exec_hash(buffer);
+    if (Cmd->runs > 0 && hash == Cmd->hash) {
+	free(buffer);
+    } else {
+	Cmd->hash = hash;
+	old = __atomic_exchange_n(&Cmd->fresh, buffer, __ATOMIC_ACQ_REL);
+	free(old);
+	/* wake up the main loop */
+	if (write(EventFd, &one, sizeof(one)) < 0)
+	    error("exec error: could not signal result of '%s': %s", Cmd->cmd, strerror(errno));
+    }
+    Cmd->runs++;
+
+    clock_gettime(CLOCK_MONOTONIC, &Cmd->done);
+    __atomic_store_n(&Cmd->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+/* a queued run has been dropped */
+static void exec_cancel(void *data)
+{
+    EXEC_CMD *Cmd = (EXEC_CMD *) data;
+
+    __atomic_store_n(&Cmd->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+/* pick up a new result of a command */
+static void exec_pickup(EXEC_CMD * Cmd)
+{
+    char *fresh = __atomic_exchange_n(&Cmd->fresh, NULL, __ATOMIC_ACQ_REL);
+
+    if (fresh != NULL) {
+	exec_update(Cmd->key, fresh);
+	free(fresh);
+    }
+}
+
+
+/* a worker has published results */
+static void exec_event(event_flags_t flags, void *data)
+{
+    EXEC_CMD *Cmd;
+    uint64_t count;
+
+    (void) flags;
+    (void) data;
+
+    if (read(EventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	error("exec error: read(eventfd) failed: %s", strerror(errno));
+
+    for (Cmd = Cmds; Cmd != NULL; Cmd = Cmd->next) {
+	exec_pickup(Cmd);
+    }
+}
+
+
+/* environment for the commands: a safe path */
+static void create_exec_env(void)
+{
+    extern char **environ;
+    int i, n;
+
+    for (n = 0; environ[n] != NULL; n++);
+
+    ExecEnv = malloc((n + 2) * sizeof(char *));
+    ExecEnv[0] = "PATH=/usr/local/bin:/usr/bin:/bin";
+    for (i = 0, n = 1; environ[i] != NULL; i++) {
+	if (strncmp(environ[i], "PATH=", 5) != 0)
+	    ExecEnv[n++] = environ[i];
+    }
+    ExecEnv[n] = NULL;
+}
+
+
+/* first-time call of the pool backend */
+static int exec_pool_init(void)
+{
+    if (pool_create(Workers) < 0)
+	return -1;
+
+    EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (EventFd < 0) {
+	error("exec error: eventfd() failed: %s", strerror(errno));
+	pool_destroy();
+	return -1;
+    }
+    event_add(exec_event, NULL, EventFd, 1, 0, 1);
+
+    return 0;
+}
+
+
+static int do_exec_pool(const char *cmd, const char *key, int delay)
+{
+    EXEC_CMD *Cmd;
+    struct timespec now;
+    long age;
+
+    for (Cmd = Cmds; Cmd != NULL; Cmd = Cmd->next) {
+	if (strcmp(key, Cmd->key) == 0)
+	    break;
+    }
+
+    if (Cmd == NULL) {
+	/* first-time call: start the pool */
+	if (EventFd < 0 && exec_pool_init() < 0) {
+	    error("cannot run exec <%s>: no worker pool", cmd);
+	    return -1;
+	}
+	if (ExecEnv == NULL)
+	    create_exec_env();
+	if (delay < 10) {
+	    error("exec(%s): delay %d is too short! using 10 msec", cmd, delay);
+	    delay = 10;
+	}
+	Cmd = malloc(sizeof(EXEC_CMD));
+	Cmd->cmd = strdup(cmd);
+	Cmd->key = strdup(key);
+	Cmd->delay = delay;
+	Cmd->busy = 0;
+	Cmd->pid = 0;
+	Cmd->done.tv_sec = 0;
+	Cmd->done.tv_nsec = 0;
+	Cmd->runs = 0;
+	Cmd->hash = 0;
+	Cmd->fresh = NULL;
+	Cmd->next = Cmds;
+	Cmds = Cmd;
+	hash_put(&EXEC, key, "");
+    }
+
+    /* usually picked up by exec_event() already */
+    exec_pickup(Cmd);
+
+    /* start the next run */
+    if (!__atomic_load_n(&Cmd->busy, __ATOMIC_ACQUIRE)) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age = (now.tv_sec - Cmd->done.tv_sec) * 1000L + (now.tv_nsec - Cmd->done.tv_nsec) / 1000000L;
+	if (Cmd->runs == 0 || age >= Cmd->delay) {
+	    Cmd->busy = 1;
+	    if (pool_submit(exec_run, exec_cancel, Cmd) < 0)
+		Cmd->busy = 0;
+	}
+    }
+
+    return 0;
+}
+
+
+static void stream_start(void *data);
+
+/* output of a long-running command has arrived */
+static void stream_event(event_flags_t flags, void *data)
+{
+    EXEC_STREAM *Stream = (EXEC_STREAM *) data;
+    char *eol, *line;
+    ssize_t n;
+    int status;
+
+    (void) flags;
+
+    while (1) {
+	if (Stream->len == Stream->size - 1) {
+	    if (Stream->size < EXEC_MAX) {
+		Stream->line = realloc(Stream->line, Stream->size *= 2);
+	    } else {
+		/* line too long: drop it */
+		Stream->len = 0;
+	    }
+	}
+	n = read(Stream->fd, Stream->line + Stream->len, Stream->size - 1 - Stream->len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	Stream->len += n;
+	Stream->line[Stream->len] = '\0';
+
+	/* every complete line replaces the value */
+	line = NULL;
+	while ((eol = strchr(Stream->line, '\n')) != NULL) {
+	    *eol = '\0';
+	    if (eol > Stream->line && eol[-1] == '\r')
+		eol[-1] = '\0';
+	    if (eol[1] == '\0') {
+		line = Stream->line;
+		Stream->len = 0;
+		break;
+	    }
+	    exec_update(Stream->key, Stream->line);
+	    Stream->len -= eol + 1 - Stream->line;
+	    memmove(Stream->line, eol + 1, Stream->len + 1);
+	}
+	if (line != NULL)
+	    exec_update(Stream->key, line);
+    }
+
+    /* still running */
+    if (n < 0 && errno == EAGAIN)
+	return;
+
+    /* a last line without newline */
+    if (Stream->len > 0) {
+	if (Stream->line[Stream->len - 1] == '\r')
+	    Stream->line[Stream->len - 1] = '\0';
+	exec_update(Stream->key, Stream->line);
+	Stream->len = 0;
+    }
+
+    /* command has finished: restart it after delay */
+    event_del(Stream->fd);
+    close(Stream->fd);
+    Stream->fd = -1;
+    waitpid(Stream->pid, &status, 0);
+    Stream->pid = 0;
+    timer_add(stream_start, Stream, Stream->delay, 1);
+}
+
+
+static void stream_start(void *data)
+{
+    EXEC_STREAM *Stream = (EXEC_STREAM *) data;
+
+    Stream->len = 0;
+    Stream->pid = exec_spawn(Stream->cmd, &Stream->fd, O_NONBLOCK);
+    if (Stream->pid < 0) {
+	Stream->pid = 0;
+	Stream->fd = -1;
+	timer_add(stream_start, Stream, Stream->delay, 1);
+	return;
+    }
+
+    event_add(stream_event, Stream, Stream->fd, 1, 0, 1);
+}
+
+
+static int do_stream(const char *cmd, const char *key, int delay)
+{
+    EXEC_STREAM *Stream;
+
+    for (Stream = Streams; Stream != NULL; Stream = Stream->next) {
+	if (strcmp(key, Stream->key) == 0)
+	    return 0;
+    }
+
+    /* first-time call: start the command */
+    if (ExecEnv == NULL)
+	create_exec_env();
+    if (delay < 10) {
+	error("exec::stream(%s): delay %d is too short! using 10 msec", cmd, delay);
+	delay = 10;
+    }
+
+    Stream = malloc(sizeof(EXEC_STREAM));
+    Stream->cmd = strdup(cmd);
+    Stream->key = strdup(key);
+    Stream->delay = delay;
+    Stream->pid = 0;
+    Stream->fd = -1;
+    Stream->size = EXEC_CHUNK;
+    Stream->line = malloc(Stream->size);
+    Stream->len = 0;
+    Stream->next = Streams;
+    Streams = Stream;
+    hash_put(&EXEC, key, "");
+
+    stream_start(Stream);
+
+    return 0;
+}
+
+
 static int do_exec(const char *cmd, const char *key, int delay)
 {
     int i, age;
 
+    if (Backend == EXEC_POOL)
+	return do_exec_pool(cmd, key, delay);
+
     age = hash_age(&EXEC, key);
 
     if (age < 0) {
@@ -264,21 +768,118 @@ static void my_exec(RESULT * result, RESULT * arg1, RESULT * arg2)
 }
 
 
+/* exec::stream(cmd, delay) runs cmd once and returns the last line of its output, */
+/* the command is restarted delay msec after it has finished */
+static void my_stream(RESULT * result, RESULT * arg1, RESULT * arg2)
+{
+    char *cmd, key[6], *val;
+    int delay;
+
+    cmd = R2S(arg1);
+    delay = (int) R2N(arg2);
+
+    qprintf(key, sizeof(key), "s%x", CRC(cmd));
+
+    if (do_stream(cmd, key, delay) < 0) {
+	SetResult(&result, R_STRING, "");
+	return;
+    }
+
+    val = hash_get(&EXEC, key, NULL);
+    if (val == NULL)
+	val = "";
+
+    SetResult(&result, R_STRING, val);
+}
+
+
 int plugin_init_exec(void)
 {
+    char *backend;
+
+    backend = cfg_get(SECTION, "Backend", "pool");
+    if (strcasecmp(backend, "fork") == 0) {
+	Backend = EXEC_FORK;
+    } else if (strcasecmp(backend, "pool") != 0) {
+	error("exec: unknown backend '%s', using 'pool'", backend);
+    }
+    free(backend);
+
+    cfg_number(SECTION, "Workers", 4, 1, 64, &Workers);
+    cfg_number(SECTION, "Timeout", 10000, 100, 3600000, &Timeout);
+
+    /* named event triggered by changed results */
+    EventName = cfg_get(SECTION, "Event", "exec");
+
     hash_create(&EXEC);
-    AddFunction("exec", 2, my_exec);
+    AddFunctionFlags("exec", 2, F_NOCACHE, my_exec);
+    AddFunctionFlags("exec::stream", 2, F_NOCACHE, my_stream);
     return 0;
 }
 
 
 void plugin_exit_exec(void)
 {
-    int i;
+    EXEC_CMD *Cmd;
+    EXEC_STREAM *Stream;
+    pid_t pid;
+    int i, status;
 
     for (i = 0; i <= max_thread; i++) {
 	destroy_exec_thread(i);
     }
 
+    while ((Stream = Streams) != NULL) {
+	Streams = Stream->next;
+	timer_remove(stream_start, Stream);
+	if (Stream->fd >= 0) {
+	    event_del(Stream->fd);
+	    close(Stream->fd);
+	}
+	if (Stream->pid > 0) {
+	    kill(-Stream->pid, SIGKILL);
+	    waitpid(Stream->pid, &status, 0);
+	}
+	free(Stream->cmd);
+	free(Stream->key);
+	free(Stream->line);
+	free(Stream);
+    }
+
+    if (Cmds != NULL) {
+	/* drop queued runs, stop running commands so the workers can finish */
+	/* (the pool may be shared, so it cannot be joined here) */
+	__atomic_store_n(&ExecQuit, 1, __ATOMIC_SEQ_CST);
+	pool_cancel(exec_run);
+	for (Cmd = Cmds; Cmd != NULL; Cmd = Cmd->next) {
+	    if ((pid = __atomic_load_n(&Cmd->pid, __ATOMIC_SEQ_CST)) > 0)
+		kill(-pid, SIGKILL);
+	}
+	if (pool_wait(exec_run, EXEC_EXIT_TIMEOUT) < 0) {
+	    /* a worker still uses the commands: leave them alone */
+	    error("exec error: commands did not finish within %d msec", EXEC_EXIT_TIMEOUT);
+	    return;
+	}
+	pool_destroy();
+	while ((Cmd = Cmds) != NULL) {
+	    Cmds = Cmd->next;
+	    free(Cmd->cmd);
+	    free(Cmd->key);
+	    free(Cmd->fresh);
+	    free(Cmd);
+	}
+    }
+    if (EventFd >= 0) {
+	event_del(EventFd);
+	close(EventFd);
+	EventFd = -1;
+    }
+    free(ExecEnv);
+    ExecEnv = NULL;
+    free(EventName);
+    EventName = NULL;
+
+    ExecQuit = 0;
+
     hash_destroy(&EXEC);
 }
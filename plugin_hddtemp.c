@@ -69,6 +69,9 @@ toasty 53 degC.
  *  adds various functions
  * void plugin_exit_hddtemp (void)
  *
+ * the daemon is queried in the background once a second,
+ * a changed value triggers the named event 'hddtemp'
+ *
  */
 
 #include "config.h"
@@ -79,56 +82,13 @@ toasty 53 degC.
 #include <string.h>
 #include <errno.h>
 
-/* network specific includes */
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-
 /* these should always be included */
 #include "debug.h"
 #include "plugin.h"
+#include "qprintf.h"
 
 
 
-static int socket_open(const char *name, int port)
-{
-    struct sockaddr_in server;
-    struct hostent *host_info;
-    unsigned long addr;
-    int sock;
-
-    sock = socket(PF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-	error("[hddtemp] failed to create socket: %s", strerror(errno));
-	return -1;
-    }
-
-    memset(&server, 0, sizeof(server));
-    if ((addr = inet_addr(name)) != INADDR_NONE) {
-	memcpy((char *) &server.sin_addr, &addr, sizeof(addr));
-    } else {
-	host_info = gethostbyname(name);
-	if (NULL == host_info) {
-	    error("[hddtemp] Unknown server: %s", name);
-	    return -1;
-	}
-	memcpy((char *) &server.sin_addr, host_info->h_addr, host_info->h_length);
-    }
-
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-
-    if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
-	error("[hddtemp] can't connect to server %s: %s", name, strerror(errno));
-	return -1;
-    }
-
-    return sock;
-}
-
-
 static size_t hddtemp_read(int socket, char *buffer, size_t size)
 {
     size_t count = 0;
@@ -161,9 +121,9 @@ static int hddtemp_connect(const char *host, int port, char *buffer, size_t size
 {
     int socket, ret;
 
-    socket = socket_open(host, port);
+    socket = plugin_fetch_connect(host, port);
     if (socket < 0) {
-	error("[hddtemp] Error accessing %s:%d: %s", host, port, strerror(errno));
+	error("[hddtemp] Error accessing %s:%d", host, port);
 	return -1;
     }
 
@@ -210,17 +170,35 @@ static char *split(const char *value, const int column)
     return buffer;
 }
 
-static char *hddtemp_fetch(const char *host, int port, const char *device)
+/* runs on a pool worker: fetch a buffer of all hddtemps of 'host:port' */
+static void *hddtemp_fetch(const char *key, int *size)
 {
     char buffer[4096];
-    char *key;
-    int i;
+    char host[256];
+    char *colon;
+
+    (void) size;
+
+    strncpy(host, key, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    colon = strrchr(host, ':');
+    if (colon == NULL)
+	return NULL;
+    *colon = '\0';
 
-    /* fetch a buffer of all hddtemps */
-    if (!hddtemp_connect(host, port, buffer, sizeof(buffer))) {
-	return "err";
+    if (hddtemp_connect(host, atoi(colon + 1), buffer, sizeof(buffer)) <= 0) {
+	return NULL;
     }
 
+    return strdup(buffer);
+}
+
+
+static char *hddtemp_device(const char *buffer, const char *device)
+{
+    char *key;
+    int i;
+
     i = 1;
     while (1) {
 	key = split(buffer, i);
@@ -241,7 +219,8 @@ static void my_hddtemp(RESULT * result, int argc, RESULT * argv[])
     char *device = "";
     int port = 7634;
     char *host = "localhost";
-    char *value;
+    char key[300];
+    char *buffer, *value;
 
     switch (argc) {
     case 0:
@@ -264,13 +243,22 @@ static void my_hddtemp(RESULT * result, int argc, RESULT * argv[])
 	return;
     }
 
-    value = hddtemp_fetch(host, port, device);
+    /* the latest buffer of this server, it is refreshed in the background */
+    qprintf(key, sizeof(key), "%s:%d", host, port);
+    buffer = plugin_fetch("hddtemp", key);
+    if (buffer == NULL) {
+	SetResult(&result, R_STRING, "");
+	return;
+    }
+
+    value = hddtemp_device(buffer, device);
     SetResult(&result, R_STRING, value);
 }
 
 
 int plugin_init_hddtemp(void)
 {
+    plugin_fetch_register("hddtemp", hddtemp_fetch, 1000);
     AddFunction("hddtemp", -1, my_hddtemp);
 
     return 0;
@@ -364,7 +364,7 @@ void my_i2c_sensors(RESULT * result, RESULT * arg)
 
 int plugin_init_i2c_sensors(void)
 {
-    AddFunction("i2c_sensors", 1, my_i2c_sensors);
+    AddFunctionFlags("i2c_sensors", 1, F_CACHE, my_i2c_sensors);
     return 0;
 }
 
@@ -51,18 +51,18 @@
 
 
 static HASH TELMON;
-static HASH IMON;
 
 static char thost[256];
 static int tport;
 static char phoneb[256];
+static char oldanswer[128];
 
 static char ihost[256];
 static char ipass[256];
 static int iport;
 
+/* connection to imond, used by the pool worker only */
 static int fd = 0;
-static int err = 0;
 
 /*----------------------------------------------------------------------------
  *  service_connect (host_name, port)       - connect to tcp-service
@@ -70,39 +70,15 @@ static int err = 0;
  */
 static int service_connect(const char *host_name, const int port)
 {
-    struct sockaddr_in addr;
-    struct hostent *host_p;
     int fd;
     int opt = 1;
 
-    (void) memset((char *) &addr, 0, sizeof(addr));
-
-    if ((addr.sin_addr.s_addr = inet_addr((char *) host_name)) == INADDR_NONE) {
-	host_p = gethostbyname(host_name);
-	if (!host_p) {
-	    error("%s: host not found\n", host_name);
-	    return (-1);
-	}
-	(void) memcpy((char *) (&addr.sin_addr), host_p->h_addr, host_p->h_length);
-    }
-
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons((unsigned short) port);
-
-    /* open socket */
-    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-	perror("socket");
+    if ((fd = plugin_fetch_connect(host_name, port)) < 0) {
 	return (-1);
     }
 
     (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &opt, sizeof(opt));
 
-    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
-	(void) close(fd);
-	perror(host_name);
-	return (-1);
-    }
-
     return (fd);
 }				/* service_connect (char * host_name, int port) */
 
@@ -114,10 +90,10 @@ static int service_connect(const char *host_name, const int port)
 static void send_command(const int fd, const char *str)
 {
     char buf[256];
-    int len = strlen(str);
+    int len;
 
-    sprintf(buf, "%s\r\n", str);
-    write(fd, buf, len + 2);
+    len = qprintf(buf, sizeof(buf), "%s\r\n", str);
+    write(fd, buf, len);
 
     return;
 }				/* send_command (int fd, char * str) */
@@ -132,11 +108,12 @@ static char *get_answer(const int fd)
     static char buf[8192];
     int len;
 
-    len = read(fd, buf, 8192);
+    len = read(fd, buf, sizeof(buf) - 1);
 
     if (len <= 0) {
-	return ((char *) NULL);
+	return ((char *) NULL);	/* connection lost */
     }
+    buf[len] = '\0';
 
     while (len > 1 && (buf[len - 1] == '\n' || buf[len - 1] == '\r')) {
 	buf[len - 1] = '\0';
@@ -152,28 +129,9 @@ static char *get_answer(const int fd)
 	return (buf);
     }
 
-    return ((char *) NULL);	/* ERR xxxx */
+    return ("");		/* ERR xxxx */
 }				/* get_answer (int fd) */
 
-/*----------------------------------------------------------------------------
- *  get_value (char * cmd)         - send command, get value
- *----------------------------------------------------------------------------
- */
-static char *get_value(const char *cmd)
-{
-    char *answer;
-
-    send_command(fd, cmd);
-
-    answer = get_answer(fd);
-
-    if (answer) {
-	return (answer);
-    }
-
-    return ("");
-}				/* get_value (char * cmd, int arg) */
-
 
 static void phonebook(char *number)
 {
@@ -208,44 +166,57 @@ static void phonebook(char *number)
 }
 
 
+/* runs on a pool worker: the last call reported by telmond */
+static void *telmon_fetch(const char *key, int *size)
+{
+    char telbuf[128];
+    int telmond_fd, l;
+
+    (void) key;
+    (void) size;
+
+    telmond_fd = service_connect(thost, tport);
+    if (telmond_fd < 0)
+	return NULL;
+
+    l = read(telmond_fd, telbuf, sizeof(telbuf) - 1);
+    close(telmond_fd);
+
+    if (l <= 0)
+	return NULL;
+
+    telbuf[l] = '\0';
+    return strdup(telbuf);
+}
+
+
 static int parse_telmon()
 {
-    static int telmond_fd = -2;
-    static char oldanswer[128];
-    int age;
+    char *telbuf;
 
-    /* reread every 1 sec only */
-    age = hash_age(&TELMON, NULL);
-    if (age > 0 && age <= 1000)
+    /* refreshed every second in the background */
+    telbuf = plugin_fetch("telmon", "call");
+    if (telbuf == NULL)
 	return 0;
 
-    if (telmond_fd != -1) {
-	char telbuf[128];
-
-	telmond_fd = service_connect(thost, tport);
-	if (telmond_fd >= 0) {
-	    int l = read(telmond_fd, telbuf, 127);
-	    if ((l > 0) && (strcmp(telbuf, oldanswer))) {
-		char date[11];
-		char time[11];
-		char number[256];
-		char msn[256];
-		sscanf(telbuf, "%s %s %s %s", date, time, number, msn);
-		hash_put(&TELMON, "time", time);
-		date[4] = '\0';
-		date[7] = '\0';
-		qprintf(time, sizeof(time), "%s.%s.%s", date + 8, date + 5, date);
-		hash_put(&TELMON, "number", number);
-		hash_put(&TELMON, "msn", msn);
-		hash_put(&TELMON, "date", time);
-		phonebook(number);
-		phonebook(msn);
-		hash_put(&TELMON, "name", number);
-		hash_put(&TELMON, "msnname", msn);
-	    }
-	    close(telmond_fd);
-	    strcpy(oldanswer, telbuf);
-	}
+    if (strcmp(telbuf, oldanswer)) {
+	char date[11];
+	char time[11];
+	char number[256];
+	char msn[256];
+	sscanf(telbuf, "%10s %10s %255s %255s", date, time, number, msn);
+	hash_put(&TELMON, "time", time);
+	date[4] = '\0';
+	date[7] = '\0';
+	qprintf(time, sizeof(time), "%s.%s.%s", date + 8, date + 5, date);
+	hash_put(&TELMON, "number", number);
+	hash_put(&TELMON, "msn", msn);
+	hash_put(&TELMON, "date", time);
+	phonebook(number);
+	phonebook(msn);
+	hash_put(&TELMON, "name", number);
+	hash_put(&TELMON, "msnname", msn);
+	strncpy(oldanswer, telbuf, sizeof(oldanswer) - 1);
     }
     return 0;
 }
@@ -307,42 +278,66 @@ static void my_telmon(RESULT * result, RESULT * arg1)
 }
 
 
-void init()
+/* establish the connection to imond */
+static int init(void)
 {
-    if (fd != 0)
-	return;
+    if (fd > 0)
+	return 0;
 
     fd = service_connect(ihost, iport);
 
     if (fd < 0) {
-	err++;
-    } else if ((ipass != NULL) && (*ipass != '\0')) {	/* Passwort senden */
+	fd = 0;
+	return -1;
+    }
+
+    if (*ipass != '\0') {	/* Passwort senden */
 	char buf[40];
 	qprintf(buf, sizeof(buf), "pass %s", ipass);
 	send_command(fd, buf);
 	get_answer(fd);
     }
+    return 0;
 }
 
 
-static int parse_imon(const char *cmd)
+/* runs on a pool worker: send a command to imond, get its answer */
+static void *imon_fetch(const char *cmd, int *size)
 {
-    /* reread every half sec only */
-    int age = hash_age(&IMON, cmd);
-    if (age > 0 && age <= 500)
-	return 0;
+    char *answer;
 
-    init();			/* establish connection */
+    (void) size;
 
-    if (err)
-	return -1;
+    if (init() < 0)
+	return NULL;
 
-    hash_put(&IMON, cmd, get_value(cmd));
+    send_command(fd, cmd);
+    answer = get_answer(fd);
 
-    return 0;
+    if (answer == NULL) {
+	/* reconnect next time */
+	close(fd);
+	fd = 0;
+	return NULL;
+    }
+
+    return strdup(answer);
 }
 
 
+/* the latest answer of imond to a command, refreshed every half sec */
+static char *get_value(const char *cmd)
+{
+    char *answer = plugin_fetch("imon", cmd);
+
+    if (answer) {
+	return (answer);
+    }
+
+    return ("");
+}				/* get_value (char * cmd) */
+
+
 static int configure_imon(void)
 {
     static int configured = 0;
@@ -352,8 +347,6 @@ static int configure_imon(void)
     if (configured != 0)
 	return configured;
 
-    hash_create(&IMON);
-
     s = cfg_get("Plugin:Imon", "Host", "127.0.0.1");
     if (*s == '\0') {
 	error("[Imon] empty 'Host' entry in %s", cfg_source());
@@ -380,233 +373,107 @@ static int configure_imon(void)
 
 static void my_imon_version(RESULT * result)
 {
-    char *val;
-    int age;
+    char *s;
 
     if (configure_imon() < 0) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    /* read only once */
-    age = hash_age(&IMON, "version");
-    if (age < 0) {
-	char *s;
-	init();
-	if (err) {
-	    SetResult(&result, R_STRING, "");
-	    return;
-	}
-	s = get_value("version");
-	for (;;) {		/* interne Versionsnummer killen */
-	    if (s[0] == ' ') {
-		s = s + 1;
-		break;
-	    }
-	    s = s + 1;
-	}
-	hash_put(&IMON, "version", s);
-    }
-
-    val = hash_get(&IMON, "version", NULL);
-    if (val == NULL)
-	val = "";
-    SetResult(&result, R_STRING, val);
-}
-
-
-static int parse_imon_rates(const char *channel)
-{
-    char buf[128], in[25], out[25];
-    char *s;
-    int age;
-
-    qprintf(buf, sizeof(buf), "rate %s in", channel);
-
-    /* reread every half sec only */
-    age = hash_age(&IMON, buf);
-    if (age > 0 && age <= 500)
-	return 0;
-
-    init();			/* establish connection */
-
-    if (err)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "rate %s", channel);
-    s = get_value(buf);
-
-    if (sscanf(s, "%s %s", in, out) != 2)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "rate %s in", channel);
-    hash_put(&IMON, buf, in);
-    qprintf(buf, sizeof(buf), "rate %s out", channel);
-    hash_put(&IMON, buf, out);
-
-    return 0;
+    /* interne Versionsnummer killen */
+    s = strchr(get_value("version"), ' ');
+    SetResult(&result, R_STRING, s ? s + 1 : "");
 }
 
 
 static void my_imon_rates(RESULT * result, RESULT * arg1, RESULT * arg2)
 {
-    char *val;
-    char buf[128];
+    char buf[128], in[25], out[25];
+    char *dir;
 
     if (configure_imon() < 0) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    if (parse_imon_rates(R2S(arg1)) < 0) {
+    qprintf(buf, sizeof(buf), "rate %s", R2S(arg1));
+    if (sscanf(get_value(buf), "%24s %24s", in, out) != 2) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    qprintf(buf, sizeof(buf), "rate %s %s", R2S(arg1), R2S(arg2));
-
-    val = hash_get(&IMON, buf, NULL);
-    if (val == NULL)
-	val = "";
-    SetResult(&result, R_STRING, val);
-}
-
-static int parse_imon_quantity(const char *channel)
-{
-    char buf[256], fill1[25], in[25], fill2[25], out[25];
-    char *s;
-    int age;
-
-    qprintf(buf, sizeof(buf), "quantity %s in", channel);
-
-    /* reread every half sec only */
-    age = hash_age(&IMON, buf);
-    if (age > 0 && age <= 500)
-	return 0;
-
-    init();			/* establish connection */
-
-    if (err)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "quantity %s", channel);
-    s = get_value(buf);
-
-    if (sscanf(s, "%s %s %s %s", fill1, in, fill2, out) != 4)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "quantity %s in", channel);
-    hash_put(&IMON, buf, in);
-    qprintf(buf, sizeof(buf), "quantity %s out", channel);
-    hash_put(&IMON, buf, out);
-
-    return 0;
-}
-
-static int parse_imon_status(const char *channel)
-{
-    char buf[256], status[25];
-    char *s;
-    int age;
-
-    qprintf(buf, sizeof(buf), "status %s", channel);
-
-    /* reread every half sec only */
-    age = hash_age(&IMON, buf);
-    if (age > 0 && age <= 500)
-	return 0;
-
-    init();			/* establish connection */
-
-    if (err)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "status %s", channel);
-    s = get_value(buf);
-
-    if (sscanf(s, "%s", status) != 1)
-	return -1;
-
-    qprintf(buf, sizeof(buf), "status %s", channel);
-    if (strcasecmp(status, "Online") == 0)
-	hash_put(&IMON, buf, "1");
+    dir = R2S(arg2);
+    if (strcmp(dir, "in") == 0)
+	SetResult(&result, R_STRING, in);
+    else if (strcmp(dir, "out") == 0)
+	SetResult(&result, R_STRING, out);
     else
-	hash_put(&IMON, buf, "0");
-
-    return 0;
+	SetResult(&result, R_STRING, "");
 }
 
 static void my_imon_quantity(RESULT * result, RESULT * arg1, RESULT * arg2)
 {
-    char *val;
-    char buf[256];
+    char buf[256], fill1[25], in[25], fill2[25], out[25];
+    char *dir;
 
     if (configure_imon() < 0) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    if (parse_imon_quantity(R2S(arg1)) < 0) {
+    qprintf(buf, sizeof(buf), "quantity %s", R2S(arg1));
+    if (sscanf(get_value(buf), "%24s %24s %24s %24s", fill1, in, fill2, out) != 4) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    qprintf(buf, sizeof(buf), "quantity %s %s", R2S(arg1), R2S(arg2));
-
-    val = hash_get(&IMON, buf, NULL);
-    if (val == NULL)
-	val = "";
-    SetResult(&result, R_STRING, val);
+    dir = R2S(arg2);
+    if (strcmp(dir, "in") == 0)
+	SetResult(&result, R_STRING, in);
+    else if (strcmp(dir, "out") == 0)
+	SetResult(&result, R_STRING, out);
+    else
+	SetResult(&result, R_STRING, "");
 }
 
 static void my_imon_status(RESULT * result, RESULT * arg1)
 {
-    char *val;
-    char buf[256];
+    char buf[256], status[25];
 
     if (configure_imon() < 0) {
-	SetResult(&result, R_NUMBER, "-1");
+	SetResult(&result, R_STRING, "-1");
 	return;
     }
 
-    if (parse_imon_status(R2S(arg1)) < 0) {
+    qprintf(buf, sizeof(buf), "status %s", R2S(arg1));
+    if (sscanf(get_value(buf), "%24s", status) != 1) {
 	SetResult(&result, R_STRING, "-1");
 	return;
     }
 
-    qprintf(buf, sizeof(buf), "status %s", R2S(arg1));
-
-    val = hash_get(&IMON, buf, NULL);
-    if (val == NULL)
-	val = "-1";
-    SetResult(&result, R_STRING, val);
+    if (strcasecmp(status, "Online") == 0)
+	SetResult(&result, R_STRING, "1");
+    else
+	SetResult(&result, R_STRING, "0");
 }
 
 static void my_imon(RESULT * result, RESULT * arg1)
 {
-    char *val;
-    char *cmd;
-
     if (configure_imon() < 0) {
 	SetResult(&result, R_STRING, "");
 	return;
     }
 
-    cmd = R2S(arg1);
-    if (parse_imon(cmd) < 0) {
-	SetResult(&result, R_STRING, "");
-	return;
-    }
-
-    val = hash_get(&IMON, cmd, NULL);
-    if (val == NULL)
-	val = "";
-    SetResult(&result, R_STRING, val);
+    SetResult(&result, R_STRING, get_value(R2S(arg1)));
 }
 
 
 int plugin_init_imon(void)
 {
+    /* imond and telmond are queried in the background */
+    plugin_fetch_register("imon", imon_fetch, 500);
+    plugin_fetch_register("telmon", telmon_fetch, 1000);
+
     AddFunction("imon", 1, my_imon);
     AddFunction("imon::version", 0, my_imon_version);
     AddFunction("imon::rates", 2, my_imon_rates);
@@ -625,5 +492,4 @@ void plugin_exit_imon(void)
 	close(fd);
     }
     hash_destroy(&TELMON);
-    hash_destroy(&IMON);
 }
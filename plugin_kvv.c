@@ -55,7 +55,6 @@
 #include "debug.h"
 #include "plugin.h"
 #include "cfg.h"
-#include "thread.h"
 
 /* these can't be configured as it doesn't make sense to change them */
 #define HTTP_SERVER "www.init-ka.de"
@@ -69,7 +68,7 @@
  * 12_701 = Berufsakademie
  */
 
-/* total max values to calculate shm size */
+/* total max values to calculate the data size */
 #define MAX_LINES           4
 #define MAX_LINE_LENGTH     8
 #define MAX_STATION_LENGTH 40
@@ -83,20 +82,14 @@ typedef struct {
 typedef struct {
     int entries, error;
     kvv_entry_t entry[MAX_LINES];
-} kvv_shm_t;
+} kvv_data_t;
 
 static char *station_id = NULL;
 static char *proxy_name = NULL;
 static int port = 80;
-static pid_t pid = -1;
 static int refresh = 60;
 static int abbreviate = 0;
 
-static int initialized = 0;
-static int mutex = 0;
-static int shmid = -1;
-static kvv_shm_t *shm = NULL;
-
 #define SECTION   "Plugin:KVV"
 
 #define TIMEOUT_SHORT 1		/* wait this long for additional data */
@@ -200,43 +193,7 @@ static int get_attrib(char *input, char *name, char **data)
 
 static int http_open(char *name)
 {
-    struct sockaddr_in server;
-    struct hostent *host_info;
-    unsigned long addr;
-    int sock;
-
-    /* create socket */
-    sock = socket(PF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-	perror("failed to create socket");
-	return -1;
-    }
-
-    /* Erzeuge die Socketadresse des Servers 
-     * Sie besteht aus Typ, IP-Adresse und Portnummer */
-    memset(&server, 0, sizeof(server));
-    if ((addr = inet_addr(name)) != INADDR_NONE) {
-	memcpy((char *) &server.sin_addr, &addr, sizeof(addr));
-    } else {
-	/* Wandle den Servernamen in eine IP-Adresse um */
-	host_info = gethostbyname(name);
-	if (NULL == host_info) {
-	    error("[KVV] Unknown server: %s", name);
-	    return -1;
-	}
-	memcpy((char *) &server.sin_addr, host_info->h_addr, host_info->h_length);
-    }
-
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-
-    /* Baue die Verbindung zum Server auf */
-    if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
-	perror("can't connect to server");
-	return -1;
-    }
-
-    return sock;
+    return plugin_fetch_connect(name, port);
 }
 
 static void get_text(char *input, char *end, char *dest, int dlen)
@@ -345,12 +302,13 @@ static void process_station_string(char *str)
     }
 }
 
-static void kvv_client( __attribute__ ((unused))
-		       void *dummy)
+/* runs on a pool worker: query the departures of a station */
+static void *kvv_fetch(const char *key, int *size)
 {
     char ibuffer[8192];
     char obuffer[1024];
     int count, i, sock;
+    kvv_data_t *data = NULL;
 
     char server_name[] = HTTP_SERVER;
     char *connect_to;
@@ -361,285 +319,247 @@ static void kvv_client( __attribute__ ((unused))
     else
 	connect_to = server_name;
 
-    info("[KVV] Connecting to %s", connect_to);
-
-    while (1) {
+    debug("[KVV] Connecting to %s", connect_to);
 
-	sock = http_open(connect_to);
-	if (sock < 0) {
-	    error("[KVV] Error accessing server/proxy: %s", strerror(errno));
-	    return;
-	}
-	/* create and set get request */
-	if (snprintf(obuffer, sizeof(obuffer),
-		     "GET http://%s" HTTP_REQUEST " HTTP/1.1\n"
-		     "Host: %s\n" "User-Agent: " USER_AGENT "\n\n", server_name, station_id,
-		     server_name) >= (int) sizeof(obuffer)) {
-
-	    info("[KVV] Warning, request has been truncated!");
-	}
+    sock = http_open(connect_to);
+    if (sock < 0) {
+	error("[KVV] Error accessing server/proxy");
+	return NULL;
+    }
+    /* create and set get request */
+    if (snprintf(obuffer, sizeof(obuffer),
+		 "GET http://%s" HTTP_REQUEST " HTTP/1.1\n"
+		 "Host: %s\n" "User-Agent: " USER_AGENT "\n\n", server_name, key,
+		 server_name) >= (int) sizeof(obuffer)) {
 
-	info("[KVV] Sending first (GET) request ...");
-	send(sock, obuffer, strlen(obuffer), 0);
+	info("[KVV] Warning, request has been truncated!");
+    }
 
-	count = 0;
-	do {
-	    fd_set rfds;
-	    struct timeval tv;
+    info("[KVV] Sending first (GET) request ...");
+    send(sock, obuffer, strlen(obuffer), 0);
 
-	    FD_ZERO(&rfds);
-	    FD_SET(sock, &rfds);
+    count = 0;
+    do {
+	fd_set rfds;
+	struct timeval tv;
 
-	    tv.tv_sec = count ? TIMEOUT_SHORT : TIMEOUT_LONG;
-	    tv.tv_usec = 0;
+	FD_ZERO(&rfds);
+	FD_SET(sock, &rfds);
 
-	    i = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
-	    if (i < 0) {
-		perror("select");
-		exit(1);
-	    }
+	tv.tv_sec = count ? TIMEOUT_SHORT : TIMEOUT_LONG;
+	tv.tv_usec = 0;
 
-	    if (i != 0) {
-		i = recv(sock, ibuffer + count, sizeof(ibuffer) - count - 1, 0);
+	i = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
+	if (i > 0) {
+	    i = recv(sock, ibuffer + count, sizeof(ibuffer) - count - 1, 0);
+	    if (i > 0)
 		count += i;
-	    }
 	}
-	while (i > 0);
+    }
+    while (i > 0);
 
-	ibuffer[count] = 0;	/* terminate string */
-	close(sock);
+    ibuffer[count] = 0;	/* terminate string */
+    close(sock);
 
-	if (!count)
-	    info("[KVV] empty/no reply");
+    if (!count)
+	info("[KVV] empty/no reply");
 
-	if (count > 0) {
-	    char *input, *cookie, *name = NULL, *value = NULL;
-	    int input_len, cookie_len, name_len, value_len;
+    if (count > 0) {
+	char *input, *cookie, *name = NULL, *value = NULL;
+	int input_len, cookie_len, name_len, value_len;
 
-	    /* buffer to html encode value */
-	    char value_enc[512];
-	    int value_enc_len;
+	/* buffer to html encode value */
+	char value_enc[512];
+	int value_enc_len;
 
-	    /* find cookie */
-	    cookie_len = 0;
-	    cookie = strstr(ibuffer, "Set-Cookie:");
-	    if (cookie) {
-		cookie += strlen("Set-Cookie:");
+	/* find cookie */
+	cookie_len = 0;
+	cookie = strstr(ibuffer, "Set-Cookie:");
+	if (cookie) {
+	    cookie += strlen("Set-Cookie:");
 
-		while (*cookie == ' ')
-		    cookie++;
+	    while (*cookie == ' ')
+		cookie++;
 
-		while (cookie[cookie_len] != ';')
-		    cookie_len++;
-	    }
-	    /* find input element */
-	    input_len = get_element(ibuffer, "input", &input);
-
-
-	    if (input_len > 0) {
-		char *input_end = input;
-		while (*input_end != '>')
-		    input_end++;
-		while (*input_end != '\"')
-		    input_end--;
-		*(input_end + 1) = 0;
-
-		name_len = get_attrib(input, "name", &name);
-		value_len = get_attrib(input, "value", &value);
-
-		for (value_enc_len = 0, i = 0; i < value_len; i++) {
-		    if (isalnum(value[i]))
-			value_enc[value_enc_len++] = value[i];
-		    else {
-			sprintf(value_enc + value_enc_len, "%%%02X", 0xff & value[i]);
-			value_enc_len += 3;
-		    }
+	    while (cookie[cookie_len] != ';')
+		cookie_len++;
+	}
+	/* find input element */
+	input_len = get_element(ibuffer, "input", &input);
+
+
+	if (input_len > 0) {
+	    char *input_end = input;
+	    while (*input_end != '>')
+		input_end++;
+	    while (*input_end != '\"')
+		input_end--;
+	    *(input_end + 1) = 0;
+
+	    name_len = get_attrib(input, "name", &name);
+	    value_len = get_attrib(input, "value", &value);
+
+	    for (value_enc_len = 0, i = 0; i < value_len; i++) {
+		if (isalnum(value[i]))
+		    value_enc[value_enc_len++] = value[i];
+		else {
+		    sprintf(value_enc + value_enc_len, "%%%02X", 0xff & value[i]);
+		    value_enc_len += 3;
 		}
+	    }
 
-		if (cookie_len >= 0)
-		    cookie[cookie_len] = 0;
-		if (name_len >= 0)
-		    name[name_len] = 0;
-		if (value_len >= 0)
-		    value[value_len] = 0;
-		if (value_enc_len >= 0)
-		    value_enc[value_enc_len] = 0;
-
-		sock = http_open(connect_to);
-
-		/* send POST */
-		if (snprintf(obuffer, sizeof(obuffer),
-			     "POST http://%s" HTTP_REQUEST " HTTP/1.1\n"
-			     "Host: %s\n"
-			     "User-Agent: " USER_AGENT "\n"
-			     "Cookie: %s\n"
-			     "Content-Type: application/x-www-form-urlencoded\n"
-			     "Content-Length: %d\n"
-			     "\n%s=%s",
-			     server_name, station_id, server_name, cookie, name_len + value_enc_len + 1, name,
-			     value_enc) >= (int) sizeof(obuffer)) {
-
-		    info("[KVV] Warning, request has been truncated!");
-		}
+	    if (cookie_len >= 0)
+		cookie[cookie_len] = 0;
+	    if (name_len >= 0)
+		name[name_len] = 0;
+	    if (value_len >= 0)
+		value[value_len] = 0;
+	    if (value_enc_len >= 0)
+		value_enc[value_enc_len] = 0;
+
+	    sock = http_open(connect_to);
+	    if (sock < 0) {
+		error("[KVV] Error accessing server/proxy");
+		return NULL;
+	    }
 
-		info("[KVV] Sending second (POST) request ...");
-		send(sock, obuffer, strlen(obuffer), 0);
+	    /* send POST */
+	    if (snprintf(obuffer, sizeof(obuffer),
+			 "POST http://%s" HTTP_REQUEST " HTTP/1.1\n"
+			 "Host: %s\n"
+			 "User-Agent: " USER_AGENT "\n"
+			 "Cookie: %s\n"
+			 "Content-Type: application/x-www-form-urlencoded\n"
+			 "Content-Length: %d\n"
+			 "\n%s=%s",
+			 server_name, key, server_name, cookie, name_len + value_enc_len + 1, name,
+			 value_enc) >= (int) sizeof(obuffer)) {
+
+		info("[KVV] Warning, request has been truncated!");
+	    }
 
-		count = 0;
-		do {
-		    fd_set rfds;
-		    struct timeval tv;
+	    info("[KVV] Sending second (POST) request ...");
+	    send(sock, obuffer, strlen(obuffer), 0);
 
-		    FD_ZERO(&rfds);
-		    FD_SET(sock, &rfds);
+	    count = 0;
+	    do {
+		fd_set rfds;
+		struct timeval tv;
 
-		    tv.tv_sec = count ? TIMEOUT_SHORT : TIMEOUT_LONG;
-		    tv.tv_usec = 0;
+		FD_ZERO(&rfds);
+		FD_SET(sock, &rfds);
 
-		    i = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
-		    if (i > 0) {
-			i = recv(sock, ibuffer + count, sizeof(ibuffer) - count - 1, 0);
+		tv.tv_sec = count ? TIMEOUT_SHORT : TIMEOUT_LONG;
+		tv.tv_usec = 0;
+
+		i = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
+		if (i > 0) {
+		    i = recv(sock, ibuffer + count, sizeof(ibuffer) - count - 1, 0);
+		    if (i > 0)
 			count += i;
-		    }
 		}
-		while (i > 0);	/* leave on select or read error */
-
-		ibuffer[count] = 0;
+	    }
+	    while (i > 0);	/* leave on select or read error */
 
-		/* printf("Result (%d):\n%s\n", count, ibuffer); */
+	    ibuffer[count] = 0;
 
-		/* close connection */
-		close(sock);
+	    /* printf("Result (%d):\n%s\n", count, ibuffer); */
 
-		if (!count)
-		    info("[KVV] empty/no reply");
+	    /* close connection */
+	    close(sock);
 
-		if (count > 0) {
-		    int last_was_stop = 0;
-		    char *td = ibuffer;
-		    char str[32];
-		    int td_len, i, overflow = 0;
+	    if (!count)
+		info("[KVV] empty/no reply");
 
-		    /* lock shared memory */
-		    mutex_lock(mutex);
+	    if (count > 0) {
+		int last_was_stop = 0;
+		char *td = ibuffer;
+		char str[32];
+		int td_len, i, overflow = 0;
 
-		    /* free allocated memory */
-		    shm->entries = 0;
+		/* zeroed, so unchanged departures compare equal */
+		data = calloc(1, sizeof(kvv_data_t));
+		*size = sizeof(kvv_data_t);
 
-		    if (strstr(ibuffer, "Die Daten konnten nicht abgefragt werden.") != NULL) {
-			info("[KVV] Server returned error!");
-			/* printf("%s\n", ibuffer); */
-			shm->error = 1;
-		    } else
-			shm->error = 0;
+		if (strstr(ibuffer, "Die Daten konnten nicht abgefragt werden.") != NULL) {
+		    info("[KVV] Server returned error!");
+		    /* printf("%s\n", ibuffer); */
+		    data->error = 1;
+		} else
+		    data->error = 0;
 
-		    /* scan through all <td> entries and search the line nums */
-		    do {
-			if ((td_len = get_element(td, "td", &td)) > 0) {
-			    char *attr, *p;
-			    int attr_len;
+		/* scan through all <td> entries and search the line nums */
+		do {
+		    if ((td_len = get_element(td, "td", &td)) > 0) {
+			char *attr, *p;
+			int attr_len;
+
+			/* time does not have a class but comes immediately after stop :-( */
+			if (last_was_stop) {
+			    td += td_len + 1;
+			    get_text(td, "td", str, sizeof(str));
+
+			    /* time needs special treatment */
+			    if (strncasecmp(str, "sofort", strlen("sofort")) == 0)
+				i = 0;
+			    else {
+				/* skip everything that is not a number */
+				p = str;
+				while (!isdigit(*p))
+				    p++;
+
+				/* and convert remaining to number */
+				i = atoi(p);
+			    }
 
-			    /* time does not have a class but comes immediately after stop :-( */
-			    if (last_was_stop) {
-				td += td_len + 1;
-				get_text(td, "td", str, sizeof(str));
+			    /* save time */
+			    if (!overflow && data->entries > 0)
+				data->entry[data->entries - 1].time = i;
 
-				/* time needs special treatment */
-				if (strncasecmp(str, "sofort", strlen("sofort")) == 0)
-				    i = 0;
-				else {
-				    /* skip everything that is not a number */
-				    p = str;
-				    while (!isdigit(*p))
-					p++;
+			    last_was_stop = 0;
+			}
 
-				    /* and convert remaining to number */
-				    i = atoi(p);
-				}
+			/* linenum and stopname fields have proper classes */
+			if ((attr_len = get_attrib(td, "class", &attr)) > 0) {
 
-				/* save time */
-				if (!overflow)
-				    shm->entry[shm->entries - 1].time = i;
+			    if (strncasecmp(attr, "lineNum", strlen("lineNum")) == 0) {
+				td += td_len + 1;
+				get_text(td, "td", str, sizeof(str));
 
-				last_was_stop = 0;
+				if (data->entries < MAX_LINES) {
+				    /* allocate a new slot */
+				    data->entries++;
+				    data->entry[data->entries - 1].time = -1;
+				    memset(data->entry[data->entries - 1].line, 0, MAX_LINE_LENGTH + 1);
+				    memset(data->entry[data->entries - 1].station, 0, MAX_STATION_LENGTH + 1);
+
+				    /* add new lines entry */
+				    strncpy(data->entry[data->entries - 1].line, str, MAX_LINE_LENGTH);
+				} else
+				    overflow = 1;	/* don't add further entries */
 			    }
 
-			    /* linenum and stopname fields have proper classes */
-			    if ((attr_len = get_attrib(td, "class", &attr)) > 0) {
-
-				if (strncasecmp(attr, "lineNum", strlen("lineNum")) == 0) {
-				    td += td_len + 1;
-				    get_text(td, "td", str, sizeof(str));
-
-				    if (shm->entries < MAX_LINES) {
-					/* allocate a new slot */
-					shm->entries++;
-					shm->entry[shm->entries - 1].time = -1;
-					memset(shm->entry[shm->entries - 1].line, 0, MAX_LINE_LENGTH + 1);
-					memset(shm->entry[shm->entries - 1].station, 0, MAX_STATION_LENGTH + 1);
-
-					/* add new lines entry */
-					strncpy(shm->entry[shm->entries - 1].line, str, MAX_LINE_LENGTH);
-				    } else
-					overflow = 1;	/* don't add further entries */
-				}
-
-				if (strncasecmp(attr, "stopname", strlen("stopname")) == 0) {
-				    td += td_len + 1;
-				    get_text(td, "td", str, sizeof(str));
+			    if (strncasecmp(attr, "stopname", strlen("stopname")) == 0) {
+				td += td_len + 1;
+				get_text(td, "td", str, sizeof(str));
 
 
-				    /* stopname may need further tuning */
-				    process_station_string(str);
+				/* stopname may need further tuning */
+				process_station_string(str);
 
-				    if (!overflow)
-					strncpy(shm->entry[shm->entries - 1].station, str, MAX_STATION_LENGTH);
+				if (!overflow && data->entries > 0)
+				    strncpy(data->entry[data->entries - 1].station, str, MAX_STATION_LENGTH);
 
-				    last_was_stop = 1;
-				}
+				last_was_stop = 1;
 			    }
 			}
-		    } while (td_len >= 0);
-
-		    mutex_unlock(mutex);
-		}
+		    }
+		} while (td_len >= 0);
 	    }
 	}
-
-	sleep(refresh);
     }
-}
-
-static int kvv_fork(void)
-{
-    if (initialized)
-	return 0;
-
-    info("[KVV] creating client thread");
-
-    /* set this here to prevent continous retries if init fails */
-    initialized = 1;
-
-    /* create communication buffer */
-    shmid = shm_create((void **) &shm, sizeof(kvv_shm_t));
 
-    /* catch error */
-    if (shmid < 0) {
-	error("[KVV] Shared memory allocation failed!");
-	return -1;
-    }
-
-    /* attach client thread */
-    mutex = mutex_create();
-    pid = thread_create("plugin_kvv", kvv_client, NULL);
-
-    if (pid < 0) {
-	error("[KVV] Unable to fork client: %s", strerror(errno));
-	return -1;
-    }
-
-    info("[KVV] forked client with pid %d", pid);
-    return 0;
+    return data;
 }
 
 static void kvv_start(void)
@@ -688,97 +608,67 @@ static void kvv_start(void)
 	info("[KVV] Default abbreviation setting: %s", abbreviate ? "on" : "off");
     }
 
+    /* the departures are refreshed in the background */
+    plugin_fetch_register("kvv", kvv_fetch, refresh * 1000);
 }
 
-static void kvv_line(RESULT * result, RESULT * arg1)
+/* the latest departures, NULL if there are none yet */
+static kvv_data_t *kvv_data(void)
 {
-    int index = (int) R2N(arg1);
-
     kvv_start();
 
-    if (kvv_fork() != 0) {
-	SetResult(&result, R_STRING, "");
-	return;
-    }
+    return plugin_fetch("kvv", station_id);
+}
 
-    mutex_lock(mutex);
+static void kvv_line(RESULT * result, RESULT * arg1)
+{
+    int index = (int) R2N(arg1);
+    kvv_data_t *data = kvv_data();
 
-    if (index < shm->entries) {
-	SetResult(&result, R_STRING, shm->entry[index].line);
+    if (data != NULL && index < data->entries) {
+	SetResult(&result, R_STRING, data->entry[index].line);
     } else
 	SetResult(&result, R_STRING, "");
-
-    mutex_unlock(mutex);
 }
 
 static void kvv_station(RESULT * result, RESULT * arg1)
 {
     int index = (int) R2N(arg1);
+    kvv_data_t *data = kvv_data();
 
-    kvv_start();
-
-    if (kvv_fork() != 0) {
-	SetResult(&result, R_STRING, "");
-	return;
-    }
-
-    mutex_lock(mutex);
-
-    if (shm->error && index == 0)
+    if (data != NULL && data->error && index == 0)
 	SetResult(&result, R_STRING, "Server Err");
     else {
-	if (index < shm->entries)
-	    SetResult(&result, R_STRING, shm->entry[index].station);
+	if (data != NULL && index < data->entries)
+	    SetResult(&result, R_STRING, data->entry[index].station);
 	else
 	    SetResult(&result, R_STRING, "");
     }
-
-    mutex_unlock(mutex);
 }
 
 static void kvv_time(RESULT * result, RESULT * arg1)
 {
     int index = (int) R2N(arg1);
+    kvv_data_t *data = kvv_data();
     double value = -1.0;
 
-    kvv_start();
-
-    if (kvv_fork() != 0) {
-	SetResult(&result, R_STRING, "");
-	return;
-    }
-
-    mutex_lock(mutex);
-
-    if (index < shm->entries)
-	value = shm->entry[index].time;
+    if (data != NULL && index < data->entries)
+	value = data->entry[index].time;
 
     SetResult(&result, R_NUMBER, &value);
-
-    mutex_unlock(mutex);
 }
 
 static void kvv_time_str(RESULT * result, RESULT * arg1)
 {
     int index = (int) R2N(arg1);
+    kvv_data_t *data = kvv_data();
 
-    kvv_start();
-
-    if (kvv_fork() != 0) {
-	SetResult(&result, R_STRING, "");
-	return;
-    }
-
-    mutex_lock(mutex);
-
-    if (index < shm->entries) {
+    if (data != NULL && index < data->entries) {
 	char str[8];
-	sprintf(str, "%d", shm->entry[index].time);
+	sprintf(str, "%d", data->entry[index].time);
 	SetResult(&result, R_STRING, str);
     } else
 	SetResult(&result, R_STRING, "");
-
-    mutex_unlock(mutex);
 }
 
 /* plugin initialization */
@@ -794,19 +684,6 @@ int plugin_init_kvv(void)
 
 void plugin_exit_kvv(void)
 {
-    /* kill client thread if it's running */
-    if (initialized) {
-	/* kill client */
-	if (pid != -1)
-	    thread_destroy(pid);
-
-	/* free shared mem and its mutex */
-	if (shm) {
-	    shm_destroy(shmid, shm);
-	    mutex_destroy(mutex);
-	}
-    }
-
     if (station_id)
 	free(station_id);
     if (proxy_name)
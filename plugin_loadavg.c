@@ -127,7 +127,7 @@ static void my_loadavg(RESULT * result, RESULT * arg1)
 
 int plugin_init_loadavg(void)
 {
-    AddFunction("loadavg", 1, my_loadavg);
+    AddFunctionFlags("loadavg", 1, F_CACHE, my_loadavg);
     return 0;
 }
 
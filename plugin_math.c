@@ -154,27 +154,27 @@ int plugin_init_math(void)
     SetVariableNumeric("e", M_E);
 
     /* register some basic math functions */
-    AddFunction("sqrt", 1, my_sqrt);
-    AddFunction("exp", 1, my_exp);
-    AddFunction("ln", 1, my_ln);
-    AddFunction("log", 1, my_log);
-    AddFunction("sin", 1, my_sin);
-    AddFunction("cos", 1, my_cos);
-    AddFunction("tan", 1, my_tan);
+    AddFunctionFlags("sqrt", 1, F_PURE, my_sqrt);
+    AddFunctionFlags("exp", 1, F_PURE, my_exp);
+    AddFunctionFlags("ln", 1, F_PURE, my_ln);
+    AddFunctionFlags("log", 1, F_PURE, my_log);
+    AddFunctionFlags("sin", 1, F_PURE, my_sin);
+    AddFunctionFlags("cos", 1, F_PURE, my_cos);
+    AddFunctionFlags("tan", 1, F_PURE, my_tan);
 
     /* min, max */
-    AddFunction("min", 2, my_min);
-    AddFunction("max", 2, my_max);
+    AddFunctionFlags("min", 2, F_PURE, my_min);
+    AddFunctionFlags("max", 2, F_PURE, my_max);
 
     /* floor, ceil */
-    AddFunction("floor", 1, my_floor);
-    AddFunction("ceil", 1, my_ceil);
+    AddFunctionFlags("floor", 1, F_PURE, my_floor);
+    AddFunctionFlags("ceil", 1, F_PURE, my_ceil);
 
     /* round */
-    AddFunction("round", 1, my_round);
+    AddFunctionFlags("round", 1, F_PURE, my_round);
 
     /* decode */
-    AddFunction("decode", -1, my_decode);
+    AddFunctionFlags("decode", -1, F_PURE, my_decode);
 
     return 0;
 }
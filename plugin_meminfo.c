@@ -122,7 +122,7 @@ static void my_meminfo(RESULT * result, RESULT * arg1)
 int plugin_init_meminfo(void)
 {
     hash_create(&MemInfo);
-    AddFunction("meminfo", 1, my_meminfo);
+    AddFunctionFlags("meminfo", 1, F_CACHE, my_meminfo);
     return 0;
 }
 
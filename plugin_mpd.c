@@ -67,6 +67,11 @@
  * changelog v0.83 (26.07.2008):
  *  added:    -mpd::cmd* commands
  *
+ * changelog v0.84:
+ *  changed:  -mpd is queried by a worker thread, the functions return the
+ *             latest snapshot and never block; commands are queued
+ *  added:    -a changed snapshot triggers the named event 'mpd'
+ *
  */
 
 /*
@@ -86,8 +91,6 @@ TODO:
 #include "debug.h"
 #include "plugin.h"
 #include "cfg.h"
-/* struct timeval */
-#include <sys/time.h>
 
 #include <locale.h>
 #include <langinfo.h>
@@ -103,7 +106,7 @@ TODO:
 #define TIMEOUT_IN_S 10
 #define ERROR_DISPLAY 5
 
-/* current song */
+/* current song, as seen by the pool worker */
 
 static int l_totalTimeSec;
 static int l_elapsedTimeSec;
@@ -126,13 +129,40 @@ static int l_channels;
 
 static struct mpd_song *currentSong;
 
+/* a snapshot of the player, handed from the pool worker to the evaluator */
+#define TAG_SIZE 256
+
+typedef struct {
+    int totalTimeSec;
+    int elapsedTimeSec;
+    int bitRate;
+    int repeatEnabled;
+    int randomEnabled;
+    int singleEnabled;
+    int consumeEnabled;
+    int state;
+    int volume;
+    int numberOfSongs;
+    unsigned long uptime;
+    unsigned long playTime;
+    unsigned long dbPlayTime;
+    int playlistLength;
+    int currentSongPos;
+    unsigned int sampleRate;
+    int channels;
+    /* UTF-8, empty if there is no current song */
+    char artist[TAG_SIZE];
+    char title[TAG_SIZE];
+    char album[TAG_SIZE];
+    char file[TAG_SIZE];
+} MPD_STATUS;
+
 /* connection information */
 static char host[255];
 static char pw[255];
 static int iport;
 static int plugin_enabled;
 static int waittime;
-struct timeval timestamp;
 
 static struct mpd_connection *conn;
 static char Section[] = "Plugin:MPD";
@@ -295,11 +325,9 @@ static void mpd_printerror(const char *cmd)
     if (conn) {
 	//assert(mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS);
 
+	/* messages received from the server are UTF-8, */
+	/* but the charset conversion belongs to the main thread */
 	s = mpd_connection_get_error_message(conn);
-	if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER)
-	    /* messages received from the server are UTF-8; the
-	       rest is either US-ASCII or locale */
-	    s = charset_from_utf8(s);
 
 	error("[MPD] %s to [%s]:[%i] failed : [%s]", cmd, host, iport, s);
 	mpd_connection_free(conn);
@@ -373,7 +401,7 @@ void mpd_query_status(struct mpd_connection *conn)
     }
 
     if (mpd_status_get_error(status) != NULL)
-	error("[MPD] query status : %s", charset_from_utf8(mpd_status_get_error(status)));
+	error("[MPD] query status : %s", mpd_status_get_error(status));
 
     mpd_status_free(status);
 
@@ -414,24 +442,9 @@ void mpd_query_stats(struct mpd_connection *conn)
     }
 }
 
-static int mpd_update()
+/* runs on the pool worker: (re)connect to mpd */
+static int mpd_connect(void)
 {
-    struct timeval now;
-
-    /* reread every 1000 msec only */
-    gettimeofday(&now, NULL);
-    int timedelta = (now.tv_sec - timestamp.tv_sec) * 1000 + (now.tv_usec - timestamp.tv_usec) / 1000;
-
-    if (timedelta > 0 && timedelta < waittime) {
-	/* debug("[MPD] waittime not reached...\n"); */
-	return 1;
-    }
-
-    /* check if configured */
-    if (configure_mpd() < 0) {
-	return -1;
-    }
-
     /* check if connected */
     if (conn == NULL || mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) {
 	if (conn) {
@@ -450,7 +463,6 @@ static int mpd_update()
 	    if (errorcnt == ERROR_DISPLAY)
 		error("[MPD] stop logging, until connection is fixed!");
 	    errorcnt++;
-	    gettimeofday(&timestamp, NULL);
 	    return -1;
 	}
 
@@ -463,19 +475,83 @@ static int mpd_update()
 	debug("[MPD] connection fixed...");
     }
 
+    return 1;
+}
+
+
+static void mpd_copy_tag(char *dest, const char *value)
+{
+    if (value) {
+	strncpy(dest, value, TAG_SIZE - 1);
+	dest[TAG_SIZE - 1] = '\0';
+    }
+}
+
+
+/* runs on the pool worker: take a snapshot of the player */
+static MPD_STATUS *mpd_snapshot(void)
+{
+    MPD_STATUS *status;
+    const char *artist;
+
     mpd_query_status(conn);
     mpd_query_stats(conn);
 
-    gettimeofday(&timestamp, NULL);
-    return 1;
+    /* the connection is dropped on errors */
+    if (conn == NULL)
+	return NULL;
+
+    /* zeroed, so unchanged snapshots compare equal */
+    status = calloc(1, sizeof(MPD_STATUS));
+    status->totalTimeSec = l_totalTimeSec;
+    status->elapsedTimeSec = l_elapsedTimeSec;
+    status->bitRate = l_bitRate;
+    status->repeatEnabled = l_repeatEnabled;
+    status->randomEnabled = l_randomEnabled;
+    status->singleEnabled = l_singleEnabled;
+    status->consumeEnabled = l_consumeEnabled;
+    status->state = l_state;
+    status->volume = l_volume;
+    status->numberOfSongs = l_numberOfSongs;
+    status->uptime = l_uptime;
+    status->playTime = l_playTime;
+    status->dbPlayTime = l_dbPlayTime;
+    status->playlistLength = l_playlistLength;
+    status->currentSongPos = l_currentSongPos;
+    status->sampleRate = l_sampleRate;
+    status->channels = l_channels;
+
+    if (currentSong != NULL) {
+	/* if no tag is availabe, use filename */
+	artist = mpd_song_get_tag(currentSong, MPD_TAG_ARTIST, 0);
+	if (!artist)
+	    artist = mpd_song_get_tag(currentSong, MPD_TAG_ALBUM_ARTIST, 0);
+	if (!artist)
+	    artist = mpd_song_get_uri(currentSong);
+	mpd_copy_tag(status->artist, artist);
+	mpd_copy_tag(status->title, mpd_song_get_tag(currentSong, MPD_TAG_TITLE, 0));
+	mpd_copy_tag(status->album, mpd_song_get_tag(currentSong, MPD_TAG_ALBUM, 0));
+	mpd_copy_tag(status->file, mpd_song_get_uri(currentSong));
+    }
+
+    return status;
+}
+
+
+/* the latest snapshot, refreshed every minUpdateTime msec in the background */
+static MPD_STATUS *mpd_current(void)
+{
+    static MPD_STATUS none;
+    MPD_STATUS *status = plugin_fetch("mpd", "status");
+
+    return status ? status : &none;
 }
 
 
 static void elapsedTimeSec(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_elapsedTimeSec;
+    d = (double) mpd_current()->elapsedTimeSec;
     SetResult(&result, R_NUMBER, &d);
 }
 
@@ -483,16 +559,14 @@ static void elapsedTimeSec(RESULT * result)
 static void totalTimeSec(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_totalTimeSec;
+    d = (double) mpd_current()->totalTimeSec;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void bitRate(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_bitRate;
+    d = (double) mpd_current()->bitRate;
     SetResult(&result, R_NUMBER, &d);
 }
 
@@ -500,8 +574,7 @@ static void bitRate(RESULT * result)
 static void getRepeatInt(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_repeatEnabled;
+    d = (double) mpd_current()->repeatEnabled;
     SetResult(&result, R_NUMBER, &d);
 }
 
@@ -509,84 +582,43 @@ static void getRepeatInt(RESULT * result)
 static void getRandomInt(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_randomEnabled;
+    d = (double) mpd_current()->randomEnabled;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getSingleInt(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_singleEnabled;
+    d = (double) mpd_current()->singleEnabled;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getConsumeInt(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_consumeEnabled;
+    d = (double) mpd_current()->consumeEnabled;
     SetResult(&result, R_NUMBER, &d);
 }
 
 /* if no tag is availabe, use filename */
 static void getArtist(RESULT * result)
 {
-    const char *value = NULL;
-    mpd_update();
-    if (currentSong != NULL) {
-	value = mpd_song_get_tag(currentSong, MPD_TAG_ARTIST, 0);
-	if (!value) {
-	    value = mpd_song_get_tag(currentSong, MPD_TAG_ALBUM_ARTIST, 0);
-	}
-	if (!value) {
-	    value = mpd_song_get_uri(currentSong);
-	}
-    }
-    if (value)
-	SetResult(&result, R_STRING, charset_from_utf8(value));
-    else
-	SetResult(&result, R_STRING, "");
+    SetResult(&result, R_STRING, charset_from_utf8(mpd_current()->artist));
 }
 
 static void getTitle(RESULT * result)
 {
-    const char *value = NULL;
-    mpd_update();
-    if (currentSong != NULL) {
-	value = mpd_song_get_tag(currentSong, MPD_TAG_TITLE, 0);
-    }
-    if (value)
-	SetResult(&result, R_STRING, charset_from_utf8(value));
-    else
-	SetResult(&result, R_STRING, "");
+    SetResult(&result, R_STRING, charset_from_utf8(mpd_current()->title));
 }
 
 static void getAlbum(RESULT * result)
 {
-    const char *value = NULL;
-    mpd_update();
-    if (currentSong != NULL) {
-	value = mpd_song_get_tag(currentSong, MPD_TAG_ALBUM, 0);
-    }
-    if (value)
-	SetResult(&result, R_STRING, charset_from_utf8(value));
-    else
-	SetResult(&result, R_STRING, "");
+    SetResult(&result, R_STRING, charset_from_utf8(mpd_current()->album));
 }
 
 static void getFilename(RESULT * result)
 {
-    const char *value = NULL;
-    mpd_update();
-    if (currentSong != NULL) {
-	value = mpd_song_get_uri(currentSong);
-    }
-    if (value)
-	SetResult(&result, R_STRING, charset_from_utf8(value));
-    else
-	SetResult(&result, R_STRING, "");
+    SetResult(&result, R_STRING, charset_from_utf8(mpd_current()->file));
 }
 
 /*  
@@ -600,9 +632,7 @@ static void getStateInt(RESULT * result)
 {
     double ret;
 
-    mpd_update();
-
-    switch (l_state) {
+    switch (mpd_current()->state) {
     case MPD_STATE_PLAY:
 	ret = 1;
 	break;
@@ -624,8 +654,7 @@ static void getStateInt(RESULT * result)
 static void getVolume(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_volume;
+    d = (double) mpd_current()->volume;
     /* return 0..100 or < 0 when failed */
     SetResult(&result, R_NUMBER, &d);
 }
@@ -634,71 +663,62 @@ static void getVolume(RESULT * result)
 static void getSongsInDb(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_numberOfSongs;
+    d = (double) mpd_current()->numberOfSongs;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getMpdUptime(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_uptime;
+    d = (double) mpd_current()->uptime;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getMpdPlayTime(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_playTime;
+    d = (double) mpd_current()->playTime;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getMpdDbPlayTime(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_dbPlayTime;
+    d = (double) mpd_current()->dbPlayTime;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getMpdPlaylistLength(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_playlistLength;
+    d = (double) mpd_current()->playlistLength;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getCurrentSongPos(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_currentSongPos;
+    d = (double) mpd_current()->currentSongPos;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getAudioChannels(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_channels;
+    d = (double) mpd_current()->channels;
     SetResult(&result, R_NUMBER, &d);
 }
 
 static void getSamplerateHz(RESULT * result)
 {
     double d;
-    mpd_update();
-    d = (double) l_sampleRate;
+    d = (double) mpd_current()->sampleRate;
     SetResult(&result, R_NUMBER, &d);
 }
 
 
-static void nextSong()
+static void cmd_next(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	if ((!mpd_run_next(conn))
 	    || (!mpd_response_finish(conn))) {
@@ -707,9 +727,8 @@ static void nextSong()
     }
 }
 
-static void prevSong()
+static void cmd_prev(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	if ((!mpd_run_previous(conn))
 	    || (!mpd_response_finish(conn))) {
@@ -718,9 +737,8 @@ static void prevSong()
     }
 }
 
-static void stopSong()
+static void cmd_stop(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	if ((!mpd_run_stop(conn))
 	    || (!mpd_response_finish(conn))) {
@@ -729,9 +747,8 @@ static void stopSong()
     }
 }
 
-static void pauseSong()
+static void cmd_pause(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	if ((!mpd_send_pause(conn, l_state == MPD_STATE_PAUSE ? 0 : 1))
 	    || (!mpd_response_finish(conn))) {
@@ -740,9 +757,8 @@ static void pauseSong()
     }
 }
 
-static void volUp()
+static void cmd_volup(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	l_volume += 5;
 	if (l_volume > 100)
@@ -755,9 +771,8 @@ static void volUp()
     }
 }
 
-static void volDown()
+static void cmd_voldown(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	if (l_volume > 5)
 	    l_volume -= 5;
@@ -771,9 +786,8 @@ static void volDown()
     }
 }
 
-static void toggleRepeat()
+static void cmd_repeat(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	l_repeatEnabled = !l_repeatEnabled;
 	if ((!mpd_run_repeat(conn, l_repeatEnabled))
@@ -783,9 +797,8 @@ static void toggleRepeat()
     }
 }
 
-static void toggleRandom()
+static void cmd_random(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	l_randomEnabled = !l_randomEnabled;
 	if ((!mpd_run_random(conn, l_randomEnabled))
@@ -795,9 +808,8 @@ static void toggleRandom()
     }
 }
 
-static void toggleSingle()
+static void cmd_single(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	l_singleEnabled = !l_singleEnabled;
 	if ((!mpd_run_single(conn, l_singleEnabled))
@@ -807,9 +819,8 @@ static void toggleSingle()
     }
 }
 
-static void toggleConsume()
+static void cmd_consume(void)
 {
-    mpd_update();
     if (currentSong != NULL) {
 	l_consumeEnabled = !l_consumeEnabled;
 	if ((!mpd_run_consume(conn, l_consumeEnabled))
@@ -819,6 +830,99 @@ static void toggleConsume()
     }
 }
 
+/* runs on the pool worker: execute a command or take a snapshot */
+static void *mpd_fetch(const char *key, int *size)
+{
+    if (mpd_connect() < 0)
+	return NULL;
+
+    if (strcmp(key, "status") == 0) {
+	*size = sizeof(MPD_STATUS);
+	return mpd_snapshot();
+    }
+
+    if (strcmp(key, "next") == 0)
+	cmd_next();
+    else if (strcmp(key, "prev") == 0)
+	cmd_prev();
+    else if (strcmp(key, "stop") == 0)
+	cmd_stop();
+    else if (strcmp(key, "pause") == 0)
+	cmd_pause();
+    else if (strcmp(key, "volup") == 0)
+	cmd_volup();
+    else if (strcmp(key, "voldown") == 0)
+	cmd_voldown();
+    else if (strcmp(key, "repeat") == 0)
+	cmd_repeat();
+    else if (strcmp(key, "random") == 0)
+	cmd_random();
+    else if (strcmp(key, "single") == 0)
+	cmd_single();
+    else if (strcmp(key, "consume") == 0)
+	cmd_consume();
+
+    return NULL;
+}
+
+
+/* commands are queued for the worker, followed by a fresh snapshot */
+static void mpd_queue_command(const char *cmd)
+{
+    plugin_fetch_request("mpd", cmd);
+    plugin_fetch_request("mpd", "status");
+}
+
+static void nextSong()
+{
+    mpd_queue_command("next");
+}
+
+static void prevSong()
+{
+    mpd_queue_command("prev");
+}
+
+static void stopSong()
+{
+    mpd_queue_command("stop");
+}
+
+static void pauseSong()
+{
+    mpd_queue_command("pause");
+}
+
+static void volUp()
+{
+    mpd_queue_command("volup");
+}
+
+static void volDown()
+{
+    mpd_queue_command("voldown");
+}
+
+static void toggleRepeat()
+{
+    mpd_queue_command("repeat");
+}
+
+static void toggleRandom()
+{
+    mpd_queue_command("random");
+}
+
+static void toggleSingle()
+{
+    mpd_queue_command("single");
+}
+
+static void toggleConsume()
+{
+    mpd_queue_command("consume");
+}
+
 static void formatTimeMMSS(RESULT * result, RESULT * param)
 {
     long sec;
@@ -863,7 +967,7 @@ static void formatTimeDDHHMM(RESULT * result, RESULT * param)
 int plugin_init_mpd(void)
 {
     int check;
-    debug("[MPD] v0.83, check lcd4linux configuration file...");
+    debug("[MPD] v0.84, check lcd4linux configuration file...");
 
     check = configure_mpd();
     if (plugin_enabled != 1)
@@ -876,7 +980,9 @@ int plugin_init_mpd(void)
 
     /* when mpd dies, do NOT exit application, ignore it! */
     signal(SIGPIPE, SIG_IGN);
-    gettimeofday(&timestamp, NULL);
+
+    /* mpd is queried in the background, every minUpdateTime msec */
+    plugin_fetch_register("mpd", mpd_fetch, waittime);
 
     AddFunction("mpd::artist", 0, getArtist);
     AddFunction("mpd::title", 0, getTitle);
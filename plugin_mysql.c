@@ -41,11 +41,15 @@
  *        Uptime in seconds and the number of running threads,
  *        questions, reloads, and open tables.
  *
+ *  queries run in the background every 'refresh' seconds,
+ *  a changed result triggers the named event 'mysql'
+ *
  */
 
 #include "config.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <ctype.h>
 #include "debug.h"
 #include "plugin.h"
@@ -67,16 +71,20 @@ static MYSQL conex;
 
 static char Section[] = "Plugin:MySQL";
 
+/* connection parameters, read by the main thread, used by the pool worker */
+static char server[256];
+static int port;
+static char user[128];
+static char password[256];
+static char database[256];
+static int refresh = 10;
+
+static int configured = 0;
+static int connected = 0;
+
 
 static int configure_mysql(void)
 {
-    static int configured = 0;
-
-    char server[256];
-    int port;
-    char user[128];
-    char password[256];
-    char database[256];
     char *s;
 
     if (configured != 0)
@@ -123,56 +131,97 @@ static int configure_mysql(void)
     strcpy(database, s);
     free(s);
 
+    /* not thread-safe, the connection is established by the worker */
     mysql_init(&conex);
-    if (!mysql_real_connect(&conex, server, user, password, database, port, NULL, 0)) {
-	error("[MySQL] conection error: %s", mysql_error(&conex));
-	configured = -1;
-	return configured;
-    }
 
     configured = 1;
     return configured;
 }
 
-static void my_MySQLcount(RESULT * result, RESULT * query)
+
+/* runs on a pool worker: 'c' counts the rows of a query, */
+/* 'q' returns its first column, 's' is the server status */
+static void *mysql_fetch(const char *key, int *size)
 {
-    char *q;
-    double value;
+    char buffer[32];
+    const char *q = key + 1;
+    const char *status;
     MYSQL_RES *res;
+    MYSQL_ROW row;
+    char *value;
 
-    if (configure_mysql() < 0) {
-	value = -1;
-	SetResult(&result, R_NUMBER, &value);
-	return;
-    }
+    (void) size;
+
+    /* the workers are not created by the MySQL client library */
+    mysql_thread_init();
 
-    q = R2S(query);
+    if (!connected) {
+	if (!mysql_real_connect(&conex, server, user, password, database, port, NULL, 0)) {
+	    error("[MySQL] conection error: %s", mysql_error(&conex));
+	    return NULL;
+	}
+	connected = 1;
+    }
 
     /* mysql_ping(MYSQL *mysql) checks whether the connection to the server is working. */
     /* If it has gone down, an automatic reconnection is attempted. */
     mysql_ping(&conex);
+
+    if (*key == 's') {
+	status = mysql_stat(&conex);
+	if (!status) {
+	    error("[MySQL] status error: %s", mysql_error(&conex));
+	    return strdup("error");
+	}
+	return strdup(status);
+    }
+
     if (mysql_real_query(&conex, q, (unsigned int) strlen(q))) {
 	error("[MySQL] query error: %s", mysql_error(&conex));
-	value = -1;
+	return NULL;
+    }
+
+    /* We don't use res=mysql_use_result();  because mysql_num_rows() will not */
+    /* return the correct value until all the rows in the result set have been retrieved */
+    /* with mysql_fetch_row(), so we use res=mysql_store_result(); instead */
+    res = mysql_store_result(&conex);
+    if (res == NULL) {
+	error("[MySQL] query returned no result: %s", mysql_error(&conex));
+	return NULL;
+    }
+
+    if (*key == 'c') {
+	snprintf(buffer, sizeof(buffer), "%lu", (unsigned long) mysql_num_rows(res));
+	value = strdup(buffer);
     } else {
-	/* We don't use res=mysql_use_result();  because mysql_num_rows() will not */
-	/* return the correct value until all the rows in the result set have been retrieved */
-	/* with mysql_fetch_row(), so we use res=mysql_store_result(); instead */
-	res = mysql_store_result(&conex);
-	value = (double) mysql_num_rows(res);
-	mysql_free_result(res);
+	row = mysql_fetch_row(res);
+	value = strdup(row && row[0] ? row[0] : "");
     }
+    mysql_free_result(res);
 
-    SetResult(&result, R_NUMBER, &value);
+    return value;
 }
 
 
-static void my_MySQLquery(RESULT * result, RESULT * query)
+/* the latest result of a query, refreshed in the background */
+static char *mysql_value(const char type, const char *query)
+{
+    char *key, *value;
+
+    key = malloc(strlen(query) + 2);
+    key[0] = type;
+    strcpy(key + 1, query);
+    value = plugin_fetch("mysql", key);
+    free(key);
+
+    return value;
+}
+
+
+static void my_MySQLcount(RESULT * result, RESULT * query)
 {
-    char *q;
     double value;
-    MYSQL_RES *res;
-    MYSQL_ROW row = NULL;
+    char *count;
 
     if (configure_mysql() < 0) {
 	value = -1;
@@ -180,45 +229,39 @@ static void my_MySQLquery(RESULT * result, RESULT * query)
 	return;
     }
 
-    q = R2S(query);
+    count = mysql_value('c', R2S(query));
+    value = count ? atof(count) : -1;
 
-    /* mysql_ping(MYSQL *mysql) checks whether the connection to the server is working. */
-    /* If it has gone down, an automatic reconnection is attempted. */
-    mysql_ping(&conex);
-    if (mysql_real_query(&conex, q, (unsigned int) strlen(q))) {
-	error("[MySQL] query error: %s", mysql_error(&conex));
+    SetResult(&result, R_NUMBER, &value);
+}
+
+
+static void my_MySQLquery(RESULT * result, RESULT * query)
+{
+    double value;
+    char *row;
+
+    if (configure_mysql() < 0) {
 	value = -1;
-    } else {
-	/* We don't use res=mysql_use_result();  because mysql_num_rows() will not */
-	/* return the correct value until all the rows in the result set have been retrieved */
-	/* with mysql_fetch_row(), so we use res=mysql_store_result(); instead */
-	res = mysql_store_result(&conex);
-	row = mysql_fetch_row(res);
-	mysql_free_result(res);
+	SetResult(&result, R_NUMBER, &value);
+	return;
     }
 
-    SetResult(&result, R_STRING, row[0]);
+    row = mysql_value('q', R2S(query));
+
+    SetResult(&result, R_STRING, row ? row : "");
 }
 
 
 static void my_MySQLstatus(RESULT * result)
 {
-    const char *value = "";
-    const char *status;
+    const char *value = NULL;
 
     if (configure_mysql() > 0) {
-
-	mysql_ping(&conex);
-	status = mysql_stat(&conex);
-	if (!status) {
-	    error("[MySQL] status error: %s", mysql_error(&conex));
-	    value = "error";
-	} else {
-	    value = status;
-	}
+	value = mysql_value('s', "");
     }
 
-    SetResult(&result, R_STRING, value);
+    SetResult(&result, R_STRING, value ? value : "");
 }
 
 
@@ -228,6 +271,9 @@ static void my_MySQLstatus(RESULT * result)
 int plugin_init_mysql(void)
 {
 #ifdef HAVE_MYSQL_MYSQL_H
+    cfg_number(Section, "refresh", 10, 1, 86400, &refresh);
+    plugin_fetch_register("mysql", mysql_fetch, refresh * 1000);
+
     AddFunction("MySQL::count", 1, my_MySQLcount);
     AddFunction("MySQL::query", 1, my_MySQLquery);
     AddFunction("MySQL::status", 0, my_MySQLstatus);
@@ -238,6 +284,7 @@ int plugin_init_mysql(void)
 void plugin_exit_mysql(void)
 {
 #ifdef HAVE_MYSQL_MYSQL_H
-    mysql_close(&conex);
+    if (configured > 0)
+	mysql_close(&conex);
 #endif
 }
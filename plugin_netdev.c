@@ -172,11 +172,11 @@ static void my_netdev_fast(RESULT * result, RESULT * arg1, RESULT * arg2, RESULT
 
 int plugin_init_netdev(void)
 {
-    hash_create(&NetDev);
+    hash_create_numeric(&NetDev);
     hash_set_delimiter(&NetDev, " :|\t\n");
 
-    AddFunction("netdev", 3, my_netdev);
-    AddFunction("netdev::fast", 3, my_netdev_fast);
+    AddFunctionFlags("netdev", 3, F_CACHE, my_netdev);
+    AddFunctionFlags("netdev::fast", 3, F_CACHE, my_netdev_fast);
     return 0;
 }
 
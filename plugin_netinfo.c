@@ -309,12 +309,12 @@ int plugin_init_netinfo(void)
 {
     open_net();
 
-    AddFunction("netinfo::exists", 1, my_exists);
-    AddFunction("netinfo::hwaddr", 1, my_hwaddr);
-    AddFunction("netinfo::ipaddr", 1, my_ipaddr);
-    AddFunction("netinfo::netmask", 1, my_netmask);
-    AddFunction("netinfo::netmask_short", 1, my_netmask_short);
-    AddFunction("netinfo::bcaddr", 1, my_bcaddr);
+    AddFunctionFlags("netinfo::exists", 1, F_CACHE, my_exists);
+    AddFunctionFlags("netinfo::hwaddr", 1, F_CACHE, my_hwaddr);
+    AddFunctionFlags("netinfo::ipaddr", 1, F_CACHE, my_ipaddr);
+    AddFunctionFlags("netinfo::netmask", 1, F_CACHE, my_netmask);
+    AddFunctionFlags("netinfo::netmask_short", 1, F_CACHE, my_netmask_short);
+    AddFunctionFlags("netinfo::bcaddr", 1, F_CACHE, my_bcaddr);
 
     return 0;
 }
@@ -64,7 +64,6 @@ struct check {
     char *password;
     char *server;
     int port;
-    int messages;
     struct check *next;
 };
 
@@ -76,7 +75,7 @@ static void check_node_add(struct check **head, struct check *new_check);
 static void check_destroy(struct check **head);
 
 /* pop3 */
-static void pop3_check_messages(struct check *hi, int verbose);
+static int pop3_check_messages(struct check *hi, int verbose);
 static void pop3_recv_crlf_terminated(int sockfd, char *buf, int size);
 
 /* socket  */
@@ -86,6 +85,7 @@ static int tcp_connect(struct check *hi);
 /************************ GLOBAL ***********************************/
 static char Section[] = "Plugin:POP3";
 static struct check *head = NULL;
+static int refresh = 60;
 /********************************************************************/
 
 
@@ -122,14 +122,16 @@ static void check_destroy(struct check **head)
 }
 
 /************************ POP3  ********************************/
-static void pop3_check_messages(struct check *hi, int verbose)
+/* runs on a pool worker: returns the number of messages, */
+/* -1 on errors and -2 if the account is locked */
+static int pop3_check_messages(struct check *hi, int verbose)
 {
     char buf[BUFSIZE];
-    int sockfd;
+    char *count;
+    int sockfd, messages;
 
     if ((sockfd = tcp_connect(hi)) < 0) {
-	hi->messages = -1;
-	return;
+	return -1;
     }
 
     pop3_recv_crlf_terminated(sockfd, buf, sizeof(buf));	/* server greeting */
@@ -154,16 +156,14 @@ static void pop3_check_messages(struct check *hi, int verbose)
 	info("[POP3] %s -> %s\n", hi->server, buf);
 
     if (strncmp(buf, LOCKEDERR, strlen(LOCKEDERR)) == 0) {
-	hi->messages = -2;
 	close(sockfd);
-	return;
+	return -2;
     }
     if (strncmp(buf, POPERR, strlen(POPERR)) == 0) {
 	error("[POP3] error logging into %s\n", hi->server);
 	error("[POP3] server responded: %s\n", buf);
-	hi->messages = -1;
 	close(sockfd);
-	return;
+	return -1;
     }
 
     snprintf(buf, sizeof(buf), "STAT\r\n");
@@ -175,7 +175,8 @@ static void pop3_check_messages(struct check *hi, int verbose)
 	info("[POP3] %s -> %s\n", hi->server, buf);
 
     strtok(buf, " ");
-    hi->messages = atoi(strtok(NULL, " "));
+    count = strtok(NULL, " ");
+    messages = count ? atoi(count) : -1;
 
     snprintf(buf, sizeof(buf), "QUIT\r\n");
     write(sockfd, buf, strlen(buf));
@@ -186,6 +187,7 @@ static void pop3_check_messages(struct check *hi, int verbose)
 	info("[POP3] %s -> %s\n", hi->server, buf);
 
     close(sockfd);
+    return messages;
 }
 
 static void pop3_recv_crlf_terminated(int sockfd, char *buf, int size)
@@ -193,44 +195,24 @@ static void pop3_recv_crlf_terminated(int sockfd, char *buf, int size)
     /* receive one line server responses terminated with CRLF */
     char *pos;
     int bytes = 0;
+    int len;
     memset(buf, 0, size);
-    while ((pos = strstr(buf, "\r\n")) == NULL)
-	bytes += read(sockfd, buf + bytes, size - bytes);
+    while ((pos = strstr(buf, "\r\n")) == NULL) {
+	/* give up on errors, timeouts and overlong lines */
+	len = read(sockfd, buf + bytes, size - 1 - bytes);
+	if (len <= 0 || (bytes += len) >= size - 1)
+	    return;
+    }
     *pos = '\0';
 }
 
 /************************ SOCKET  ********************************/
 static int tcp_connect(struct check *hi)
 {
-    struct sockaddr_in addr;
-    struct hostent *he = gethostbyname(hi->server);
-    int sockfd;
-
     if (hi == NULL)
 	return -1;
 
-    if (!he) {
-	error("[POP3] Failed to lookup %s\n", hi->server);
-	return (-1);
-    }
-
-    memset((char *) &addr, 0, sizeof(struct sockaddr_in));
-    addr.sin_family = AF_INET;
-    memcpy(&(addr.sin_addr.s_addr), he->h_addr, he->h_length);
-    addr.sin_port = htons(hi->port);
-
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-	perror("socket()");
-	return (-1);
-    }
-
-    if (connect(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr)) < 0) {
-	perror("connect()");
-	close(sockfd);
-	return (-1);
-    }
-
-    return (sockfd);
+    return plugin_fetch_connect(hi->server, hi->port);
 }
 
 
@@ -258,7 +240,6 @@ static int getConfig(void)
 	    node = check_node_alloc();
 	    node->id = i;
 	    node->server = x;
-	    node->messages = 0;
 	    node->next = NULL;
 
 	    x = cfg_get(Section, user, "");
@@ -308,10 +289,44 @@ static int configure_pop3(void)
 }
 
 
+static struct check *pop3_account(const int id)
+{
+    struct check *node;
+
+    for (node = head; node; node = node->next) {
+	if (node->id == id)
+	    break;
+    }
+    return node;
+}
+
+
+/* runs on a pool worker, the list of accounts does not change any more */
+static void *pop3_fetch(const char *key, int *size)
+{
+    struct check *node = pop3_account(atoi(key));
+    char buf[16];
+    int messages;
+
+    (void) size;
+
+    if (node == NULL)
+	return NULL;
+
+    /* errors keep the last number of messages */
+    messages = pop3_check_messages(node, 0);
+    if (messages < 0)
+	return NULL;
+
+    snprintf(buf, sizeof(buf), "%d", messages);
+    return strdup(buf);
+}
+
+
 static void my_POP3check(RESULT * result, RESULT * check)
 {
-    double param = R2N(check);
-    struct check *node = NULL;
+    int param = (int) R2N(check);
+    char key[16], *messages;
     double value;
 
     if (configure_pop3() < 0) {
@@ -320,15 +335,13 @@ static void my_POP3check(RESULT * result, RESULT * check)
 	return;
     }
 
-    for (node = head; node; node = node->next) {
-	if (node->id == param)
-	    break;
-    }
-    if (node == NULL) {		/*Inexistent account */
+    if (pop3_account(param) == NULL) {	/*Inexistent account */
 	value = -1;
     } else {
-	pop3_check_messages(node, 0);
-	value = (double) node->messages;
+	/* the accounts are checked in the background */
+	snprintf(key, sizeof(key), "%d", param);
+	messages = plugin_fetch("pop3", key);
+	value = messages ? atof(messages) : -1;
     }
     SetResult(&result, R_NUMBER, &value);
 }
@@ -336,6 +349,9 @@ static void my_POP3check(RESULT * result, RESULT * check)
 
 int plugin_init_pop3(void)
 {
+    cfg_number(Section, "refresh", 60, 1, 86400, &refresh);
+    plugin_fetch_register("pop3", pop3_fetch, refresh * 1000);
+
     AddFunction("POP3check", 1, my_POP3check);
     return 0;
 }
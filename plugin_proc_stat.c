@@ -364,10 +364,10 @@ static void my_disk(RESULT * result, RESULT * arg1, RESULT * arg2, RESULT * arg3
 
 int plugin_init_proc_stat(void)
 {
-    hash_create(&Stat);
-    AddFunction("proc_stat", -1, my_proc_stat);
-    AddFunction("proc_stat::cpu", 2, my_cpu);
-    AddFunction("proc_stat::disk", 3, my_disk);
+    hash_create_numeric(&Stat);
+    AddFunctionFlags("proc_stat", -1, F_CACHE, my_proc_stat);
+    AddFunctionFlags("proc_stat::cpu", 2, F_CACHE, my_cpu);
+    AddFunctionFlags("proc_stat::disk", 3, F_CACHE, my_disk);
     return 0;
 }
 
@@ -202,13 +202,16 @@ int plugin_init_sample(void)
     /* register all our cool functions */
     /* the second parameter is the number of arguments */
     /* -1 stands for variable argument list */
-    AddFunction("sample::mul2", 1, my_mul2);
-    AddFunction("sample::mul3", 1, my_mul3);
-    AddFunction("sample::answer", 0, my_answer);
-    AddFunction("sample::diff", 2, my_diff);
-    AddFunction("sample::length", 1, my_length);
-    AddFunction("sample::upcase", 1, my_upcase);
-    AddFunction("sample::concat", -1, my_concat);
+    /* functions whose result depends on their arguments only */
+    /* should be registered with the F_PURE flag, so that calls */
+    /* with constant arguments are evaluated at compile time */
+    AddFunctionFlags("sample::mul2", 1, F_PURE, my_mul2);
+    AddFunctionFlags("sample::mul3", 1, F_PURE, my_mul3);
+    AddFunctionFlags("sample::answer", 0, F_PURE, my_answer);
+    AddFunctionFlags("sample::diff", 2, F_PURE, my_diff);
+    AddFunctionFlags("sample::length", 1, F_PURE, my_length);
+    AddFunctionFlags("sample::upcase", 1, F_PURE, my_upcase);
+    AddFunctionFlags("sample::concat", -1, F_PURE, my_concat);
 
     return 0;
 }
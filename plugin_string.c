@@ -132,10 +132,10 @@ int plugin_init_string(void)
 {
 
     /* register some basic string functions */
-    AddFunction("strlen", 1, my_strlen);
-    AddFunction("strupper", 1, my_strupper);
-    AddFunction("strstr", 2, my_strstr);
-    AddFunction("substr", -1, my_substr);
+    AddFunctionFlags("strlen", 1, F_PURE, my_strlen);
+    AddFunctionFlags("strupper", 1, F_PURE, my_strupper);
+    AddFunctionFlags("strstr", 2, F_PURE, my_strstr);
+    AddFunctionFlags("substr", -1, F_PURE, my_substr);
     return 0;
 }
 
@@ -100,8 +100,8 @@ static void my_test_onoff(RESULT * result, RESULT * arg1)
 int plugin_init_test(void)
 {
 
-    AddFunction("test::bar", 4, my_test_bar);
-    AddFunction("test::onoff", 1, my_test_onoff);
+    AddFunctionFlags("test::bar", 4, F_VOLATILE, my_test_bar);
+    AddFunctionFlags("test::onoff", 1, F_VOLATILE, my_test_onoff);
 
     return 0;
 }
@@ -100,7 +100,7 @@ int plugin_init_time(void)
 {
 
     /* register some basic time functions */
-    AddFunction("time", 0, my_time);
+    AddFunctionFlags("time", 0, F_NOCACHE, my_time);
     AddFunction("strftime", 2, my_strftime);
     AddFunction("strftime_tz", 3, my_stftime_tz);
 
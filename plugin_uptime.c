@@ -226,7 +226,7 @@ static void my_uptime(RESULT * result, const int argc, RESULT * argv[])
 
 int plugin_init_uptime(void)
 {
-    AddFunction("uptime", -1, my_uptime);
+    AddFunctionFlags("uptime", -1, F_CACHE, my_uptime);
     return 0;
 }
 
@@ -653,16 +653,16 @@ int plugin_init_wireless(void)
 {
     hash_create(&wireless);
 
-    AddFunction("wifi::level", 1, wireless_level);
-    AddFunction("wifi::noise", 1, wireless_noise);
-    AddFunction("wifi::quality", 1, wireless_quality);
-    AddFunction("wifi::protocol", 1, wireless_protocol);
-    AddFunction("wifi::frequency", 1, wireless_frequency);
-    AddFunction("wifi::bitrate", 1, wireless_bitrate);
-    AddFunction("wifi::essid", 1, wireless_essid);
-    AddFunction("wifi::op_mode", 1, wireless_op_mode);
-    AddFunction("wifi::sensitivity", 1, wireless_sensitivity);
-    AddFunction("wifi::sec_mode", 1, wireless_sec_mode);
+    AddFunctionFlags("wifi::level", 1, F_CACHE, wireless_level);
+    AddFunctionFlags("wifi::noise", 1, F_CACHE, wireless_noise);
+    AddFunctionFlags("wifi::quality", 1, F_CACHE, wireless_quality);
+    AddFunctionFlags("wifi::protocol", 1, F_CACHE, wireless_protocol);
+    AddFunctionFlags("wifi::frequency", 1, F_CACHE, wireless_frequency);
+    AddFunctionFlags("wifi::bitrate", 1, F_CACHE, wireless_bitrate);
+    AddFunctionFlags("wifi::essid", 1, F_CACHE, wireless_essid);
+    AddFunctionFlags("wifi::op_mode", 1, F_CACHE, wireless_op_mode);
+    AddFunctionFlags("wifi::sensitivity", 1, F_CACHE, wireless_sensitivity);
+    AddFunctionFlags("wifi::sec_mode", 1, F_CACHE, wireless_sec_mode);
 
     return 0;
 }
@@ -35,7 +35,7 @@
  *   frees all property allocations
  *
  * int property_eval(PROPERTY * prop)
- *   evaluates a property; returns 1 if value has changed
+ *   evaluates a property if necessary; returns 1 if value has changed
  *
  * double P2N(PROPERTY * prop)
  *   returns a (already evaluated) property as number
@@ -100,37 +100,38 @@ int property_valid(PROPERTY * prop)
 }
 
 
+/* has the value changed? compare every representation both values have */
+static int property_changed(RESULT * old, RESULT * new)
+{
+    int common = old->type & new->type;
+
+    if (common == 0)
+	return 1;
+    if (common & R_NUMBER && new->number != old->number)
+	return 1;
+    if (common & R_STRING && strcmp(new->string, old->string) != 0)
+	return 1;
+    return 0;
+}
+
+
 int property_eval(PROPERTY * prop)
 {
-    RESULT old;
-    int update;
+    static RESULT value = { 0, 0, 0, NULL, 0, "" };
+    RESULT *result = &prop->result;
 
-    /* this is a bit ugly: we need to remember the old value */
-    old.type = prop->result.type;
-    old.size = prop->result.size;
-    old.number = prop->result.number;
-    old.string = prop->result.string != NULL ? strdup(prop->result.string) : NULL;
+    /* constant, or no dependency has changed since the last evaluation */
+    if (!EvalChanged(prop->compiled))
+	return 0;
 
-    DelResult(&prop->result);
-    Eval(prop->compiled, &prop->result);
+    Eval(prop->compiled, &value);
 
-    /* check if property value has changed */
-    update = 1;
-    if (prop->result.type & R_NUMBER && old.type & R_NUMBER && prop->result.number == old.number) {
-	update = 0;
-    }
-    if (prop->result.type & R_STRING && old.type & R_STRING && prop->result.size == old.size) {
-	if (prop->result.string == NULL && old.string == NULL) {
-	    update = 0;
-	} else if (prop->result.string != NULL && old.string != NULL && strcmp(prop->result.string, old.string) == 0) {
-	    update = 0;
-	}
-    }
+    if (!property_changed(&prop->result, &value))
+	return 0;
 
-    if (old.string)
-	free(old.string);
+    CopyResult(&result, &value);
 
-    return update;
+    return 1;
 }
 
 
@@ -166,7 +167,7 @@ void property_free(PROPERTY * prop)
     }
 
     if (prop->compiled != NULL) {
-	free(prop->compiled);
+	DelTree(prop->compiled);
 	prop->compiled = NULL;
     }
 
@@ -0,0 +1,77 @@
+/* $Id$
+ * $URL$
+ *
+ * regression test for the timer queue
+ *
+ * Copyright (C) 2026 The LCD4Linux Team <lcd4linux-devel@users.sourceforge.net>
+ *
+ * This file is part of LCD4Linux.
+ *
+ * LCD4Linux is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * LCD4Linux is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * A timer with an interval of 0 msec must not starve other
+ * expired timers: over 200 passes (at least 200 msec), a 10 msec
+ * timer has to fire about 20 times.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "debug.h"
+#include "timer.h"
+
+int running_foreground = 0;
+int running_background = 0;
+int verbose_level = 0;
+
+void message(const int level, const char *format, ...)
+{
+    (void) level;
+    (void) format;
+}
+
+
+static void count(void *data)
+{
+    (*(int *) data)++;
+}
+
+
+int main(void)
+{
+    struct timespec delay;
+    int pass, zero = 0, ten = 0;
+
+    timer_add(count, &zero, 0, 0);
+    timer_add(count, &ten, 10, 0);
+
+    for (pass = 0; pass < 200; pass++) {
+	if (timer_process(&delay) < 0)
+	    return 1;
+	nanosleep(&delay, NULL);
+    }
+
+    timer_exit();
+
+    printf("zero-ms=%d 10ms=%d\n", zero, ten);
+
+    return zero >= 100 && ten >= 10 ? 0 : 1;
+}
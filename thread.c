@@ -52,6 +52,22 @@
  * int thread_create (char *name, void (*thread)(void *data), void *data);
  *   create a new thread
  *
+ * int pool_create (int workers);
+ *   start the worker pool (or register one more user, growing the pool if needed)
+ *
+ * int pool_submit (void (*job)(void *data), void (*cancel)(void *data), void *data);
+ *   run a job on one of the pool workers, cancel (if not NULL) is called
+ *   instead if the job gets dropped from the queue
+ *
+ * int pool_cancel (void (*job)(void *data));
+ *   drop all queued runs of a job, returns their number
+ *
+ * int pool_wait (void (*job)(void *data), int msec);
+ *   wait (at most msec) until no worker runs the job any more
+ *
+ * void pool_destroy (void);
+ *   unregister a user, the last one stops the worker pool
+ *
  */
 
 
@@ -62,11 +78,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
 #include <sys/shm.h>
+#include <pthread.h>
 
 #include "debug.h"
 #include "thread.h"
@@ -191,3 +210,252 @@ int thread_destroy(const int pid)
 {
     return kill(pid, SIGKILL);
 }
+
+
+/* worker pool: real threads sharing one job queue */
+
+typedef struct POOL_JOB {
+    void (*job) (void *data);
+    void (*cancel) (void *data);
+    void *data;
+    struct POOL_JOB *next;
+} POOL_JOB;
+
+static pthread_mutex_t PoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PoolCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t PoolIdle = PTHREAD_COND_INITIALIZER;
+static pthread_t *PoolThread = NULL;
+static POOL_JOB *PoolRunning = NULL;	/* the job each worker is running */
+static int nPoolThread = 0;
+static int PoolUsers = 0;
+static int PoolQuit = 0;
+static POOL_JOB *PoolHead = NULL;
+static POOL_JOB *PoolTail = NULL;
+
+
+static void *pool_worker(void *arg)
+{
+    POOL_JOB *job;
+    int i = (int) (intptr_t) arg;
+
+    pthread_mutex_lock(&PoolMutex);
+    while (!PoolQuit) {
+	job = PoolHead;
+	if (job == NULL) {
+	    pthread_cond_wait(&PoolCond, &PoolMutex);
+	    continue;
+	}
+	PoolHead = job->next;
+	if (PoolHead == NULL)
+	    PoolTail = NULL;
+	PoolRunning[i] = *job;
+	pthread_mutex_unlock(&PoolMutex);
+
+	job->job(job->data);
+	free(job);
+
+	pthread_mutex_lock(&PoolMutex);
+	PoolRunning[i].job = NULL;
+	pthread_cond_broadcast(&PoolIdle);
+    }
+    pthread_mutex_unlock(&PoolMutex);
+
+    return NULL;
+}
+
+
+/* the pool is shared, so it grows to the largest size asked for */
+int pool_create(const int workers)
+{
+    pthread_t *Thread;
+    POOL_JOB *Running;
+    sigset_t all, old;
+    int i, n, err;
+
+    n = workers > 0 ? workers : 1;
+    if (PoolUsers > 0 && n <= nPoolThread) {
+	PoolUsers++;
+	return 0;
+    }
+
+    /* workers access PoolRunning[] with the mutex held */
+    pthread_mutex_lock(&PoolMutex);
+    Thread = realloc(PoolThread, n * sizeof(pthread_t));
+    if (Thread != NULL)
+	PoolThread = Thread;
+    Running = realloc(PoolRunning, n * sizeof(POOL_JOB));
+    if (Running != NULL) {
+	PoolRunning = Running;
+	memset(PoolRunning + nPoolThread, 0, (n - nPoolThread) * sizeof(POOL_JOB));
+    }
+    pthread_mutex_unlock(&PoolMutex);
+
+    if (Thread == NULL || Running == NULL) {
+	error("worker pool: out of memory");
+	n = nPoolThread;
+    }
+    PoolQuit = 0;
+
+    /* signals are handled by the main loop only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (i = nPoolThread; i < n; i++) {
+	err = pthread_create(&PoolThread[i], NULL, pool_worker, (void *) (intptr_t) i);
+	if (err != 0) {
+	    error("fatal error: pthread_create() failed: %s", strerror(err));
+	    break;
+	}
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (i == 0) {
+	free(PoolThread);
+	free(PoolRunning);
+	PoolThread = NULL;
+	PoolRunning = NULL;
+	return -1;
+    }
+
+    if (PoolUsers++ == 0)
+	info("started worker pool with %d threads", i);
+    else if (i > nPoolThread)
+	info("worker pool grown from %d to %d threads", nPoolThread, i);
+    else
+	error("worker pool: could not grow to %d threads, keeping %d", workers, nPoolThread);
+
+    pthread_mutex_lock(&PoolMutex);
+    nPoolThread = i;
+    pthread_mutex_unlock(&PoolMutex);
+
+    return 0;
+}
+
+
+int pool_submit(void (*job) (void *data), void (*cancel) (void *data), void *data)
+{
+    POOL_JOB *Job;
+
+    if (nPoolThread == 0) {
+	error("internal error: worker pool not started");
+	return -1;
+    }
+
+    Job = malloc(sizeof(POOL_JOB));
+    if (Job == NULL)
+	return -1;
+
+    Job->job = job;
+    Job->cancel = cancel;
+    Job->data = data;
+    Job->next = NULL;
+
+    pthread_mutex_lock(&PoolMutex);
+    if (PoolTail)
+	PoolTail->next = Job;
+    else
+	PoolHead = Job;
+    PoolTail = Job;
+    pthread_cond_signal(&PoolCond);
+    pthread_mutex_unlock(&PoolMutex);
+
+    return 0;
+}
+
+
+/* run the cancel hooks of dropped jobs */
+static int pool_drop(POOL_JOB * Job)
+{
+    POOL_JOB *Next;
+    int n = 0;
+
+    for (; Job != NULL; Job = Next) {
+	Next = Job->next;
+	if (Job->cancel)
+	    Job->cancel(Job->data);
+	free(Job);
+	n++;
+    }
+
+    return n;
+}
+
+
+int pool_cancel(void (*job) (void *data))
+{
+    POOL_JOB *Job, **Prev, *Dropped = NULL, **Tail = &Dropped;
+
+    pthread_mutex_lock(&PoolMutex);
+    PoolTail = NULL;
+    for (Prev = &PoolHead; (Job = *Prev) != NULL;) {
+	if (Job->job == job) {
+	    *Prev = Job->next;
+	    Job->next = NULL;
+	    *Tail = Job;
+	    Tail = &Job->next;
+	} else {
+	    PoolTail = Job;
+	    Prev = &Job->next;
+	}
+    }
+    pthread_mutex_unlock(&PoolMutex);
+
+    /* outside the lock, the hooks may submit again */
+    return pool_drop(Dropped);
+}
+
+
+int pool_wait(void (*job) (void *data), const int msec)
+{
+    struct timespec end;
+    int i, err = 0;
+
+    clock_gettime(CLOCK_REALTIME, &end);
+    end.tv_sec += msec / 1000;
+    end.tv_nsec += (msec % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+	end.tv_sec++;
+	end.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&PoolMutex);
+    for (i = 0; i < nPoolThread && err == 0;) {
+	if (PoolRunning[i].job == job)
+	    err = pthread_cond_timedwait(&PoolIdle, &PoolMutex, &end);
+	else
+	    i++;
+    }
+    pthread_mutex_unlock(&PoolMutex);
+
+    return err == 0 ? 0 : -1;
+}
+
+
+void pool_destroy(void)
+{
+    int i;
+
+    if (PoolUsers == 0 || --PoolUsers > 0)
+	return;
+
+    /* running jobs are finished, queued ones are cancelled */
+    pthread_mutex_lock(&PoolMutex);
+    PoolQuit = 1;
+    pthread_cond_broadcast(&PoolCond);
+    pthread_mutex_unlock(&PoolMutex);
+
+    for (i = 0; i < nPoolThread; i++) {
+	pthread_join(PoolThread[i], NULL);
+    }
+
+    pool_drop(PoolHead);
+    PoolHead = NULL;
+    PoolTail = NULL;
+
+    free(PoolThread);
+    free(PoolRunning);
+    PoolThread = NULL;
+    PoolRunning = NULL;
+    nPoolThread = 0;
+}
@@ -63,4 +63,10 @@ void shm_destroy(const int shmid, const void *buffer);
 int thread_create(const char *name, void (*thread) (void *data), void *data);
 int thread_destroy(const int pid);
 
+int pool_create(const int workers);
+int pool_submit(void (*job) (void *data), void (*cancel) (void *data), void *data);
+int pool_cancel(void (*job) (void *data));
+int pool_wait(void (*job) (void *data), const int msec);
+void pool_destroy(void);
+
 #endif
@@ -61,7 +61,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "debug.h"
@@ -76,6 +76,9 @@
    and clock jitter */
 #define CLOCK_SKEW_DETECT_TIME_IN_MS 1000
 
+/* number of hash buckets used to find a timer by callback and data */
+#define TIMER_BUCKETS 256
+
 /* structure for storing all relevant data of a single timer */
 typedef struct TIMER {
     /* pointer to function of type void func(void *data) that will be
@@ -87,9 +90,9 @@ typedef struct TIMER {
        it will also be used to identify a specific timer */
     void *data;
 
-    /* struct to hold the time (in seconds and milliseconds since the
-       Epoch) when the timer will be processed for the next time */
-    struct timeval when;
+    /* struct to hold the time (on the monotonic clock) when the timer
+       will be processed for the next time */
+    struct timespec when;
 
     /* specifies the timer's triggering interval in milliseconds */
     int interval;
@@ -102,6 +105,16 @@ typedef struct TIMER {
        inactive (which means the timer has been deleted and its
        allocated memory may be re-used) */
     int active;
+
+    /* position of an active timer in the heap */
+    int heap;
+
+    /* call of timer_process() which has processed the timer */
+    unsigned int pass;
+
+    /* next timer in the same hash bucket (active timers) or next
+       free timer slot (inactive timers), -1 terminates the list */
+    int next;
 } TIMER;
 
 /* number of allocated timer slots */
@@ -110,29 +123,250 @@ int nTimers = 0;
 /* pointer to memory allocated for storing the timer slots */
 TIMER *Timers = NULL;
 
+/* first inactive timer slot */
+static int Free = -1;
+
+/* binary min-heap of active timer IDs, ordered by triggering time;
+   the next upcoming timer is always found at Heap[0] */
+static int *Heap = NULL;
+static int nHeap = 0;
+
+/* number of timer_process() calls */
+static unsigned int Pass = 0;
+
+/* first timer of every hash bucket */
+static int Bucket[TIMER_BUCKETS];
+static int Buckets = 0;
+
+
+static void timer_now(struct timespec *now)
+/*  Get current time from the monotonic clock, which (unlike
+    gettimeofday) does not jump if the system time is changed.
+
+	now (timespec pointer): struct receiving the current time
+
+	return value: void
+ */
+{
+    clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+
+static long timer_diff(const struct timespec *a, const struct timespec *b)
+/*  Calculate the time difference a - b in milliseconds.
+
+	return value (long): difference in milliseconds, truncated
+	towards zero
+ */
+{
+    return (a->tv_sec - b->tv_sec) * 1000L + (a->tv_nsec - b->tv_nsec) / 1000000L;
+}
+
+
+static void timer_shift(struct timespec *when, const long msec)
+/*  Add a (possibly negative) number of milliseconds to a point in
+    time.
+
+	return value: void
+ */
+{
+    when->tv_sec += msec / 1000;
+    when->tv_nsec += (msec % 1000) * 1000000L;
+
+    if (when->tv_nsec >= 1000000000L) {
+	when->tv_sec++;
+	when->tv_nsec -= 1000000000L;
+    } else if (when->tv_nsec < 0) {
+	when->tv_sec--;
+	when->tv_nsec += 1000000000L;
+    }
+}
+
+
+static int timer_cmp(const struct timespec *a, const struct timespec *b)
+/*  Compare two points in time.
+
+	return value (integer): negative, zero or positive if a is
+	earlier than, equal to or later than b
+ */
+{
+    if (a->tv_sec != b->tv_sec)
+	return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_nsec != b->tv_nsec)
+	return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+
+static int timer_before(const int a, const int b)
+/*  Check whether timer a triggers before timer b.
+
+	return value (integer): non-zero if so
+ */
+{
+    return timer_cmp(&Timers[a].when, &Timers[b].when) < 0;
+}
+
+
+static void heap_set(const int pos, const int timer)
+/*  Store a timer at a given heap position.
+
+	return value: void
+ */
+{
+    Heap[pos] = timer;
+    Timers[timer].heap = pos;
+}
+
+
+static void heap_up(int pos)
+/*  Move a timer towards the top of the heap until its parent
+    triggers earlier.
+
+	return value: void
+ */
+{
+    int timer = Heap[pos];
+
+    while (pos > 0) {
+	int parent = (pos - 1) / 2;
+	if (!timer_before(timer, Heap[parent]))
+	    break;
+	heap_set(pos, Heap[parent]);
+	pos = parent;
+    }
+    heap_set(pos, timer);
+}
+
+
+static void heap_down(int pos)
+/*  Move a timer towards the bottom of the heap until both of its
+    children trigger later.
+
+	return value: void
+ */
+{
+    int timer = Heap[pos];
+
+    while (2 * pos + 1 < nHeap) {
+	int child = 2 * pos + 1;
+	if (child + 1 < nHeap && timer_before(Heap[child + 1], Heap[child]))
+	    child++;
+	if (!timer_before(Heap[child], timer))
+	    break;
+	heap_set(pos, Heap[child]);
+	pos = child;
+    }
+    heap_set(pos, timer);
+}
+
+
+static void heap_remove(const int pos)
+/*  Remove the timer at a given heap position by replacing it with the
+    last one and restoring the heap order.
+
+	return value: void
+ */
+{
+    nHeap--;
+    if (pos == nHeap)
+	return;
+
+    heap_set(pos, Heap[nHeap]);
+    if (pos > 0 && timer_before(Heap[pos], Heap[(pos - 1) / 2]))
+	heap_up(pos);
+    else
+	heap_down(pos);
+}
+
+
+static int timer_bucket(void (*callback) (void *data), void *data)
+/*  Calculate the hash bucket of a timer from its callback and data.
 
-static void timer_inc(const int timer, struct timeval *now)
+	return value (integer): bucket number
+ */
+{
+    uintptr_t key = (uintptr_t) callback ^ ((uintptr_t) data * 31);
+
+    key ^= key >> 16;
+    key ^= key >> 8;
+
+    return key % TIMER_BUCKETS;
+}
+
+
+static int timer_find(void (*callback) (void *data), void *data)
+/*  Find an active timer with given callback and data.
+
+	return value (integer): ID of the timer, or -1 if not found
+ */
+{
+    int timer;
+
+    if (!Buckets)
+	return -1;
+
+    for (timer = Bucket[timer_bucket(callback, data)]; timer >= 0; timer = Timers[timer].next) {
+	if (Timers[timer].callback == callback && Timers[timer].data == data)
+	    return timer;
+    }
+
+    return -1;
+}
+
+
+static void timer_free(const int timer)
+/*  Remove a timer from the heap and from its hash bucket and mark it
+    as being inactive, so its allocated memory may be re-used.
+
+	return value: void
+ */
+{
+    int *link;
+
+    heap_remove(Timers[timer].heap);
+
+    /* unlink the timer from its bucket */
+    link = &Bucket[timer_bucket(Timers[timer].callback, Timers[timer].data)];
+    while (*link != timer)
+	link = &Timers[*link].next;
+    *link = Timers[timer].next;
+
+    Timers[timer].active = TIMER_INACTIVE;
+    Timers[timer].next = Free;
+    Free = timer;
+}
+
+
+static void timer_inc(const int timer, struct timespec *now)
 /*  Update the time a given timer updates next.
 
     timer (integer): internal ID of timer that is to be updated
 
-	now (timeval pointer): struct holding the "current" time
+	now (timespec pointer): struct holding the "current" time
 
 	return value: void
  */
 {
-    /* calculate the time difference between the last time the given
-       timer has been processed and the current time */
-    struct timeval diff;
-    timersub(now, &Timers[timer].when, &diff);
+    /* a zero interval would keep the timer on top of the heap and
+       starve all other expired timers, so it is due one tick later */
+    if (Timers[timer].interval <= 0) {
+	Timers[timer].when = *now;
+	timer_shift(&Timers[timer].when, 1);
+	return;
+    }
 
-    /* convert this time difference to fractional milliseconds */
-    float time_difference = (diff.tv_sec * 1000.0f) + (diff.tv_usec / 1000.0f);
+    /* calculate the time difference (in milliseconds) between the
+       last time the given timer has been processed and the current
+       time */
+    long time_difference = timer_diff(now, &Timers[timer].when);
 
     /* calculate the number of timer intervals that have passed since
        the last timer the given timer has been processed -- value is
        truncated (rounded down) to an integer */
-    int number_of_intervals = (int) (time_difference / Timers[timer].interval);
+    int number_of_intervals = 0;
+    if (Timers[timer].interval > 0 && time_difference > 0)
+	number_of_intervals = time_difference / Timers[timer].interval;
 
     /* notify the user in case one or more timer intervals have been
        missed */
@@ -146,19 +380,97 @@ static void timer_inc(const int timer, struct timeval *now)
        railway companies might learn a lesson from us <g>) */
     number_of_intervals++;
 
-    /* calculate time difference between the last time the timer has
-       been processed and the next time it will be processed */
-    int interval = Timers[timer].interval * number_of_intervals;
+    /* finally, add time difference to the timer's trigger */
+    timer_shift(&Timers[timer].when, (long) Timers[timer].interval * number_of_intervals);
+}
+
 
-    /* convert time difference (in milliseconds) to a "timeval"
-       struct (in seconds and microseconds) */
-    struct timeval tv_interval = {
-	.tv_sec = interval / 1000,
-	.tv_usec = (interval % 1000) * 1000
-    };
+static int timer_insert(void (*callback) (void *data), void *data, const int interval, const int one_shot, const int late)
+/*  Create a new timer and add it to the heap and to its hash bucket.
 
-    /* finally, add time difference to the timer's trigger */
-    timeradd(&Timers[timer].when, &tv_interval, &Timers[timer].when);
+	late (integer): if non-zero, the timer will be triggered after a
+	single timer interval instead of immediately
+
+	return value (integer): returns a value of 0 on successful timer
+	creation; otherwise returns a value of -1
+*/
+{
+    int timer;			/* current timer's ID */
+    struct timespec now;	/* struct to hold current time */
+
+    if (!Buckets) {
+	for (timer = 0; timer < TIMER_BUCKETS; timer++)
+	    Bucket[timer] = -1;
+	Buckets = 1;
+    }
+
+    /* no inactive timers (or none at all) found, so we have to add a
+       new timer slot; the heap grows along with the timer slots */
+    if (Free < 0) {
+	TIMER *tmp;
+	int *heap;
+
+	if ((tmp = realloc(Timers, (nTimers + 1) * sizeof(*Timers))) == NULL) {
+	    /* signal unsuccessful timer creation */
+	    return -1;
+	}
+	Timers = tmp;
+
+	if ((heap = realloc(Heap, (nTimers + 1) * sizeof(*Heap))) == NULL) {
+	    /* signal unsuccessful timer creation */
+	    return -1;
+	}
+	Heap = heap;
+
+	Timers[nTimers].active = TIMER_INACTIVE;
+	Timers[nTimers].next = -1;
+	Free = nTimers++;
+    }
+
+    /* reuse the first inactive timer */
+    timer = Free;
+    Free = Timers[timer].next;
+
+    /* get current time so the timer triggers immediately */
+    timer_now(&now);
+
+    /* initialize timer data */
+    Timers[timer].callback = callback;
+    Timers[timer].data = data;
+    Timers[timer].when = now;
+    Timers[timer].interval = interval;
+    Timers[timer].one_shot = one_shot;
+    Timers[timer].pass = Pass - 1;
+
+    /* set timer to active so that it is processed and not overwritten
+       by the memory optimization routine above */
+    Timers[timer].active = TIMER_ACTIVE;
+
+    /* one-shot timers should NOT fire immediately, so delay them by a
+       single timer interval */
+    if (one_shot || late) {
+	timer_inc(timer, &now);
+    } else if (interval > 0) {
+	/* periodic timers are aligned to a multiple of their interval,
+	   so timers with related intervals (e.g. 100 and 500 ms) expire
+	   at the same time and share a single wakeup */
+	long long msec = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+	msec -= msec % interval;
+	Timers[timer].when.tv_sec = msec / 1000;
+	Timers[timer].when.tv_nsec = (msec % 1000) * 1000000L;
+    }
+
+    /* link the timer into its hash bucket */
+    int bucket = timer_bucket(callback, data);
+    Timers[timer].next = Bucket[bucket];
+    Bucket[bucket] = timer;
+
+    /* and into the heap */
+    heap_set(nHeap++, timer);
+    heap_up(nHeap - 1);
+
+    /* signal successful timer creation */
+    return 0;
 }
 
 
@@ -177,27 +489,21 @@ int timer_remove(void (*callback) (void *data), void *data)
 {
     int timer;			/* current timer's ID */
 
-    /* loop through the timer slots and try to find the specified
-       timer slot by looking for its settings */
-    for (timer = 0; timer < nTimers; timer++) {
-	/* skip inactive (i.e. deleted) timers */
-	if (Timers[timer].active == TIMER_INACTIVE)
-	    continue;
-
-	if (Timers[timer].callback == callback && Timers[timer].data == data) {
-	    /* we have found the timer slot, so mark it as being inactive;
-	       we will not actually delete the slot, so its allocated
-	       memory may be re-used */
-	    Timers[timer].active = TIMER_INACTIVE;
-
-	    /* signal successful timer removal */
-	    return 0;
-	}
-    }
+    /* look up the timer slot in its hash bucket */
+    timer = timer_find(callback, data);
 
     /* we have NOT found the timer slot, so signal failure by
        returning a value of -1 */
-    return -1;
+    if (timer < 0)
+	return -1;
+
+    /* we have found the timer slot, so mark it as being inactive;
+       we will not actually delete the slot, so its allocated
+       memory may be re-used */
+    timer_free(timer);
+
+    /* signal successful timer removal */
+    return 0;
 }
 
 
@@ -223,54 +529,7 @@ int timer_add(void (*callback) (void *data), void *data, const int interval, con
 	creation; otherwise returns a value of -1
 */
 {
-    int timer;			/* current timer's ID */
-    struct timeval now;		/* struct to hold current time */
-
-    /* try to minimize memory usage by looping through the timer slots
-       and looking for an inactive timer */
-    for (timer = 0; timer < nTimers; timer++) {
-	if (Timers[timer].active == TIMER_INACTIVE) {
-	    /* we've just found one, so let's reuse it ("timer" holds its
-	       ID) by breaking the loop */
-	    break;
-	}
-    }
-
-    /* no inactive timers (or none at all) found, so we have to add a
-       new timer slot */
-    if (timer == nTimers) {
-	TIMER *tmp;
-
-	if ((tmp = realloc(Timers, (nTimers + 1) * sizeof(*Timers))) == NULL) {
-	    /* signal unsuccessful timer creation */
-	    return -1;
-	}
-	Timers = tmp;
-	nTimers++;
-    }
-
-    /* get current time so the timer triggers immediately */
-    gettimeofday(&now, NULL);
-
-    /* initialize timer data */
-    Timers[timer].callback = callback;
-    Timers[timer].data = data;
-    Timers[timer].when = now;
-    Timers[timer].interval = interval;
-    Timers[timer].one_shot = one_shot;
-
-    /* set timer to active so that it is processed and not overwritten
-       by the memory optimization routine above */
-    Timers[timer].active = TIMER_ACTIVE;
-
-    /* one-shot timers should NOT fire immediately, so delay them by a
-       single timer interval */
-    if (one_shot) {
-	timer_inc(timer, &now);
-    }
-
-    /* signal successful timer creation */
-    return 0;
+    return timer_insert(callback, data, interval, one_shot, 0);
 }
 
 
@@ -298,37 +557,7 @@ int timer_add_late(void (*callback) (void *data), void *data, const int interval
 	creation; otherwise returns a value of -1
 */
 {
-    /* create new timer slot and add it to the timer queue; mask it as
-       one-shot timer for now, so the timer will be delayed by a
-       single timer interval */
-    if (!timer_add(callback, data, interval, 1)) {
-	/* signal unsuccessful timer creation */
-	return -1;
-    }
-
-    int timer;			/* current timer's ID */
-
-    /* loop through the timer slots and try to find the new timer slot
-       by looking for its settings */
-    for (timer = 0; timer < nTimers; timer++) {
-	/* skip inactive (i.e. deleted) timers */
-	if (Timers[timer].active == TIMER_INACTIVE)
-	    continue;
-
-	if (Timers[timer].callback == callback && Timers[timer].data == data && Timers[timer].interval == interval) {
-	    /* we have found the new timer slot, so unmask it by setting
-	       its "one_shot" variable to the REAL value; then signal
-	       successful timer creation */
-	    Timers[timer].one_shot = one_shot;
-
-	    /* signal successful timer creation */
-	    return 0;
-	}
-    }
-
-    /* we have NOT found the new timer slot for some reason, so signal
-       failure by returning a value of -1 */
-    return -1;
+    return timer_insert(callback, data, interval, one_shot, 1);
 }
 
 
@@ -342,143 +571,119 @@ int timer_process(struct timespec *delay)
 	processed successfully; otherwise returns a value of -1
 */
 {
-    struct timeval now;		/* struct to hold current time */
+    struct timespec now;	/* struct to hold current time */
 
     /* get current time to check which timers need processing */
-    gettimeofday(&now, NULL);
+    timer_now(&now);
 
     /* sanity check; by now, at least one timer should be
        instantiated */
-    if (nTimers <= 0) {
+    if (nHeap <= 0) {
 	/* otherwise, print an error and return a value of -1 to
 	   signal an error */
 	error("Huh? Not even a single timer to process? Dazed and confused...");
 	return -1;
     }
 
-    int timer;			/* current timer's ID */
-
-    /* process all expired timers */
-    for (timer = 0; timer < nTimers; timer++) {
-	/* skip inactive (i.e. deleted) timers */
-	if (Timers[timer].active == TIMER_INACTIVE)
-	    continue;
-
-	/* check whether current timer needs to be processed, i.e. the
-	   timer's triggering time is less than or equal to the current
-	   time; according to the man page of timercmp(), this avoids
-	   using the operators ">=", "<=" and "==" which might be broken
-	   on some systems */
-	if (!timercmp(&Timers[timer].when, &now, >)) {
-	    /* if the timer's callback function has been set, call it and
-	       pass the corresponding data */
-	    if (Timers[timer].callback != NULL) {
-		Timers[timer].callback(Timers[timer].data);
-	    }
-
-	    /* check for one-shot timers */
-	    if (Timers[timer].one_shot) {
-		/* mark one-shot timer as inactive (which means the timer has
-		   been deleted and its allocated memory may be re-used) */
-		Timers[timer].active = TIMER_INACTIVE;
-	    } else {
-		/* otherwise, re-spawn timer by adding one triggering interval
-		   to its triggering time */
-		timer_inc(timer, &now);
-	    }
+    Pass++;
+
+    /* process all expired timers, i.e. the timer's triggering time is
+       less than or equal to the current time; as the heap is ordered
+       by triggering time, only the top needs to be checked; every
+       timer is processed only once per call, even if its interval is
+       zero */
+    while (nHeap > 0 && timer_cmp(&Timers[Heap[0]].when, &now) <= 0 && Timers[Heap[0]].pass != Pass) {
+
+	int timer = Heap[0];	/* current timer's ID */
+	void (*callback) (void *data) = Timers[timer].callback;
+	void *data = Timers[timer].data;
+
+	Timers[timer].pass = Pass;
+
+	/* the callback may add or remove timers (and even move the
+	   timer slots), so the timer is rescheduled before it is
+	   called */
+	if (Timers[timer].one_shot) {
+	    /* mark one-shot timer as inactive (which means the timer has
+	       been deleted and its allocated memory may be re-used) */
+	    timer_free(timer);
+	} else {
+	    /* otherwise, re-spawn timer by adding one triggering interval
+	       to its triggering time */
+	    timer_inc(timer, &now);
+	    heap_down(0);
 	}
-    }
 
-    int next_timer = -1;	/* ID of the next upcoming timer */
-
-    /* loop through the timer slots and try to find the next upcoming
-       timer */
-    for (timer = 0; timer < nTimers; timer++) {
-	/* skip inactive (i.e. deleted) timers */
-	if (Timers[timer].active == TIMER_INACTIVE)
-	    continue;
-
-	/* if this is the first timer that we check, mark it as the next
-	   upcoming timer; otherwise, we'll have nothing to compare
-	   against in this loop */
-	if (next_timer < 0)
-	    next_timer = timer;
-	/* check whether current timer needs processing prior to the one
-	   selected */
-	else if (timercmp(&Timers[timer].when, &Timers[next_timer].when, <)) {
-	    /* if so, mark it as the next upcoming timer */
-	    next_timer = timer;
+	/* if the timer's callback function has been set, call it and
+	   pass the corresponding data */
+	if (callback != NULL) {
+	    callback(data);
 	}
     }
 
-    /* sanity check; we should by now have found the next upcoming
-       timer */
-    if (next_timer < 0) {
+    /* sanity check; we should by now have a next upcoming timer */
+    if (nHeap <= 0) {
 	/* otherwise, print an error and return a value of -1 to signal an
 	   error */
 	error("Huh? Not even a single timer left? Dazed and confused...");
 	return -1;
     }
 
+    /* the next upcoming timer is always on top of the heap */
+    int next_timer = Heap[0];
+
     /* processing all the timers might have taken a while, so update
        the current time to compensate for processing delay */
-    gettimeofday(&now, NULL);
+    timer_now(&now);
 
-    struct timeval diff;	/* struct holding the time difference
+    struct timespec diff;	/* struct holding the time difference
 				   between current time and the triggering time of the
 				   next upcoming timer event */
 
     /* calculate delay to the next upcoming timer event and store it
        in "diff" */
-    timersub(&Timers[next_timer].when, &now, &diff);
+    diff = Timers[next_timer].when;
+    diff.tv_sec -= now.tv_sec;
+    diff.tv_nsec -= now.tv_nsec;
+    if (diff.tv_nsec < 0) {
+	diff.tv_sec--;
+	diff.tv_nsec += 1000000000L;
+    }
+
+    /* convert "diff" to milliseconds */
+    long time_difference = diff.tv_sec * 1000L + diff.tv_nsec / 1000000L;
 
-    /* a negative delay has occurred (positive clock skew or some
-       timers are faster than the time needed for processing their
-       callbacks) */
-    if (diff.tv_sec < 0 || diff.tv_usec < 0) {
+    /* a negative delay has occurred (some timers are faster than the
+       time needed for processing their callbacks) */
+    if (diff.tv_sec < 0) {
 	/* zero "diff" so the next update is triggered immediately */
-	timerclear(&diff);
-    } else {
-	/* convert "diff" to milliseconds */
-	int time_difference = diff.tv_sec * 1000 + diff.tv_usec / 1000;
-
-	/* if there is a notable difference between "time_difference" and
-	   the next upcoming timer's interval, assume clock skew */
-	if (time_difference > (Timers[next_timer].interval + CLOCK_SKEW_DETECT_TIME_IN_MS)) {
-	    /* extract clock skew from "time_difference" by eliminating
-	       the timer's triggering interval */
-	    int skew = time_difference - Timers[next_timer].interval;
-
-	    /* display an info message to inform the user */
-	    info("Oops, clock skewed by %d ms, updating timestamps...", skew);
-
-	    /* convert clock skew from milliseconds to "timeval"
-	       structure */
-	    struct timeval clock_skew = {
-		.tv_sec = skew / 1000,
-		.tv_usec = (skew % 1000) * 1000
-	    };
-
-	    /* process all timers */
-	    for (timer = 0; timer < nTimers; timer++) {
-		/* skip inactive (i.e. deleted) timers */
-		if (Timers[timer].active == TIMER_INACTIVE)
-		    continue;
-
-		/* correct timer's time stamp by clock skew */
-		timersub(&Timers[timer].when, &clock_skew, &Timers[timer].when);
-	    }
-
-	    /* finally, zero "diff" so the next update is triggered
-	       immediately */
-	    timerclear(&diff);
+	diff.tv_sec = 0;
+	diff.tv_nsec = 0;
+    } else if (time_difference > (Timers[next_timer].interval + CLOCK_SKEW_DETECT_TIME_IN_MS)) {
+	/* if there is a notable difference between "time_difference"
+	   and the next upcoming timer's interval, assume clock skew;
+	   extract clock skew from "time_difference" by eliminating the
+	   timer's triggering interval */
+	long skew = time_difference - Timers[next_timer].interval;
+
+	/* display an info message to inform the user */
+	info("Oops, clock skewed by %ld ms, updating timestamps...", skew);
+
+	/* correct all timers' time stamps by clock skew; as all of them
+	   are moved by the same amount, the heap order is preserved */
+	int pos;
+	for (pos = 0; pos < nHeap; pos++) {
+	    timer_shift(&Timers[Heap[pos]].when, -skew);
 	}
+
+	/* finally, zero "diff" so the next update is triggered
+	   immediately */
+	diff.tv_sec = 0;
+	diff.tv_nsec = 0;
     }
 
     /* set timespec "delay" passed by calling function to "diff" */
-    delay->tv_sec = diff.tv_sec;
-    /* timespec uses nanoseconds instead of microseconds!!! */
-    delay->tv_nsec = diff.tv_usec * 1000;
+    *delay = diff;
 
     /* signal successful timer processing */
     return 0;
@@ -493,10 +698,18 @@ void timer_exit(void)
 {
     /* reset number of allocated timer slots */
     nTimers = 0;
+    nHeap = 0;
+    Free = -1;
+    Buckets = 0;
 
     /* free memory used for storing the timer slots */
     if (Timers != NULL) {
 	free(Timers);
 	Timers = NULL;
     }
+
+    if (Heap != NULL) {
+	free(Heap);
+	Heap = NULL;
+    }
 }
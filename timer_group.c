@@ -67,6 +67,7 @@
 #include "cfg.h"
 #include "timer.h"
 #include "timer_group.h"
+#include "drv_generic.h"
 
 #ifdef WITH_DMALLOC
 #include <dmalloc.h>
@@ -269,7 +270,7 @@ int timer_remove_group(const int interval)
 	    TimerGroups[group].active = TIMER_INACTIVE;
 
 	    /* remove the generic timer that calls this group */
-	    if (timer_remove(timer_process_group, &TimerGroups[group].interval)) {
+	    if (timer_remove(timer_process_group, TimerGroups[group].interval) == 0) {
 		/* signal successful removal of timer group */
 		return 0;
 	    } else {
@@ -351,6 +352,10 @@ void timer_process_group(void *data)
 	return;
     }
 
+    /* collect the display updates of all widgets in this group and
+       send them to the display at once */
+    drv_generic_frame_begin();
+
     /* loop through widgets and search for those matching the timer
        group's update interval */
     for (widget = 0; widget < nTimerGroupWidgets; widget++) {
@@ -375,6 +380,8 @@ void timer_process_group(void *data)
 	    }
 	}
     }
+
+    drv_generic_frame_end();
 }
 
 